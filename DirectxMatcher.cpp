@@ -1,10 +1,13 @@
 // TemplateMatcher.cpp - Hlavný program pre template matching s učením
-// Kompiluj s: cl.exe /O2 /arch:AVX2 TemplateMatcher.cpp /link user32.lib gdi32.lib d3d11.lib dxgi.lib
+// Kompiluj s: cl.exe /O2 /std:c++17 TemplateMatcher.cpp /link user32.lib gdi32.lib d3d11.lib dxgi.lib
+// (bez /arch:AVX2 - kernel sa vyberá za behu podľa CPU)
+// alebo cez CMake: cmake -S . -B build && cmake --build build --config Release
 #define _CRT_SECURE_NO_WARNINGS
 #include <windows.h>
 #include <windowsx.h>
 #include <immintrin.h>  // AVX2
 #include <emmintrin.h>  // SSE2
+#include <intrin.h>  // __cpuidex
 #include <iostream>
 #include <vector>
 #include <string>
@@ -13,10 +16,16 @@
 #include <chrono>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 #include <filesystem>
 #include <sstream>
 #include <iomanip>
 #include <ctime>
+#include <cmath>
 #include <d3d11.h>
 #include <dxgi1_2.h>
 #include <wrl/client.h>
@@ -38,27 +47,59 @@
 #include <random>
 #include <algorithm>
 
+#include "MatcherCore.h"  // Jadro bez závislosti na zachytávaní (FrameView, kernely, MatchFrame)
+
 using Microsoft::WRL::ComPtr;
 
-// ===== KONFIGURÁCIA =====
-constexpr int TEMPLATE_SIZE = 20;  // Veľkosť šablóny 20x20
-constexpr int MAX_TEMPLATES = 500;  // Max počet šablón
-constexpr int SCREEN_WIDTH = 1920;
-constexpr int SCREEN_HEIGHT = 1080;
 std::thread displayThread;
 
 // ===== DESKTOP DUPLICATION API =====
-class DesktopDuplicator {
+class DesktopDuplicator : public FrameSource {
 private:
     ComPtr<ID3D11Device> m_device;
     ComPtr<ID3D11DeviceContext> m_context;
     ComPtr<IDXGIOutputDuplication> m_duplication;
     ComPtr<ID3D11Texture2D> m_stagingTexture;
-    bool m_initialized = false;
+    std::atomic<bool> m_initialized{ false };  // Číta aj CaptureThread mimo g_captureMutex
+    bool m_hasFrame = false;  // Staging texture obsahuje aspoň jednu snímku
+    bool m_mapped = false;
+    uint64_t m_sequence = 0;
+    int m_frameWaitMs = 100;  // Najdlhšie čakanie na novú snímku v AcquireNextFrame
+
+    // Staging texture musí mať rozmery desktopu, inak CopyResource nič neurobí
+    bool EnsureStagingTexture(ID3D11Texture2D* desktopTexture) {
+        D3D11_TEXTURE2D_DESC desktopDesc;
+        desktopTexture->GetDesc(&desktopDesc);
+
+        if (m_stagingTexture) {
+            D3D11_TEXTURE2D_DESC stagingDesc;
+            m_stagingTexture->GetDesc(&stagingDesc);
+            if (stagingDesc.Width == desktopDesc.Width && stagingDesc.Height == desktopDesc.Height) {
+                return true;
+            }
+            m_stagingTexture.Reset();
+            m_hasFrame = false;
+        }
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = desktopDesc.Width;
+        desc.Height = desktopDesc.Height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+        return SUCCEEDED(m_device->CreateTexture2D(&desc, nullptr, &m_stagingTexture));
+    }
     
 public:
     bool Initialize() {
         HRESULT hr;
+        m_duplication.Reset();
+        m_stagingTexture.Reset();
+        m_hasFrame = false;
         
         // Create D3D11 device
         D3D_FEATURE_LEVEL featureLevel;
@@ -107,97 +148,104 @@ public:
             return false;
         }
         
-        // Create staging texture for CPU access
-        D3D11_TEXTURE2D_DESC desc = {};
-        desc.Width = SCREEN_WIDTH;
-        desc.Height = SCREEN_HEIGHT;
-        desc.MipLevels = 1;
-        desc.ArraySize = 1;
-        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-        desc.SampleDesc.Count = 1;
-        desc.Usage = D3D11_USAGE_STAGING;
-        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-        
-        hr = m_device->CreateTexture2D(&desc, nullptr, &m_stagingTexture);
-        if (FAILED(hr)) return false;
-        
         m_initialized = true;
         return true;
     }
     
-    bool CaptureScreen(int x, int y, int width, int height, std::vector<uint8_t>& data) {
-        if (!m_initialized) {
-            // Fallback na GDI ak DXGI zlyhá
-            return CaptureScreenGDI(x, y, width, height, data);
-        }
+    // Bez duplikácie AcquireFrame hneď zlyhá a snímku dodá GDI, tempo potom určuje FramePacer
+    bool WaitsForNewFrame() const override { return m_initialized; }
+    void SetFrameWait(int ms) { m_frameWaitMs = max(ms, 0); }
+
+    // Namapuje celú obrazovku priamo zo staging texture, regióny sú len výrezy
+    bool AcquireFrame(const RECT& area, CapturedFrame& frame) override {
+        if (!m_initialized) return false;
         
         HRESULT hr;
         ComPtr<IDXGIResource> desktopResource;
         DXGI_OUTDUPL_FRAME_INFO frameInfo;
         
-        // Získaj nový frame
-        hr = m_duplication->AcquireNextFrame(100, &frameInfo, &desktopResource);
+        // Získaj nový frame, čaká kým nejaký príde (najviac m_frameWaitMs)
+        hr = m_duplication->AcquireNextFrame(m_frameWaitMs, &frameInfo, &desktopResource);
         if (FAILED(hr)) {
-            if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
-                // Žiadny nový frame, použi posledný
-                return true;
+            if (hr != DXGI_ERROR_WAIT_TIMEOUT) {
+                // Reinicializuj ak treba
+                m_initialized = false;
+                Initialize();
+                return false;
             }
-            // Reinicializuj ak treba
-            m_initialized = false;
-            Initialize();
-            return CaptureScreenGDI(x, y, width, height, data);
+            // Žiadny nový frame, staging texture ešte drží posledný
+            if (!m_hasFrame) return false;
+            frame.isNew = false;
         }
-        
-        // Získaj texture
-        ComPtr<ID3D11Texture2D> desktopTexture;
-        hr = desktopResource.As(&desktopTexture);
-        if (FAILED(hr)) {
+        else {
+            // Získaj texture
+            ComPtr<ID3D11Texture2D> desktopTexture;
+            hr = desktopResource.As(&desktopTexture);
+            if (FAILED(hr) || !EnsureStagingTexture(desktopTexture.Get())) {
+                m_duplication->ReleaseFrame();
+                return false;
+            }
+
+            // Kopíruj do staging texture, frame môžeme hneď vrátiť
+            m_context->CopyResource(m_stagingTexture.Get(), desktopTexture.Get());
             m_duplication->ReleaseFrame();
-            return false;
+
+            m_hasFrame = true;
+            m_sequence++;
+            frame.isNew = true;
         }
         
-        // Kopíruj do staging texture
-        m_context->CopyResource(m_stagingTexture.Get(), desktopTexture.Get());
-        
-        // Map texture pre čítanie
+        // Map texture pre čítanie, ostáva namapovaná do ReleaseFrame
         D3D11_MAPPED_SUBRESOURCE mapped;
         hr = m_context->Map(m_stagingTexture.Get(), 0, D3D11_MAP_READ, 0, &mapped);
-        if (FAILED(hr)) {
-            m_duplication->ReleaseFrame();
-            return false;
-        }
-        
-        // Kopíruj požadovanú oblasť
-        data.resize(width * height * 4);
-        uint8_t* src = (uint8_t*)mapped.pData;
-        uint8_t* dst = data.data();
-        
-        for (int row = 0; row < height; row++) {
-            memcpy(
-                dst + row * width * 4,
-                src + ((y + row) * mapped.RowPitch) + (x * 4),
-                width * 4
-            );
-        }
-        
-        // Cleanup
-        m_context->Unmap(m_stagingTexture.Get(), 0);
-        m_duplication->ReleaseFrame();
-        
+        if (FAILED(hr)) return false;
+        m_mapped = true;
+
+        D3D11_TEXTURE2D_DESC desc;
+        m_stagingTexture->GetDesc(&desc);
+
+        frame.data = (const uint8_t*)mapped.pData;
+        frame.originX = 0;
+        frame.originY = 0;
+        frame.width = desc.Width;
+        frame.height = desc.Height;
+        frame.stride = mapped.RowPitch;
+        frame.sequence = m_sequence;
+        frame.captureTime = std::chrono::steady_clock::now();
         return true;
     }
-    
-    // Fallback GDI capture
-    bool CaptureScreenGDI(int x, int y, int width, int height, std::vector<uint8_t>& data) {
-        data.resize(width * height * 4);
-        
+
+    void ReleaseFrame() override {
+        if (m_mapped) {
+            m_context->Unmap(m_stagingTexture.Get(), 0);
+            m_mapped = false;
+        }
+    }
+
+    const char* Name() const override { return "DXGI (HW)"; }
+};
+
+// GDI capture - jeden BitBlt pre celú požadovanú oblasť
+class GdiFrameSource : public FrameSource {
+private:
+    std::vector<uint8_t> m_buffer;
+    uint64_t m_sequence = 0;
+
+public:
+    bool AcquireFrame(const RECT& area, CapturedFrame& frame) override {
+        int width = area.right - area.left;
+        int height = area.bottom - area.top;
+        if (width <= 0 || height <= 0) return false;
+
+        m_buffer.resize((size_t)width * height * 4);
+
         HDC screenDC = GetDC(NULL);
         HDC memDC = CreateCompatibleDC(screenDC);
         HBITMAP bitmap = CreateCompatibleBitmap(screenDC, width, height);
         HBITMAP oldBitmap = (HBITMAP)SelectObject(memDC, bitmap);
-        
-        BitBlt(memDC, 0, 0, width, height, screenDC, x, y, SRCCOPY);
-        
+
+        BitBlt(memDC, 0, 0, width, height, screenDC, area.left, area.top, SRCCOPY);
+
         BITMAPINFO bmi = { 0 };
         bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
         bmi.bmiHeader.biWidth = width;
@@ -205,696 +253,204 @@ public:
         bmi.bmiHeader.biPlanes = 1;
         bmi.bmiHeader.biBitCount = 32;
         bmi.bmiHeader.biCompression = BI_RGB;
-        
-        GetDIBits(memDC, bitmap, 0, height, data.data(), &bmi, DIB_RGB_COLORS);
-        
+
+        GetDIBits(memDC, bitmap, 0, height, m_buffer.data(), &bmi, DIB_RGB_COLORS);
+
         SelectObject(memDC, oldBitmap);
         DeleteObject(bitmap);
         DeleteDC(memDC);
         ReleaseDC(NULL, screenDC);
-        
+
+        frame.data = m_buffer.data();
+        frame.originX = area.left;
+        frame.originY = area.top;
+        frame.width = width;
+        frame.height = height;
+        frame.stride = width * 4;
+        frame.sequence = ++m_sequence;
+        frame.isNew = true;
+        frame.captureTime = std::chrono::steady_clock::now();
         return true;
     }
-    
-    ~DesktopDuplicator() {
-        if (m_duplication) {
-            m_duplication->ReleaseFrame();
-        }
-    }
-};
-
-// SSE2 template matching s early rejection
-float MatchTemplateSSE2(const uint8_t* image, int imgStride,
-    const uint8_t* tmpl, int tolerance, int earlyPixels) {
-    int totalDiff = 0;
-    int pixelsTested = 0;
-
-    for (int y = 0; y < TEMPLATE_SIZE; y++) {
-        for (int x = 0; x < TEMPLATE_SIZE; x += 4) {
-            // Kontrola či nezájdeme mimo hranice
-            int pixelsToProcess = min(4, TEMPLATE_SIZE - x);
 
-            if (pixelsToProcess == 4) {
-                // Načítaj 4 pixely z obrazu a šablóny
-                __m128i imgPixels = _mm_loadu_si128((__m128i*) & image[y * imgStride + x * 4]);
-                __m128i tmplPixels = _mm_loadu_si128((__m128i*) & tmpl[y * TEMPLATE_SIZE * 4 + x * 4]);
+    void ReleaseFrame() override {}
 
-                // Vypočítaj absolútne rozdiely
-                __m128i diff = _mm_sad_epu8(imgPixels, tmplPixels);
+    const char* Name() const override { return "GDI"; }
+};
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002  // Windows 10 1803+, staršie SDK ho nemajú
+#endif
 
-                // Akumuluj rozdiely
-                totalDiff += _mm_cvtsi128_si32(diff) + _mm_extract_epi32(diff, 2);
-                pixelsTested += 4;
-            }
-            else {
-                // Spracuj zvyšné pixely manuálne
-                for (int i = 0; i < pixelsToProcess; i++) {
-                    for (int c = 0; c < 4; c++) {
-                        int imgVal = image[y * imgStride + (x + i) * 4 + c];
-                        int tmplVal = tmpl[y * TEMPLATE_SIZE * 4 + (x + i) * 4 + c];
-                        totalDiff += abs(imgVal - tmplVal);
-                    }
-                    pixelsTested++;
-                }
-            }
+// Tempo zachytávania podľa TargetFPS. Čaká na high-resolution waitable timer,
+// Sleep má granularitu ~15 ms a 60 FPS by s ním nebolo presných.
+class FramePacer {
+private:
+    HANDLE m_timer = nullptr;
+    std::chrono::steady_clock::time_point m_nextCapture;
 
-            // Early rejection
-            if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4) {
-                return FLT_MAX;
-            }
-        }
+public:
+    FramePacer() {
+        m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (!m_timer) m_timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);  // Staršie Windows
     }
 
-    return (float)totalDiff / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
-}
-
-
-
-// AVX2 template matching s early rejection
-float MatchTemplateAVX2(const uint8_t* image, int imgStride,
-    const uint8_t* tmpl, int tolerance, int earlyPixels) {
-    int totalDiff = 0;
-    int pixelsTested = 0;
-
-    for (int y = 0; y < TEMPLATE_SIZE; y++) {
-        int x = 0;
-
-        // Spracuj po 8 pixelov pokiaľ môžeme
-        for (; x <= TEMPLATE_SIZE - 8; x += 8) {
-            __m256i imgPixels = _mm256_loadu_si256((__m256i*) & image[y * imgStride + x * 4]);
-            __m256i tmplPixels = _mm256_loadu_si256((__m256i*) & tmpl[y * TEMPLATE_SIZE * 4 + x * 4]);
-
-            __m256i diff = _mm256_sad_epu8(imgPixels, tmplPixels);
-
-            totalDiff += _mm256_extract_epi32(diff, 0) + _mm256_extract_epi32(diff, 2) +
-                _mm256_extract_epi32(diff, 4) + _mm256_extract_epi32(diff, 6);
-
-            pixelsTested += 8;
-
-            // Early rejection
-            if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4) {
-                return FLT_MAX;
-            }
-        }
-
-        // Dokonči zvyšné pixely pomocou SSE2
-        for (; x < TEMPLATE_SIZE; x += 4) {
-            __m128i imgPixels = _mm_loadu_si128((__m128i*) & image[y * imgStride + x * 4]);
-            __m128i tmplPixels = _mm_loadu_si128((__m128i*) & tmpl[y * TEMPLATE_SIZE * 4 + x * 4]);
-
-            __m128i diff = _mm_sad_epu8(imgPixels, tmplPixels);
-            totalDiff += _mm_cvtsi128_si32(diff) + _mm_extract_epi32(diff, 2);
-
-            pixelsTested += 4;
-        }
+    ~FramePacer() {
+        if (m_timer) CloseHandle(m_timer);
     }
 
-    return (float)totalDiff / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
-}
-// ===== PYRAMÍDOVÉ VYHĽADÁVANIE =====
-class PyramidSearch {
-private:
-    // Zmenší obraz na polovicu
-    std::vector<uint8_t> DownsampleImage(const uint8_t* src, int srcWidth, int srcHeight) {
-        int dstWidth = srcWidth / 2;
-        int dstHeight = srcHeight / 2;
-        std::vector<uint8_t> dst(dstWidth * dstHeight * 4);
-        
-        // Použiť AVX2 pre rýchle downsampling
-        for (int y = 0; y < dstHeight; y++) {
-            for (int x = 0; x < dstWidth; x++) {
-                int srcX = x * 2;
-                int srcY = y * 2;
-                
-                // Priemer 2x2 oblasti
-                for (int c = 0; c < 4; c++) {
-                    int sum = 0;
-                    sum += src[(srcY * srcWidth + srcX) * 4 + c];
-                    sum += src[(srcY * srcWidth + srcX + 1) * 4 + c];
-                    sum += src[((srcY + 1) * srcWidth + srcX) * 4 + c];
-                    sum += src[((srcY + 1) * srcWidth + srcX + 1) * 4 + c];
-                    
-                    dst[(y * dstWidth + x) * 4 + c] = sum / 4;
-                }
-            }
-        }
-        
-        return dst;
-    }
-    
-    struct Candidate {
-        int x, y;
-        float score;
-    };
-    
-public:
-    std::vector<Candidate> SearchPyramid(
-        const uint8_t* image, int imgWidth, int imgHeight,
-        const uint8_t* tmpl, int tmplSize,
-        int tolerance, int earlyPixels, bool useAVX2) 
-    {
-        std::vector<Candidate> candidates;
-        
-        // Level 0 - polovičná veľkosť
-        auto smallImage = DownsampleImage(image, imgWidth, imgHeight);
-        auto smallTemplate = DownsampleImage(tmpl, tmplSize, tmplSize);
-        
-        int smallImgWidth = imgWidth / 2;
-        int smallImgHeight = imgHeight / 2;
-        int smallTmplSize = tmplSize / 2;
-        
-        // Rýchle vyhľadávanie v malom
-        for (int y = 0; y <= smallImgHeight - smallTmplSize; y += 2) {
-            for (int x = 0; x <= smallImgWidth - smallTmplSize; x += 2) {
-                float score = QuickMatch(
-                    &smallImage[(y * smallImgWidth + x) * 4],
-                    smallImgWidth * 4,
-                    smallTemplate.data(),
-                    smallTmplSize,
-                    tolerance * 2  // Voľnejšia tolerancia pre malý obraz
-                );
-                
-                if (score < tolerance * 2) {
-                    // Kandidát nájdený, prepočítaj na plnú veľkosť
-                    candidates.push_back({x * 2, y * 2, score});
-                }
+    // Počká do termínu ďalšieho zachytenia. Po oneskorení sa termíny
+    // nedobiehajú, ďalší je o periódu od teraz.
+    void WaitForNextCapture(int targetFPS) {
+        if (targetFPS <= 0) return;
+        auto now = std::chrono::steady_clock::now();
+
+        if (m_nextCapture > now) {
+            LARGE_INTEGER due;
+            due.QuadPart = -(LONGLONG)(std::chrono::duration_cast<std::chrono::nanoseconds>(m_nextCapture - now).count() / 100);
+            if (m_timer && SetWaitableTimer(m_timer, &due, 0, nullptr, nullptr, FALSE)) {
+                WaitForSingleObject(m_timer, INFINITE);
             }
-        }
-        
-        return candidates;
-    }
-    
-    // Verifikuj kandidátov v plnej veľkosti
-    float VerifyCandidate(
-        const uint8_t* image, int imgStride,
-        const uint8_t* tmpl, int tmplSize,
-        int x, int y, int tolerance, bool useAVX2) 
-    {
-        // Použiť existujúce AVX2/SSE2 funkcie
-        if (useAVX2) {
-            return MatchTemplateAVX2(
-                &image[(y * imgStride/4 + x) * 4],
-                imgStride,
-                tmpl,
-                tolerance,
-                100
-            );
-        } else {
-            return MatchTemplateSSE2(
-                &image[(y * imgStride/4 + x) * 4],
-                imgStride,
-                tmpl,
-                tolerance,
-                100
-            );
-        }
-    }
-    
-private:
-    // Rýchle porovnanie pre pyramídu
-    float QuickMatch(const uint8_t* img, int stride, const uint8_t* tmpl, int size, int tolerance) {
-        int diff = 0;
-        int pixels = 0;
-        
-        // Testuj len každý druhý pixel
-        for (int y = 0; y < size; y += 2) {
-            for (int x = 0; x < size; x += 2) {
-                for (int c = 0; c < 4; c++) {
-                    diff += abs(img[y * stride + x * 4 + c] - tmpl[y * size * 4 + x * 4 + c]);
-                }
-                pixels++;
-                
-                if (pixels > 10 && diff > tolerance * pixels * 4) {
-                    return FLT_MAX;
-                }
+            else {
+                std::this_thread::sleep_until(m_nextCapture);
             }
+            now = m_nextCapture;
         }
-        
-        return (float)diff / (pixels * 4);
-    }
-};
 
-// ===== GLOBÁLNE PREMENNÉ =====
-struct Template {
-    std::vector<uint8_t> data;  // BGRA data (4 bajty na pixel)
-    std::string filename;
-    int width = TEMPLATE_SIZE;
-    int height = TEMPLATE_SIZE;
-    bool active = true;  // Či sa má testovať
-};
-
-struct SearchRegion {
-    int x, y, width, height;
-    std::string name;
-    bool active = true;
-};
-
-struct MatchResult {
-    int templateId;
-    int x, y;
-    float score;
-    std::chrono::steady_clock::time_point timestamp;
+        m_nextCapture = now + std::chrono::microseconds(1000000 / targetFPS);
+    }
 };
 
-void DrawHitVisualization();
-
-// Globálne nastavenia
-struct Settings {
-    bool clickOnMatch = false;
-    bool doubleClick = false;
-    int tolerance = 10;  // 0-255, nižšie = presnejšie
-    int earlyPixelCount = 100;  // Počet pixelov pre early rejection
-    bool randomPixelTest = false;  // Random vs sekvenčné testovanie
-    bool useAVX2 = true;  // AVX2 vs SSE2
-    bool showFPS = true;
-    bool enableLearning = true;
-    bool usePyramidSearch = true;  // Nové - pyramídové vyhľadávanie
-    bool useDXGI = true;  // Nové - použiť DXGI capture
-    int currentRegionSet = 0;  // Ktorý set regiónov používame
-} g_settings;
-
-// Globálne dáta
-std::vector<Template> g_templates;
-std::vector<SearchRegion> g_searchRegions;
-std::vector<MatchResult> g_lastMatches;
-std::atomic<bool> g_running(true);
-std::atomic<int> g_fps(0);
-std::atomic<float> g_lastProcessTime(0.0f);
-std::atomic<bool> g_searchActive(false);
-std::atomic<int> g_currentMatchIndex(0);
-
 // Desktop duplicator instance
 DesktopDuplicator g_desktopDuplicator;
-PyramidSearch g_pyramidSearch;
-
-// Učenie - štatistiky pre každú šablónu
-struct TemplateStats {
-    int hitCount = 0;
-    std::vector<POINT> hitPositions;  // História pozícií
-    POINT avgPosition = { 0, 0 };
-    float probability = 0.0f;
-    int regionPreference[10] = { 0 };  // Ktoré regióny preferuje
-    std::chrono::steady_clock::time_point lastHitTime;
-};
-std::vector<TemplateStats> g_templateStats;
-
-// ===== POMOCNÉ FUNKCIE =====
+GdiFrameSource g_gdiFrameSource;
 
-// Načíta BMP súbor (32-bit BGRA)
-bool LoadBMP32(const std::string& filename, std::vector<uint8_t>& data, int& width, int& height) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) return false;
-
-    // BMP header
-    char header[54];
-    file.read(header, 54);
-
-    width = *(int*)&header[18];
-    height = *(int*)&header[22];
-    int bpp = *(short*)&header[28];
-
-    if (bpp != 32) {
-        std::cerr << "Podporované sú len 32-bit BMP súbory!" << std::endl;
-        return false;
-    }
-
-    // Načítaj pixel data
-    int dataSize = width * height * 4;
-    data.resize(dataSize);
-    file.seekg(*(int*)&header[10], std::ios::beg);
-    file.read((char*)data.data(), dataSize);
-
-    // BMP je uložené bottom-up, pretoč to
-    for (int y = 0; y < height / 2; y++) {
-        for (int x = 0; x < width * 4; x++) {
-            std::swap(data[y * width * 4 + x],
-                data[(height - 1 - y) * width * 4 + x]);
-        }
-    }
-
-    return true;
-}
-
-// Uloží 32-bit BMP
-bool SaveBMP32(const std::string& filename, const uint8_t* data, int width, int height) {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) return false;
-
-    // BMP header
-    int fileSize = 54 + width * height * 4;
-    char header[54] = { 0 };
-
-    // Signature
-    header[0] = 'B'; header[1] = 'M';
-    // File size
-    *(int*)&header[2] = fileSize;
-    // Data offset
-    *(int*)&header[10] = 54;
-    // Info header size
-    *(int*)&header[14] = 40;
-    // Width, height
-    *(int*)&header[18] = width;
-    *(int*)&header[22] = height;
-    // Planes
-    *(short*)&header[26] = 1;
-    // BPP
-    *(short*)&header[28] = 32;
-
-    file.write(header, 54);
-
-    // Zapíš pixel data (bottom-up)
-    for (int y = height - 1; y >= 0; y--) {
-        file.write((char*)&data[y * width * 4], width * 4);
-    }
-
-    return true;
-}
-
-void LoadConfig(const std::string& filename = "config.ini") {
-    std::ifstream file(filename);
-    if (!file) return;
-
-    std::string line;
-    while (std::getline(file, line)) {
-        if (line.find("=") != std::string::npos) {
-            std::string key = line.substr(0, line.find("="));
-            std::string value = line.substr(line.find("=") + 1);
-
-            if (key == "ClickOnMatch") g_settings.clickOnMatch = std::stoi(value);
-            else if (key == "DoubleClick") g_settings.doubleClick = std::stoi(value);
-            else if (key == "Tolerance") g_settings.tolerance = std::stoi(value);
-            else if (key == "EarlyPixelCount") g_settings.earlyPixelCount = std::stoi(value);
-            else if (key == "RandomPixelTest") g_settings.randomPixelTest = std::stoi(value);
-            else if (key == "UseAVX2") g_settings.useAVX2 = std::stoi(value);
-            else if (key == "ShowFPS") g_settings.showFPS = std::stoi(value);
-            else if (key == "EnableLearning") g_settings.enableLearning = std::stoi(value);
-            else if (key == "UsePyramidSearch") g_settings.usePyramidSearch = std::stoi(value);
-            else if (key == "UseDXGI") g_settings.useDXGI = std::stoi(value);
+// Sleduje ./obr/ a pri zmene súborov postaví novú sadu na pozadí
+class TemplateWatcher {
+private:
+    std::thread m_thread;
+    std::atomic<bool> m_stop{ false };
+
+    void Run(std::string path) {
+        HANDLE change = FindFirstChangeNotificationA(path.c_str(), FALSE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+        if (change == INVALID_HANDLE_VALUE) {
+            std::cout << "Sledovanie " << path << " nie je dostupné." << std::endl;
+            return;
         }
-    }
-}
 
-void SaveConfig(const std::string& filename = "config.ini") {
-    std::ofstream file(filename);
-    if (!file) return;
+        while (!m_stop) {
+            if (WaitForSingleObject(change, 200) != WAIT_OBJECT_0) continue;
 
-    file << "[Settings]\n";
-    file << "ClickOnMatch=" << g_settings.clickOnMatch << "\n";
-    file << "DoubleClick=" << g_settings.doubleClick << "\n";
-    file << "Tolerance=" << g_settings.tolerance << "\n";
-    file << "EarlyPixelCount=" << g_settings.earlyPixelCount << "\n";
-    file << "RandomPixelTest=" << g_settings.randomPixelTest << "\n";
-    file << "UseAVX2=" << g_settings.useAVX2 << "\n";
-    file << "ShowFPS=" << g_settings.showFPS << "\n";
-    file << "EnableLearning=" << g_settings.enableLearning << "\n";
-    file << "UsePyramidSearch=" << g_settings.usePyramidSearch << "\n";
-    file << "UseDXGI=" << g_settings.useDXGI << "\n";
-}
+            // Počkaj kým sa zápisy utíšia (najviac ~3 s), jedna zmena často
+            // príde ako viac notifikácií
+            int quietWaits = 0;
+            do {
+                FindNextChangeNotification(change);
+            } while (!m_stop && ++quietWaits < 10 && WaitForSingleObject(change, 300) == WAIT_OBJECT_0);
 
-// Uloženie štatistík učenia
-void SaveLearningStats(const std::string& filename = "learning_stats.dat") {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file) return;
-
-    // Ulož počet šablón
-    size_t count = g_templateStats.size();
-    file.write((char*)&count, sizeof(count));
-
-    // Pre každú šablónu
-    for (size_t i = 0; i < count; i++) {
-        const auto& stats = g_templateStats[i];
-
-        // Ulož základné dáta
-        file.write((char*)&stats.hitCount, sizeof(stats.hitCount));
-        file.write((char*)&stats.avgPosition, sizeof(stats.avgPosition));
-        file.write((char*)&stats.probability, sizeof(stats.probability));
-
-        // Ulož históriu pozícií (max posledných 100)
-        size_t histSize = min(stats.hitPositions.size(), (size_t)100);
-        file.write((char*)&histSize, sizeof(histSize));
-
-        // Ulož len posledných 100 pozícií
-        size_t startIdx = stats.hitPositions.size() > 100 ? stats.hitPositions.size() - 100 : 0;
-        for (size_t j = startIdx; j < stats.hitPositions.size(); j++) {
-            file.write((char*)&stats.hitPositions[j], sizeof(POINT));
+            if (!m_stop) ReloadTemplates();
         }
 
-        // Ulož čas posledného hitu (ako počet sekúnd od epochy)
-        auto timeSinceEpoch = stats.lastHitTime.time_since_epoch();
-        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeSinceEpoch).count();
-        file.write((char*)&seconds, sizeof(seconds));
+        FindCloseChangeNotification(change);
     }
 
-    std::cout << "Štatistiky učenia uložené do: " << filename << std::endl;
-}
-
-// Načítanie štatistík učenia
-void LoadLearningStats(const std::string& filename = "learning_stats.dat") {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cout << "Súbor so štatistikami neexistuje, začínam s prázdnymi." << std::endl;
-        return;
+public:
+    void Start(const std::string& path) {
+        m_stop = false;
+        m_thread = std::thread(&TemplateWatcher::Run, this, path);
     }
 
-    size_t count;
-    file.read((char*)&count, sizeof(count));
-
-    // Uisti sa že máme správny počet štatistík
-    g_templateStats.resize(max(count, g_templates.size()));
-
-    for (size_t i = 0; i < count && i < g_templateStats.size(); i++) {
-        auto& stats = g_templateStats[i];
-
-        // Načítaj základné dáta
-        file.read((char*)&stats.hitCount, sizeof(stats.hitCount));
-        file.read((char*)&stats.avgPosition, sizeof(stats.avgPosition));
-        file.read((char*)&stats.probability, sizeof(stats.probability));
-
-        // Načítaj históriu
-        size_t histSize;
-        file.read((char*)&histSize, sizeof(histSize));
-
-        stats.hitPositions.clear();
-        for (size_t j = 0; j < histSize; j++) {
-            POINT p;
-            file.read((char*)&p, sizeof(POINT));
-            stats.hitPositions.push_back(p);
-        }
-
-        // Načítaj čas
-        long long seconds;
-        file.read((char*)&seconds, sizeof(seconds));
-        stats.lastHitTime = std::chrono::steady_clock::time_point(std::chrono::seconds(seconds));
+    void Stop() {
+        m_stop = true;
+        if (m_thread.joinable()) m_thread.join();
     }
+};
+TemplateWatcher g_templateWatcher;
 
-    std::cout << "Načítané štatistiky pre " << count << " šablón." << std::endl;
+// Zdroj snímok podľa nastavení
+FrameSource* ActiveFrameSource(const Settings& settings) {
+    if (!settings.frameSourcePath.empty() && g_fileFrameSource.IsOpen()) return &g_fileFrameSource;
+    if (settings.useDXGI) return &g_desktopDuplicator;
+    return &g_gdiFrameSource;
 }
 
-// Načíta všetky obrázky z adresára
-void LoadTemplates() {
-    g_templates.clear();
-    g_templateStats.clear();
-    
-    // Načítaj štatistiky učenia
-    LoadLearningStats();
-    
-    // Načítaj konfiguráciu
-    LoadConfig();
-    
-    std::string path = "./obr/";
-
-    // Vytvor adresár ak neexistuje
-    std::filesystem::create_directories(path);
-
-    // Načítaj všetky .bmp súbory
-    for (const auto& entry : std::filesystem::directory_iterator(path)) {
-        if (entry.path().extension() == ".bmp") {
-            Template tmpl;
-            int width, height;
-
-            if (LoadBMP32(entry.path().string(), tmpl.data, width, height)) {
-                if (width == TEMPLATE_SIZE && height == TEMPLATE_SIZE) {
-                    tmpl.filename = entry.path().filename().string();
-                    tmpl.width = width;
-                    tmpl.height = height;
-                    g_templates.push_back(tmpl);
-                    g_templateStats.push_back(TemplateStats());
-
-                    std::cout << "Načítaná šablóna: " << tmpl.filename << std::endl;
-                }
-            }
-        }
+// Zachytí jednu snímku pokrývajúcu area. Pri zlyhaní DXGI skúsi GDI.
+// Volajúci drží g_captureMutex, lease.source uvoľní snímku.
+bool AcquireFrame(const Settings& settings, const RECT& area, CapturedFrame& frame, FrameLease& lease) {
+    FrameSource* source = ActiveFrameSource(settings);
+    if (!source->AcquireFrame(area, frame)) {
+        if (source != &g_desktopDuplicator) return false;
+        source = &g_gdiFrameSource;
+        if (!source->AcquireFrame(area, frame)) return false;
     }
 
-    std::cout << "Načítaných šablón: " << g_templates.size() << std::endl;
+    lease.source = source;
+    return true;
 }
 
 // Zachytí screenshot
 std::vector<uint8_t> CaptureScreen(int x, int y, int width, int height) {
-    std::vector<uint8_t> data;
-    
-    if (g_settings.useDXGI) {
-        if (g_desktopDuplicator.CaptureScreen(x, y, width, height, data)) {
-            return data;
-        }
-    }
-    
-    // Fallback na GDI
-    data.resize(width * height * 4);
-
-    HDC screenDC = GetDC(NULL);
-    HDC memDC = CreateCompatibleDC(screenDC);
-    HBITMAP bitmap = CreateCompatibleBitmap(screenDC, width, height);
-    HBITMAP oldBitmap = (HBITMAP)SelectObject(memDC, bitmap);
-
-    BitBlt(memDC, 0, 0, width, height, screenDC, x, y, SRCCOPY);
-
-    BITMAPINFO bmi = { 0 };
-    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    bmi.bmiHeader.biWidth = width;
-    bmi.bmiHeader.biHeight = -height;  // Top-down
-    bmi.bmiHeader.biPlanes = 1;
-    bmi.bmiHeader.biBitCount = 32;
-    bmi.bmiHeader.biCompression = BI_RGB;
+    std::vector<uint8_t> data((size_t)width * height * 4, 0);
 
-    GetDIBits(memDC, bitmap, 0, height, data.data(), &bmi, DIB_RGB_COLORS);
+    std::lock_guard<std::mutex> captureLock(g_captureMutex);
+    CapturedFrame frame;
+    FrameLease lease;
+    if (!AcquireFrame(g_settings, { x, y, x + width, y + height }, frame, lease)) {
+        return data;
+    }
 
-    SelectObject(memDC, oldBitmap);
-    DeleteObject(bitmap);
-    DeleteDC(memDC);
-    ReleaseDC(NULL, screenDC);
+    // Skopíruj časť ktorá leží v snímke, zvyšok ostane čierny
+    FrameView view;
+    if (frame.View(x, y, width, height, view)) {
+        for (int row = 0; row < view.height; row++) {
+            memcpy(
+                &data[((size_t)(view.y - y + row) * width + (view.x - x)) * 4],
+                view.Pixel(0, row),
+                (size_t)view.width * 4
+            );
+        }
+    }
 
     return data;
 }
 
+enum CaptureResult {
+    CAPTURE_FAILED,
+    CAPTURE_UNCHANGED,  // Zdroj vrátil snímku skipSequence
+    CAPTURE_NEW
+};
 
-
-
-
-// Hlavná funkcia pre hľadanie šablón
-void FindTemplates() {
-    auto startTime = std::chrono::steady_clock::now();
-
-    g_lastMatches.clear();
-
-    // Pre každý región
-    for (const auto& region : g_searchRegions) {
-        if (!region.active) continue;
-
-        // Zachyť screenshot regiónu
-        auto screenshot = CaptureScreen(region.x, region.y, region.width, region.height);
-
-        // Hľadaj každú šablónu
-        for (int t = 0; t < g_templates.size(); t++) {
-            if (!g_templates[t].active) continue;
-
-            float bestScore = FLT_MAX;
-            int bestX = -1, bestY = -1;
-
-            if (g_settings.usePyramidSearch) {
-                // Pyramídové vyhľadávanie
-                auto candidates = g_pyramidSearch.SearchPyramid(
-                    screenshot.data(), region.width, region.height,
-                    g_templates[t].data.data(), TEMPLATE_SIZE,
-                    g_settings.tolerance, g_settings.earlyPixelCount, g_settings.useAVX2
-                );
-                
-                // Verifikuj kandidátov
-                for (const auto& candidate : candidates) {
-                    // Zabezpeč že kandidát je v rámci hraníc
-                    int x = min(max(candidate.x, 0), region.width - TEMPLATE_SIZE);
-                    int y = min(max(candidate.y, 0), region.height - TEMPLATE_SIZE);
-                    
-                    float score = g_pyramidSearch.VerifyCandidate(
-                        screenshot.data(), region.width * 4,
-                        g_templates[t].data.data(), TEMPLATE_SIZE,
-                        x, y, g_settings.tolerance, g_settings.useAVX2
-                    );
-                    
-                    if (score < bestScore) {
-                        bestScore = score;
-                        bestX = x;
-                        bestY = y;
-                    }
-                }
-            } else {
-                // Štandardné vyhľadávanie
-                for (int y = 0; y <= region.height - TEMPLATE_SIZE; y++) {
-                    for (int x = 0; x <= region.width - TEMPLATE_SIZE; x++) {
-                        float score;
-
-                        if (g_settings.useAVX2) {
-                            score = MatchTemplateAVX2(
-                                &screenshot[(y * region.width + x) * 4],
-                                region.width * 4,
-                                g_templates[t].data.data(),
-                                g_settings.tolerance,
-                                g_settings.earlyPixelCount
-                            );
-                        }
-                        else {
-                            score = MatchTemplateSSE2(
-                                &screenshot[(y * region.width + x) * 4],
-                                region.width * 4,
-                                g_templates[t].data.data(),
-                                g_settings.tolerance,
-                                g_settings.earlyPixelCount
-                            );
-                        }
-
-                        if (score < bestScore) {
-                            bestScore = score;
-                            bestX = x;
-                            bestY = y;
-                        }
-                    }
-                }
-            }
-
-            // Ak sme našli dobrú zhodu
-            if (bestScore < g_settings.tolerance) {
-                MatchResult match;
-                match.templateId = t;
-                match.x = region.x + bestX + TEMPLATE_SIZE / 2;  // Stred šablóny
-                match.y = region.y + bestY + TEMPLATE_SIZE / 2;
-                match.score = bestScore;
-                match.timestamp = std::chrono::steady_clock::now();
-
-                g_lastMatches.push_back(match);
-
-                // Aktualizuj štatistiky (učenie)
-                if (g_settings.enableLearning) {
-                    g_templateStats[t].hitCount++;
-                    g_templateStats[t].lastHitTime = std::chrono::steady_clock::now();
-                    g_templateStats[t].hitPositions.push_back({ match.x, match.y });
-
-                    // Prepočítaj priemernú pozíciu
-                    long sumX = 0, sumY = 0;
-                    for (const auto& pos : g_templateStats[t].hitPositions) {
-                        sumX += pos.x;
-                        sumY += pos.y;
-                    }
-                    g_templateStats[t].avgPosition.x = (LONG)(sumX / g_templateStats[t].hitPositions.size());
-                    g_templateStats[t].avgPosition.y = (LONG)(sumY / g_templateStats[t].hitPositions.size());
-                }
-            }
-        }
+// Skopíruje oblasť regiónov do buffra z poolu. Zdroj snímky sa uvoľní hneď
+// po kópii, ďalšie zachytenie tak môže bežať počas hľadania v tejto snímke.
+// Snímka s číslom skipSequence (už spracovaná) sa nekopíruje.
+CaptureResult CaptureToPool(PooledFrame& pooled, const RECT& area, uint64_t skipSequence) {
+    std::lock_guard<std::mutex> captureLock(g_captureMutex);
+    CapturedFrame frame;
+    FrameLease lease;
+    if (area.right <= area.left || !AcquireFrame(g_settings, area, frame, lease)) return CAPTURE_FAILED;
+    if (frame.sequence == skipSequence) return CAPTURE_UNCHANGED;
+
+    FrameView view;
+    if (!frame.View(area.left, area.top, area.right - area.left, area.bottom - area.top, view)) return CAPTURE_FAILED;
+
+    // Riadky zarovnané na cache line, buffer sa zväčší len pri väčšej oblasti
+    int stride = (view.width * 4 + (int)sizeof(CacheLine) - 1) / (int)sizeof(CacheLine) * (int)sizeof(CacheLine);
+    size_t lines = (size_t)stride * view.height / sizeof(CacheLine);
+    if (pooled.storage.size() < lines) pooled.storage.resize(lines);
+
+    uint8_t* dst = pooled.storage.data()->bytes;
+    for (int row = 0; row < view.height; row++) {
+        memcpy(dst + (size_t)row * stride, view.Pixel(0, row), (size_t)view.width * 4);
     }
 
-    // Aktualizuj FPS       
-    auto endTime = std::chrono::steady_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
-    g_lastProcessTime = duration.count() / 1000.0f;  // ms
-
-    static int frameCount = 0;
-    static auto lastFPSUpdate = std::chrono::steady_clock::now();
-    frameCount++;
-
-    if (std::chrono::duration_cast<std::chrono::seconds>(endTime - lastFPSUpdate).count() >= 1) {
-        g_fps = frameCount;
-        frameCount = 0;
-        lastFPSUpdate = endTime;
-    }
+    pooled.frame = frame;
+    pooled.frame.data = dst;
+    pooled.frame.originX = view.x;
+    pooled.frame.originY = view.y;
+    pooled.frame.width = view.width;
+    pooled.frame.height = view.height;
+    pooled.frame.stride = stride;
+    return CAPTURE_NEW;
 }
 
 // Klikni na pozíciu
@@ -1040,17 +596,23 @@ void CaptureTemplateAtMouse() {
     auto time_t = std::chrono::system_clock::to_time_t(now);
     std::stringstream ss;
     ss << "./obr/template_" << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S")
-        << "_" << g_templates.size() << ".bmp";
+        << "_" << AcquireTemplateSet()->templates.size() << ".bmp";
 
     if (SaveBMP32(ss.str(), screenshot.data(), TEMPLATE_SIZE, TEMPLATE_SIZE)) {
         // Pridaj do zoznamu šablón
         Template tmpl;
-        tmpl.data = screenshot;
-        tmpl.filename = ss.str();
+        tmpl.filename = std::filesystem::path(ss.str()).filename().string();  // Ako LoadTemplateSet, kľúč RemapTemplateStats
         tmpl.width = TEMPLATE_SIZE;
         tmpl.height = TEMPLATE_SIZE;
-        g_templates.push_back(tmpl);
-        g_templateStats.push_back(TemplateStats());
+        PrepareTemplate(tmpl, screenshot.data());
+
+        // Nová verzia = kópia aktuálnej + šablóna, watcher ju neskôr len znovu načíta
+        {
+            std::lock_guard<std::mutex> lock(g_templateWriteMutex);
+            auto set = std::make_shared<TemplateSet>(*AcquireTemplateSet());
+            set->templates.push_back(tmpl);
+            PublishTemplateSet(set);
+        }
 
         std::cout << "Šablóna uložená: " << ss.str() << std::endl;
     }
@@ -1062,7 +624,8 @@ void DrawHitVisualization() {
     HPEN pen = CreatePen(PS_SOLID, 3, RGB(255, 0, 0));
     HPEN oldPen = (HPEN)SelectObject(screenDC, pen);
     
-    for (const auto& match : g_lastMatches) {
+    const auto batch = g_matchPublisher.Latest();
+    for (const auto& match : batch->matches) {
         // Nakresli krížik
         MoveToEx(screenDC, match.x - 10, match.y, NULL);
         LineTo(screenDC, match.x + 10, match.y);
@@ -1071,10 +634,10 @@ void DrawHitVisualization() {
         
         // Obdĺžnik okolo
         Rectangle(screenDC, 
-            match.x - TEMPLATE_SIZE/2, 
-            match.y - TEMPLATE_SIZE/2,
-            match.x + TEMPLATE_SIZE/2,
-            match.y + TEMPLATE_SIZE/2);
+            match.x - match.width/2, 
+            match.y - match.height/2,
+            match.x + match.width/2,
+            match.y + match.height/2);
     }
     
     SelectObject(screenDC, oldPen);
@@ -1089,14 +652,28 @@ void ShowMenu() {
     std::cout << "2. Nastaviť klikanie (aktuálne: " << (g_settings.clickOnMatch ? "ZAP" : "VYP") << ")\n";
     std::cout << "3. Prepnúť double-click (aktuálne: " << (g_settings.doubleClick ? "ZAP" : "VYP") << ")\n";
     std::cout << "4. Tolerancia: " << g_settings.tolerance << " (T/Y pre zmenu)\n";
-    std::cout << "5. Early pixels: " << g_settings.earlyPixelCount << " (E/R pre zmenu)\n";
-    std::cout << "6. Prepnúť AVX2/SSE2 (aktuálne: " << (g_settings.useAVX2 ? "AVX2" : "SSE2") << ")\n";
+    std::cout << "5. Early pixels: " << g_settings.earlyPixelCount;
+    if (g_settings.randomPixelTest) std::cout << " (v diskriminačnom poradí " << OrderedEarlyPixels(g_settings.earlyPixelCount) << ")";
+    std::cout << " (E/R pre zmenu)\n";
+    std::cout << "6. Prepnúť kernel (aktuálne: " << GetKernels(g_settings.kernelLevel).name
+        << (g_settings.kernelLevel == KERNEL_AUTO ? ", auto" : "") << ")\n";
     std::cout << "7. Vytvoriť nový región myšou\n";
     std::cout << "8. Uložiť regióny\n";
     std::cout << "9. Načítať regióny\n";
     std::cout << "0. Zobraziť FPS (aktuálne: " << (g_settings.showFPS ? "ZAP" : "VYP") << ")\n";
     std::cout << "P. Pyramídové vyhľadávanie (aktuálne: " << (g_settings.usePyramidSearch ? "ZAP" : "VYP") << ")\n";
     std::cout << "D. DXGI Capture (aktuálne: " << (g_settings.useDXGI ? "ZAP" : "VYP") << ")\n";
+    std::cout << "B. Dávkový kernel (aktuálne: " << (g_settings.useBatchedKernel ? "ZAP" : "VYP") << ")\n";
+    std::cout << "S. SEA prefilter (aktuálne: úrovne " << g_settings.seaLevels << ")\n";
+    std::cout << "K. Sledovanie zhôd (aktuálne: " << (g_settings.useTracking ? "ZAP" : "VYP") << ")\n";
+    std::cout << "O. Naučené oblasti šablón (aktuálne: " << (g_settings.useSpatialPriors ? "ZAP" : "VYP") << ")\n";
+    std::cout << "I. Všetky výskyty šablóny (aktuálne: " << (g_settings.multiInstance ?
+        "ZAP, najviac " + std::to_string(g_settings.maxInstances) : std::string("VYP")) << ")\n";
+    std::cout << "H. Presná zhoda cez hash okien (aktuálne: " << (g_settings.exactMatch ? "ZAP" : "VYP") << ")\n";
+    std::cout << "L. Strom zhlukov šablón (aktuálne: " << (g_settings.useClusterTree ? "ZAP" : "VYP") << ")\n";
+    std::cout << "C. Kanály (aktuálne: " << CHANNEL_MODE_NAMES[g_settings.channelMode] << ")\n";
+    std::cout << "X. Diskriminačné poradie pixelov (aktuálne: " << (g_settings.randomPixelTest ? "ZAP" : "VYP") << ")\n";
+    std::cout << "Z. Len zmenené dlaždice (aktuálne: " << (g_settings.useDirtyTiles ? "ZAP" : "VYP") << ")\n";
     std::cout << "V. Vizualizácia hitov (zobrazí krížiky)\n";
     std::cout << "CTRL - Zachytiť šablónu z pozície myši\n";
     std::cout << "ESC - Ukončiť program\n";
@@ -1104,22 +681,101 @@ void ShowMenu() {
     std::cout << "\nPre akciu stlač príslušnú klávesu...\n";
 }
 
-// Thread pre spracovanie
+// Fáza zachytenia: plní voľné buffery z poolu a posiela ich na hľadanie.
+// DXGI sa budí príchodom novej snímky, ostatné zdroje termínmi FramePacer.
+// Cyklus bez novej snímky sa preskočí, ak sa nezmenili šablóny ani oblasť.
+void CaptureThread() {
+    FramePacer pacer;
+    int slot = -1;  // Buffer ktorý práve vlastní táto fáza
+    uint64_t lastSequence = 0;
+    uint64_t lastTemplateVersion = 0;
+    RECT lastArea = {};
+    auto lastSubmit = std::chrono::steady_clock::now();
+    int skipped = 0;
+    auto skipCountStart = lastSubmit;
+
+    while (g_running) {
+        if (!g_searchActive || g_searchRegions.empty() || AcquireTemplateSet()->templates.empty()) {
+            Sleep(16);
+            continue;
+        }
+
+        // Všetky buffery sú v hľadaní, hľadanie je najpomalšia fáza
+        if (slot < 0 && !g_framePool.free.WaitPop(slot, g_settings.maxLatencyMs)) continue;
+
+        // Zdroj čo sám čaká na snímku (DXGI) sa nepoťahuje na termín, inak by
+        // snímka čo príde tesne po zachytení čakala na ďalší termín
+        if (!ActiveFrameSource(g_settings)->WaitsForNewFrame()) pacer.WaitForNextCapture(g_settings.targetFPS);
+        g_desktopDuplicator.SetFrameWait(g_settings.maxLatencyMs);
+
+        // Rovnakú snímku znova hľadaj len ak sa zmenila sada šablón alebo
+        // oblasť, prípadne raz za sekundu kvôli zmenám nastavení
+        RECT area = ActiveRegionArea();
+        uint64_t templateVersion = AcquireTemplateSet()->version;
+        auto now = std::chrono::steady_clock::now();
+        bool mustMatch = templateVersion != lastTemplateVersion || memcmp(&area, &lastArea, sizeof(RECT)) != 0 ||
+            now - lastSubmit >= std::chrono::seconds(1);
+
+        CaptureResult captured = CaptureToPool(g_framePool.frames[slot], area, mustMatch ? 0 : lastSequence);
+        if (captured == CAPTURE_NEW) {
+            lastSequence = g_framePool.frames[slot].frame.sequence;
+            lastTemplateVersion = templateVersion;
+            lastArea = area;
+            lastSubmit = now;
+
+            g_framePool.ready.Push(slot);
+            slot = -1;
+        }
+        else {
+            // Obrazovka sa nezmenila: zhody poslednej snímky platia aj teraz
+            if (captured == CAPTURE_UNCHANGED) g_matchPublisher.Confirm(lastSequence, lastSequence, now);
+            skipped++;
+        }
+
+        if (now - skipCountStart >= std::chrono::seconds(1)) {
+            g_skippedFrames = skipped;
+            skipped = 0;
+            skipCountStart = now;
+        }
+    }
+}
+
+// Fáza hľadania: vždy najnovšia zachytená snímka, staršie sa vrátia do poolu
 void ProcessingThread() {
+    MatcherContext context;
     while (g_running) {
-        if (g_searchActive && !g_searchRegions.empty() && !g_templates.empty()) {
-            FindTemplates();
-
-            // Ak máme zhody a je zapnuté klikanie
-            if (g_settings.clickOnMatch && !g_lastMatches.empty()) {
-                // Cykluj cez všetky zhody
-                int idx = g_currentMatchIndex % g_lastMatches.size();
-                ClickAt(g_lastMatches[idx].x, g_lastMatches[idx].y, g_settings.doubleClick);
-                g_currentMatchIndex++;
-            }
+        int slot;
+        if (!g_framePool.ready.WaitPop(slot, 100)) continue;
+
+        int newer;
+        while (g_framePool.ready.TryPop(newer)) {
+            g_framePool.free.Push(slot);
+            slot = newer;
         }
 
-        Sleep(16);  // ~60 FPS
+        MatchFrame(context, g_framePool.frames[slot].frame);
+        g_framePool.free.Push(slot);
+    }
+}
+
+// Fáza akcie: klikne raz za cyklus zachytenia, pri novom batchi zhôd aj keď
+// sa snímka nezmenila a zhody sa len potvrdili (statická obrazovka tak cykluje
+// kliky cez všetky zhody ako predtým). Zhody potvrdené pred viac ako
+// MaxClickAge sa ignorujú, obrazovka sa už mohla zmeniť.
+void ActionThread() {
+    uint64_t seen = 0;
+    while (g_running) {
+        std::chrono::steady_clock::time_point confirmedTime;
+        auto batch = g_matchPublisher.WaitCycle(seen, 100, confirmedTime);
+
+        // Ak máme zhody a je zapnuté klikanie
+        if (!batch || !g_settings.clickOnMatch || batch->matches.empty()) continue;
+        if (std::chrono::steady_clock::now() - confirmedTime > std::chrono::milliseconds(g_settings.clickMaxAgeMs)) continue;
+
+        // Cykluj cez všetky zhody
+        const auto& match = batch->matches[g_currentMatchIndex % batch->matches.size()];
+        ClickAt(match.x, match.y, g_settings.doubleClick);
+        g_currentMatchIndex++;
     }
 }
 
@@ -1132,13 +788,38 @@ void DisplayThread() {
             std::cout << "\n--- STAV ---\n";
             std::cout << "FPS: " << g_fps << "\n";
             std::cout << "Čas spracovania: " << g_lastProcessTime << " ms\n";
-            std::cout << "Načítané šablóny: " << g_templates.size() << "\n";
+            if (g_settings.useDirtyTiles) {
+                std::cout << "Zmenené dlaždice: " << g_changedTilePercent << " %\n";
+            }
+            if (g_settings.useSpatialPriors) {
+                std::cout << "Šablóny s naučenou oblasťou: " << g_priorTemplates << "\n";
+            }
+            const uint64_t sampled = g_sampledPositions.exchange(0);
+            const uint64_t rowOrder = g_pixelsRowOrder.exchange(0);
+            const uint64_t ordered = g_pixelsOrdered.exchange(0);
+            if (sampled) {
+                std::cout << "Pixely na pozíciu: " << (double)rowOrder / sampled << " (riadky), "
+                    << (double)ordered / sampled << " (diskriminačné poradie)\n";
+            }
+            std::cout << "Latencia snímka -> zhoda: " << g_lastLatency << " ms (preskočené cykly: " << g_skippedFrames << "/s)\n";
+            const auto templateSet = AcquireTemplateSet();
+            std::cout << "Načítané šablóny: " << templateSet->templates.size()
+                << " (verzia " << templateSet->version << ")\n";
+            if (g_settings.useClusterTree) {
+                std::cout << "Strom zhlukov: " << templateSet->clusterRoots.size() << " stromov, "
+                    << templateSet->clusterNodes.size() << " uzlov\n";
+            }
             std::cout << "Aktívne regióny: " << g_searchRegions.size() << "\n";
-            std::cout << "Posledné zhody: " << g_lastMatches.size() << "\n";
-            std::cout << "Capture metóda: " << (g_settings.useDXGI ? "DXGI (HW)" : "GDI") << "\n";
+            const auto batch = g_matchPublisher.Latest();
+            std::cout << "Posledné zhody: " << batch->matches.size() << " (snímka " << batch->frameSequence << ")\n";
+            std::cout << "Capture metóda: " << ActiveFrameSource(g_settings)->Name() << "\n";
             std::cout << "Vyhľadávanie: " << (g_settings.usePyramidSearch ? "Pyramídové" : "Štandardné") << "\n";
+            std::cout << "Worker vlákna: " << g_workerPool.WorkerCount() << "\n";
+            std::cout << "Kernel: " << GetKernels(g_settings.kernelLevel).name << "\n";
+            std::cout << "Kanály: " << CHANNEL_MODE_NAMES[g_settings.channelMode] << "\n";
 
             // Zobraz top 5 najčastejších šablón
+            std::lock_guard<std::mutex> statsLock(g_statsMutex);  // Aj prázdnosť, RemapTemplateStats ju mení
             if (g_settings.enableLearning && !g_templateStats.empty()) {
                 std::cout << "\n--- TOP ŠABLÓNY ---\n";
                 std::vector<std::pair<int, int>> sorted;
@@ -1149,7 +830,8 @@ void DisplayThread() {
 
                 for (int i = 0; i < min(5, (int)sorted.size()); i++) {
                     int tid = sorted[i].second;
-                    std::cout << g_templates[tid].filename << ": "
+                    if (tid >= (int)templateSet->templates.size()) continue;  // Štatistiky ešte patria k staršej sade
+                    std::cout << templateSet->templates[tid].filename << ": "
                         << sorted[i].first << " hitov\n";
                 }
             }
@@ -1162,6 +844,10 @@ void DisplayThread() {
 // Hlavná funkcia
 int main() {
     std::cout << "Template Matcher v2.0 - s DXGI a Pyramídovým vyhľadávaním\n";
+    // Vyber SIMD kernel podľa CPU
+    g_maxKernelLevel = DetectKernelLevel();
+    std::cout << "Najširší podporovaný kernel: " << g_kernelTables[g_maxKernelLevel].name << "\n";
+
     std::cout << "Inicializujem DXGI...\n";
     
     // Inicializuj DXGI
@@ -1177,6 +863,19 @@ int main() {
     // Načítaj šablóny
     LoadTemplates();
 
+    // Snímky zo súboru namiesto obrazovky
+    if (!g_settings.frameSourcePath.empty()) {
+        g_fileFrameSource.Open(g_settings.frameSourcePath);
+        std::cout << "Zdroj snímok: " << g_settings.frameSourcePath << "\n";
+    }
+
+    // Spusti worker pool (počet vlákien z config.ini)
+    g_workerPool.Start(g_settings.workerThreads);
+    std::cout << "Worker vlákna: " << g_workerPool.WorkerCount() << "\n";
+
+    // Nové šablóny v ./obr/ sa načítajú bez reštartu
+    if (g_settings.watchTemplates) g_templateWatcher.Start("./obr/");
+
     // Skús načítať posledné regióny
     LoadRegions("last_regions.txt");
 
@@ -1187,7 +886,9 @@ int main() {
     ShowMenu();
 
     // Spusti threads
+    std::thread captureThread(CaptureThread);
     std::thread processingThread(ProcessingThread);
+    std::thread actionThread(ActionThread);
     std::thread displayThread(DisplayThread);
 
     // Hlavný input loop
@@ -1249,18 +950,23 @@ int main() {
         // E/R pre early pixels
         if (GetAsyncKeyState('E') & 0x8000) {
             g_settings.earlyPixelCount = max(10, g_settings.earlyPixelCount - 10);
-            std::cout << "\nEarly pixels: " << g_settings.earlyPixelCount << std::endl;
+            std::cout << "\nEarly pixels: " << g_settings.earlyPixelCount
+                << " (v diskriminačnom poradí " << OrderedEarlyPixels(g_settings.earlyPixelCount) << ")" << std::endl;
             Sleep(100);
         }
         if (GetAsyncKeyState('R') & 0x8000) {
             g_settings.earlyPixelCount = min(400, g_settings.earlyPixelCount + 10);
-            std::cout << "\nEarly pixels: " << g_settings.earlyPixelCount << std::endl;
+            std::cout << "\nEarly pixels: " << g_settings.earlyPixelCount
+                << " (v diskriminačnom poradí " << OrderedEarlyPixels(g_settings.earlyPixelCount) << ")" << std::endl;
             Sleep(100);
         }
 
         if (GetAsyncKeyState('6') & 0x8000) {
-            g_settings.useAVX2 = !g_settings.useAVX2;
-            std::cout << "\nPoužívam: " << (g_settings.useAVX2 ? "AVX2" : "SSE2") << std::endl;
+            // Auto -> Scalar -> SSE2 -> ... -> najvyšší podporovaný -> Auto
+            int next = g_settings.kernelLevel + 1;
+            g_settings.kernelLevel = next > g_maxKernelLevel ? KERNEL_AUTO : next;
+            std::cout << "\nPoužívam: " << GetKernels(g_settings.kernelLevel).name
+                << (g_settings.kernelLevel == KERNEL_AUTO ? " (auto)" : "") << std::endl;
             Sleep(200);
         }
 
@@ -1336,10 +1042,81 @@ int main() {
             Sleep(200);
         }
         
+        // B pre dávkový kernel
+        if (GetAsyncKeyState('B') & 0x8000) {
+            g_settings.useBatchedKernel = !g_settings.useBatchedKernel;
+            std::cout << "\nDávkový kernel: " << (g_settings.useBatchedKernel ? "ZAPNUTÝ" : "VYPNUTÝ") << std::endl;
+            Sleep(200);
+        }
+
+        // S pre úrovne SEA prefiltra (0 -> 1 -> ... -> max -> 0)
+        if (GetAsyncKeyState('S') & 0x8000) {
+            g_settings.seaLevels = (g_settings.seaLevels + 1) % (SEA_MAX_LEVELS + 1);
+            std::cout << "\nSEA prefilter: " << (g_settings.seaLevels ? std::to_string(g_settings.seaLevels) + " úrovne" : "VYPNUTÝ") << std::endl;
+            Sleep(200);
+        }
+
+        // K pre sledovanie zhôd
+        if (GetAsyncKeyState('K') & 0x8000) {
+            g_settings.useTracking = !g_settings.useTracking;
+            std::cout << "\nSledovanie zhôd: " << (g_settings.useTracking ? "ZAPNUTÉ" : "VYPNUTÉ") << std::endl;
+            Sleep(200);
+        }
+
+        // O pre naučené oblasti šablón
+        if (GetAsyncKeyState('O') & 0x8000) {
+            g_settings.useSpatialPriors = !g_settings.useSpatialPriors;
+            std::cout << "\nNaučené oblasti: " << (g_settings.useSpatialPriors ? "ZAPNUTÉ" : "VYPNUTÉ") << std::endl;
+            Sleep(200);
+        }
+
+        // I pre všetky výskyty šablóny
+        if (GetAsyncKeyState('I') & 0x8000) {
+            g_settings.multiInstance = !g_settings.multiInstance;
+            std::cout << "\nVšetky výskyty: " << (g_settings.multiInstance ? "ZAPNUTÉ" : "VYPNUTÉ") << std::endl;
+            Sleep(200);
+        }
+
+        // H pre presnú zhodu cez hash okien
+        if (GetAsyncKeyState('H') & 0x8000) {
+            g_settings.exactMatch = !g_settings.exactMatch;
+            std::cout << "\nPresná zhoda: " << (g_settings.exactMatch ? "ZAPNUTÁ" : "VYPNUTÁ") << std::endl;
+            Sleep(200);
+        }
+
+        // L pre strom zhlukov šablón
+        if (GetAsyncKeyState('L') & 0x8000) {
+            g_settings.useClusterTree = !g_settings.useClusterTree;
+            std::cout << "\nStrom zhlukov: " << (g_settings.useClusterTree ? "ZAPNUTÝ" : "VYPNUTÝ") << std::endl;
+            Sleep(200);
+        }
+
+        // C pre kanálový režim (BGRA -> BGR -> jas)
+        if (GetAsyncKeyState('C') & 0x8000) {
+            g_settings.channelMode = (g_settings.channelMode + 1) % CHANNEL_MODE_COUNT;
+            std::cout << "\nKanály: " << CHANNEL_MODE_NAMES[g_settings.channelMode] << std::endl;
+            Sleep(200);
+        }
+
+        // X pre diskriminačné poradie pixelov
+        if (GetAsyncKeyState('X') & 0x8000) {
+            g_settings.randomPixelTest = !g_settings.randomPixelTest;
+            std::cout << "\nDiskriminačné poradie pixelov: " << (g_settings.randomPixelTest ? "ZAPNUTÉ" : "VYPNUTÉ") << std::endl;
+            Sleep(200);
+        }
+
+        // Z pre detekciu zmien po dlaždiciach
+        if (GetAsyncKeyState('Z') & 0x8000) {
+            g_settings.useDirtyTiles = !g_settings.useDirtyTiles;
+            std::cout << "\nLen zmenené dlaždice: " << (g_settings.useDirtyTiles ? "ZAPNUTÉ" : "VYPNUTÉ") << std::endl;
+            Sleep(200);
+        }
+
         // V pre vizualizáciu
         if (GetAsyncKeyState('V') & 0x8000) {
-            if (!g_lastMatches.empty()) {
-                std::cout << "\nZobrazujem " << g_lastMatches.size() << " nájdených pozícií..." << std::endl;
+            const auto batch = g_matchPublisher.Latest();
+            if (!batch->matches.empty()) {
+                std::cout << "\nZobrazujem " << batch->matches.size() << " nájdených pozícií..." << std::endl;
                 DrawHitVisualization();
                 Sleep(2000);  // Zobraz na 2 sekundy
             }
@@ -1353,8 +1130,12 @@ int main() {
     }
 
     // Počkaj na threads
+    captureThread.join();
     processingThread.join();
+    actionThread.join();
     displayThread.join();
+    g_templateWatcher.Stop();
+    g_workerPool.Stop();
 
     // Ulož posledné regióny
     SaveRegions("last_regions.txt");
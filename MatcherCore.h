@@ -0,0 +1,5690 @@
+// MatcherCore.h - Jadro template matchingu nezávislé od zachytávania obrazovky
+// Snímky (FrameView, FileFrameSource), BMP, kernely, sady šablón a MatchFrame.
+// Prekladá sa aj mimo Windows, testy v tests/ cez neho prehrávajú snímky zo súborov.
+// Obsahuje definície, v programe ho vkladá práve jeden preklad.
+#pragma once
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>  // __cpuidex
+#else
+#include <cpuid.h>  // __cpuid_count
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <immintrin.h>  // AVX2
+#include <emmintrin.h>  // SSE2
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <filesystem>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <random>
+
+#ifndef _WIN32
+// Náhrady typov a makier z windows.h, ktoré jadro používa
+typedef long LONG;
+struct POINT { LONG x, y; };
+struct RECT { LONG left, top, right, bottom; };
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#endif
+
+// CPUID a XCR0 pre výber kernelu
+inline void CpuId(int info[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+inline unsigned long long ReadXcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int low, high;
+    __asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return ((unsigned long long)high << 32) | low;
+#endif
+}
+
+// Index najnižšieho nastaveného bitu, bits != 0 (bez BMI, beží na každom CPU)
+inline int LowestSetBit(uint32_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// AVX2/AVX-512 kernely sa prekladajú bez globálneho /arch ani -mavx2, vyberajú
+// sa za behu. MSVC intrinsiky povolí vždy, GCC a Clang potrebujú cieľ pre úsek.
+#if defined(__clang__)
+#define KERNEL_TARGET_AVX2_BEGIN _Pragma("clang attribute push(__attribute__((target(\"avx2\"))), apply_to = function)")
+#define KERNEL_TARGET_AVX512_BEGIN _Pragma("clang attribute push(__attribute__((target(\"avx2,avx512f,avx512bw\"))), apply_to = function)")
+#define KERNEL_TARGET_END _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#define KERNEL_TARGET_AVX2_BEGIN _Pragma("GCC push_options") _Pragma("GCC target(\"avx2\")")
+#define KERNEL_TARGET_AVX512_BEGIN _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,avx512f,avx512bw\")")
+#define KERNEL_TARGET_END _Pragma("GCC pop_options")
+#else
+#define KERNEL_TARGET_AVX2_BEGIN
+#define KERNEL_TARGET_AVX512_BEGIN
+#define KERNEL_TARGET_END
+#endif
+
+// ===== KONFIGURÁCIA =====
+constexpr int TEMPLATE_SIZE = 20;  // Predvolená šablóna 20x20 (zachytenie, dávkový kernel, pyramída)
+constexpr int MAX_TEMPLATES = 500;  // Max počet šablón
+constexpr int SCREEN_WIDTH = 1920;
+constexpr int SCREEN_HEIGHT = 1080;
+
+// ===== SNÍMKA OBRAZOVKY =====
+// Pohľad na časť snímky bez kopírovania dát
+struct FrameView {
+    const uint8_t* data = nullptr;
+    int x = 0, y = 0;  // Pozícia ľavého horného pixelu na obrazovke
+    int width = 0, height = 0;
+    int stride = 0;  // Bajty na riadok
+    const uint8_t* luma = nullptr;  // Jas výrezu pri ChannelMode luma, inak nullptr
+    int lumaStride = 0;
+
+    const uint8_t* Pixel(int px, int py) const {
+        return data + (size_t)py * stride + (size_t)px * 4;
+    }
+
+    const uint8_t* LumaPixel(int px, int py) const {
+        return luma + (size_t)py * lumaStride + px;
+    }
+};
+
+// Jedna snímka zachytená pre celý cyklus vyhľadávania
+struct CapturedFrame {
+    const uint8_t* data = nullptr;
+    int originX = 0, originY = 0;  // Pozícia pixelu (0,0) na obrazovke
+    int width = 0, height = 0;
+    int stride = 0;
+    uint64_t sequence = 0;  // Zvyšuje sa s každou novou snímkou zo zdroja
+    bool isNew = false;  // false = zdroj nemal novú snímku, dáta sú z predošlej
+    std::chrono::steady_clock::time_point captureTime;
+
+    // Výrez oblasti v súradniciach obrazovky orezaný na snímku, false ak je prázdny
+    bool View(int x, int y, int w, int h, FrameView& view) const {
+        int left = max(x, originX);
+        int top = max(y, originY);
+        int right = min(x + w, originX + width);
+        int bottom = min(y + h, originY + height);
+        if (right <= left || bottom <= top) return false;
+
+        view.data = data + (size_t)(top - originY) * stride + (size_t)(left - originX) * 4;
+        view.x = left;
+        view.y = top;
+        view.width = right - left;
+        view.height = bottom - top;
+        view.stride = stride;
+        return true;
+    }
+};
+
+// Zdroj snímok. AcquireFrame drží snímku platnú až do ReleaseFrame.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // area = oblasť obrazovky ktorú volajúci potrebuje (zdroj môže vrátiť viac)
+    virtual bool AcquireFrame(const RECT& area, CapturedFrame& frame) = 0;
+    virtual void ReleaseFrame() = 0;
+    virtual const char* Name() const = 0;
+
+    // true = AcquireFrame sám čaká kým príde nová snímka (DXGI), inak vráti
+    // aktuálny stav hneď a tempo určuje FramePacer
+    virtual bool WaitsForNewFrame() const { return false; }
+};
+
+// Uvoľní snímku pri opustení bloku
+struct FrameLease {
+    FrameSource* source = nullptr;
+
+    ~FrameLease() {
+        if (source) source->ReleaseFrame();
+    }
+};
+
+
+bool LoadBMP32(const std::string& filename, std::vector<uint8_t>& data, int& width, int& height, int maxDim);
+
+constexpr int MAX_FRAME_DIM = 16384;  // Najväčší rozmer snímky zo súboru
+
+// Snímky zo súboru namiesto obrazovky (testy, prehrávanie záznamu).
+// Cesta k .bmp súboru = statická snímka, načíta sa znova keď sa súbor zmení.
+// Cesta k adresáru = prehrávanie všetkých .bmp v abecednom poradí dookola.
+class FileFrameSource : public FrameSource {
+private:
+    std::string m_path;
+    std::vector<std::string> m_replayFiles;
+    size_t m_replayIndex = 0;
+    std::filesystem::file_time_type m_lastWriteTime;
+    std::vector<uint8_t> m_buffer;
+    int m_width = 0, m_height = 0;
+    uint64_t m_sequence = 0;
+
+    bool Load(const std::string& filename) {
+        if (!LoadBMP32(filename, m_buffer, m_width, m_height, MAX_FRAME_DIM)) return false;
+        m_sequence++;
+        return true;
+    }
+
+public:
+    void Open(const std::string& path) {
+        m_path = path;
+        m_replayFiles.clear();
+        m_replayIndex = 0;
+        m_buffer.clear();
+        m_width = m_height = 0;
+
+        std::error_code ec;
+        if (std::filesystem::is_directory(path, ec)) {
+            for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+                if (entry.path().extension() == ".bmp") {
+                    m_replayFiles.push_back(entry.path().string());
+                }
+            }
+            std::sort(m_replayFiles.begin(), m_replayFiles.end());
+        }
+    }
+
+    bool IsOpen() const { return !m_path.empty(); }
+
+    bool AcquireFrame(const RECT& area, CapturedFrame& frame) override {
+        bool isNew = false;
+
+        if (!m_replayFiles.empty()) {
+            // Prehrávanie - každé volanie je ďalšia snímka
+            isNew = Load(m_replayFiles[m_replayIndex]);
+            m_replayIndex = (m_replayIndex + 1) % m_replayFiles.size();
+        }
+        else {
+            std::error_code ec;
+            auto writeTime = std::filesystem::last_write_time(m_path, ec);
+            if (!ec && (m_buffer.empty() || writeTime != m_lastWriteTime)) {
+                isNew = Load(m_path);
+                m_lastWriteTime = writeTime;
+            }
+        }
+
+        if (m_buffer.empty()) return false;
+
+        frame.data = m_buffer.data();
+        frame.originX = 0;
+        frame.originY = 0;
+        frame.width = m_width;
+        frame.height = m_height;
+        frame.stride = m_width * 4;
+        frame.sequence = m_sequence;
+        frame.isNew = isNew;
+        frame.captureTime = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void ReleaseFrame() override {}
+
+    const char* Name() const override { return "Súbor"; }
+};
+
+// Early rejection všetkých kernelov TEMPLATE_SIZE (jednotlivých aj dávkových)
+// je na konci každého riadku ako pri šablónach iných rozmerov, rozhodnutia
+// tak nezávisia od úrovne kernelu.
+
+// Skalárny template matching s early rejection (CPU bez SIMD, referencia)
+float MatchTemplateScalar(const uint8_t* image, int imgStride,
+    const uint8_t* tmpl, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+    int pixelsTested = 0;
+
+    for (int y = 0; y < TEMPLATE_SIZE; y++) {
+        for (int i = 0; i < TEMPLATE_SIZE * 4; i++) {
+            totalDiff += abs(image[y * imgStride + i] - tmpl[y * TEMPLATE_SIZE * 4 + i]);
+        }
+        pixelsTested += TEMPLATE_SIZE;
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+}
+
+// SSE2 template matching s early rejection
+float MatchTemplateSSE2(const uint8_t* image, int imgStride,
+    const uint8_t* tmpl, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+    int pixelsTested = 0;
+
+    for (int y = 0; y < TEMPLATE_SIZE; y++) {
+        for (int x = 0; x < TEMPLATE_SIZE; x += 4) {
+            // Kontrola či nezájdeme mimo hranice
+            int pixelsToProcess = min(4, TEMPLATE_SIZE - x);
+
+            if (pixelsToProcess == 4) {
+                // Načítaj 4 pixely z obrazu a šablóny
+                __m128i imgPixels = _mm_loadu_si128((__m128i*) & image[y * imgStride + x * 4]);
+                __m128i tmplPixels = _mm_loadu_si128((__m128i*) & tmpl[y * TEMPLATE_SIZE * 4 + x * 4]);
+
+                // Vypočítaj absolútne rozdiely
+                __m128i diff = _mm_sad_epu8(imgPixels, tmplPixels);
+
+                // Akumuluj rozdiely (bez _mm_extract_epi32, to je až SSE4.1)
+                totalDiff += _mm_cvtsi128_si32(diff) + _mm_cvtsi128_si32(_mm_srli_si128(diff, 8));
+                pixelsTested += 4;
+            }
+            else {
+                // Spracuj zvyšné pixely manuálne
+                for (int i = 0; i < pixelsToProcess; i++) {
+                    for (int c = 0; c < 4; c++) {
+                        int imgVal = image[y * imgStride + (x + i) * 4 + c];
+                        int tmplVal = tmpl[y * TEMPLATE_SIZE * 4 + (x + i) * 4 + c];
+                        totalDiff += abs(imgVal - tmplVal);
+                    }
+                    pixelsTested++;
+                }
+            }
+        }
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+}
+
+
+
+KERNEL_TARGET_AVX2_BEGIN
+// AVX2 template matching s early rejection
+float MatchTemplateAVX2(const uint8_t* image, int imgStride,
+    const uint8_t* tmpl, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+    int pixelsTested = 0;
+
+    for (int y = 0; y < TEMPLATE_SIZE; y++) {
+        int x = 0;
+
+        // Spracuj po 8 pixelov pokiaľ môžeme
+        for (; x <= TEMPLATE_SIZE - 8; x += 8) {
+            __m256i imgPixels = _mm256_loadu_si256((__m256i*) & image[y * imgStride + x * 4]);
+            __m256i tmplPixels = _mm256_loadu_si256((__m256i*) & tmpl[y * TEMPLATE_SIZE * 4 + x * 4]);
+
+            __m256i diff = _mm256_sad_epu8(imgPixels, tmplPixels);
+
+            totalDiff += _mm256_extract_epi32(diff, 0) + _mm256_extract_epi32(diff, 2) +
+                _mm256_extract_epi32(diff, 4) + _mm256_extract_epi32(diff, 6);
+
+            pixelsTested += 8;
+        }
+
+        // Dokonči zvyšné pixely pomocou SSE2
+        for (; x < TEMPLATE_SIZE; x += 4) {
+            __m128i imgPixels = _mm_loadu_si128((__m128i*) & image[y * imgStride + x * 4]);
+            __m128i tmplPixels = _mm_loadu_si128((__m128i*) & tmpl[y * TEMPLATE_SIZE * 4 + x * 4]);
+
+            __m128i diff = _mm_sad_epu8(imgPixels, tmplPixels);
+            totalDiff += _mm_cvtsi128_si32(diff) + _mm_extract_epi32(diff, 2);
+
+            pixelsTested += 4;
+        }
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+}
+KERNEL_TARGET_END
+
+KERNEL_TARGET_AVX512_BEGIN
+// AVX-512BW template matching s early rejection
+// Jeden _mm512_sad_epu8 spracuje 16 pixelov riadku, zvyšok riadku ide cez maskovaný load
+float MatchTemplateAVX512(const uint8_t* image, int imgStride,
+    const uint8_t* tmpl, int tolerance, int earlyPixels) {
+    constexpr int FULL_PIXELS = TEMPLATE_SIZE / 16 * 16;
+    constexpr int REST_BYTES = (TEMPLATE_SIZE - FULL_PIXELS) * 4;
+    const __mmask64 restMask = REST_BYTES ? (~0ULL >> (64 - REST_BYTES)) : 0;
+
+    __m512i acc = _mm512_setzero_si512();
+    int pixelsTested = 0;
+
+    for (int y = 0; y < TEMPLATE_SIZE; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * TEMPLATE_SIZE * 4;
+
+        for (int x = 0; x < FULL_PIXELS; x += 16) {
+            __m512i imgPixels = _mm512_loadu_si512(imgRow + x * 4);
+            __m512i tmplPixels = _mm512_loadu_si512(tmplRow + x * 4);
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(imgPixels, tmplPixels));
+        }
+
+        // Zvyšné pixely - maskované bajty sú v oboch nulové a SAD ich ignoruje
+        if (REST_BYTES) {
+            __m512i imgPixels = _mm512_maskz_loadu_epi8(restMask, imgRow + FULL_PIXELS * 4);
+            __m512i tmplPixels = _mm512_maskz_loadu_epi8(restMask, tmplRow + FULL_PIXELS * 4);
+            acc = _mm512_add_epi64(acc, _mm512_sad_epu8(imgPixels, tmplPixels));
+        }
+
+        pixelsTested += TEMPLATE_SIZE;
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels &&
+            _mm512_reduce_add_epi64(acc) > (long long)tolerance * pixelsTested * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)_mm512_reduce_add_epi64(acc) / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+}
+KERNEL_TARGET_END
+
+// ===== ŠABLÓNY ĽUBOVOĽNEJ VEĽKOSTI =====
+// Kernely vyššie sú pre TEMPLATE_SIZE x TEMPLATE_SIZE. Šablóny iných rozmerov
+// idú cez MatchTemplateSizedFn: bežné rozmery (SIZED_KERNEL_DIMS v oboch
+// smeroch) majú inštanciu template<W, H> s konštantnými slučkami, ostatné
+// všeobecný kernel s rozmermi za behu. Early rejection vždy na konci riadku,
+// rozhodnutia sú tak rovnaké na všetkých úrovniach kernelov.
+using MatchTemplateSizedFn = float (*)(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels);
+
+constexpr int MIN_TEMPLATE_DIM = 4;
+constexpr int MAX_TEMPLATE_DIM = 256;
+constexpr int SIZED_KERNEL_DIMS[] = { 8, 16, 20, 24, 32, 48, 64 };
+constexpr int SIZED_KERNEL_COUNT = sizeof(SIZED_KERNEL_DIMS) / sizeof(SIZED_KERNEL_DIMS[0]);
+
+float MatchTemplateGenericScalar(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width * 4;
+        for (int i = 0; i < width * 4; i++) {
+            totalDiff += abs(imgRow[i] - tmplRow[i]);
+        }
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (width * height * 4);
+}
+
+float MatchTemplateGenericSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    __m128i acc = _mm_setzero_si128();
+    int tail = 0;  // Pixely za posledným celým štvoricovým blokom
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width * 4;
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(
+                _mm_loadu_si128((const __m128i*)(imgRow + x * 4)),
+                _mm_loadu_si128((const __m128i*)(tmplRow + x * 4))));
+        }
+        for (int i = x * 4; i < width * 4; i++) {
+            tail += abs(imgRow[i] - tmplRow[i]);
+        }
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+            if (diff > tolerance * pixelsTested * 4) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+    return (float)diff / (width * height * 4);
+}
+
+// Všetky rozmery v SIZED_KERNEL_DIMS sú násobky 4 pixelov, riadok ide celý cez SAD
+template<int W, int H>
+float MatchTemplateFixedSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int, int, int tolerance, int earlyPixels) {
+    static_assert(W % 4 == 0, "Riadok šablóny sa porovnáva po 4 pixeloch");
+    __m128i acc = _mm_setzero_si128();
+
+    for (int y = 0; y < H; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * W * 4;
+        for (int x = 0; x < W; x += 4) {
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(
+                _mm_loadu_si128((const __m128i*)(imgRow + x * 4)),
+                _mm_loadu_si128((const __m128i*)(tmplRow + x * 4))));
+        }
+
+        if ((y + 1) * W >= earlyPixels) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc)));
+            if (diff > tolerance * (y + 1) * W * 4) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc)));
+    return (float)diff / (W * H * 4);
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+// 8 pixelov na _mm256_sad_epu8, riadok s W % 8 == 4 dokončí jeden SSE2 SAD
+template<int W, int H>
+float MatchTemplateFixedAVX2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int, int, int tolerance, int earlyPixels) {
+    static_assert(W % 4 == 0, "Riadok šablóny sa porovnáva po 4 pixeloch");
+    __m256i acc = _mm256_setzero_si256();
+    __m128i rest = _mm_setzero_si128();
+
+    auto total = [&]() {
+        __m128i sum = _mm_add_epi64(_mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)), rest);
+        return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum)));
+    };
+
+    for (int y = 0; y < H; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * W * 4;
+        for (int x = 0; x + 8 <= W; x += 8) {
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(
+                _mm256_loadu_si256((const __m256i*)(imgRow + x * 4)),
+                _mm256_loadu_si256((const __m256i*)(tmplRow + x * 4))));
+        }
+        if (W % 8) {
+            rest = _mm_add_epi64(rest, _mm_sad_epu8(
+                _mm_loadu_si128((const __m128i*)(imgRow + (W - 4) * 4)),
+                _mm_loadu_si128((const __m128i*)(tmplRow + (W - 4) * 4))));
+        }
+
+        if ((y + 1) * W >= earlyPixels && total() > tolerance * (y + 1) * W * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)total() / (W * H * 4);
+}
+KERNEL_TARGET_END
+
+// Tabuľka [index šírky][index výšky] podľa SIZED_KERNEL_DIMS
+#define SIZED_KERNEL_ROW(KERNEL, W) \
+    { KERNEL<W, 8>, KERNEL<W, 16>, KERNEL<W, 20>, KERNEL<W, 24>, KERNEL<W, 32>, KERNEL<W, 48>, KERNEL<W, 64> }
+#define SIZED_KERNEL_TABLE(KERNEL) { \
+    SIZED_KERNEL_ROW(KERNEL, 8), SIZED_KERNEL_ROW(KERNEL, 16), SIZED_KERNEL_ROW(KERNEL, 20), \
+    SIZED_KERNEL_ROW(KERNEL, 24), SIZED_KERNEL_ROW(KERNEL, 32), SIZED_KERNEL_ROW(KERNEL, 48), \
+    SIZED_KERNEL_ROW(KERNEL, 64) }
+
+const MatchTemplateSizedFn g_sizedKernelsSSE2[SIZED_KERNEL_COUNT][SIZED_KERNEL_COUNT] =
+    SIZED_KERNEL_TABLE(MatchTemplateFixedSSE2);
+const MatchTemplateSizedFn g_sizedKernelsAVX2[SIZED_KERNEL_COUNT][SIZED_KERNEL_COUNT] =
+    SIZED_KERNEL_TABLE(MatchTemplateFixedAVX2);
+
+#undef SIZED_KERNEL_TABLE
+#undef SIZED_KERNEL_ROW
+
+// Index rozmeru v SIZED_KERNEL_DIMS, -1 = ide cez všeobecný kernel
+int SizedKernelIndex(int dim) {
+    for (int i = 0; i < SIZED_KERNEL_COUNT; i++) {
+        if (SIZED_KERNEL_DIMS[i] == dim) return i;
+    }
+    return -1;
+}
+
+// ===== KANÁLOVÉ REŽIMY (ChannelMode) =====
+// Alfa v snímke aj šablóne je konštanta (DXGI 255, GDI 0), porovnávať ju je
+// zbytočné a pri šablóne z iného zdroja než snímka aj škodlivé.
+// BGR: alfa obrazu sa maskuje, šablóna má alfu vynulovanú, skóre je priemer
+//      rozdielu na kanál B, G, R.
+// Luma: snímka sa raz za cyklus prevedie na 8-bit jas, šablóny sú prevedené
+//      pri načítaní. Jeden SAD bajt = jeden pixel, skóre je priemerný rozdiel jasu.
+enum ChannelMode {
+    CHANNELS_BGRA,
+    CHANNELS_BGR,
+    CHANNELS_LUMA,
+    CHANNEL_MODE_COUNT
+};
+
+const char* const CHANNEL_MODE_NAMES[CHANNEL_MODE_COUNT] = { "bgra", "bgr", "luma" };
+constexpr int CHANNEL_MODE_PIXEL_BYTES[CHANNEL_MODE_COUNT] = { 4, 4, 1 };  // Bajty na pixel porovnávanej roviny
+constexpr int CHANNEL_MODE_COMPARED[CHANNEL_MODE_COUNT] = { 4, 3, 1 };  // Porovnávané kanály (delenie skóre)
+
+using ConvertLumaFn = void (*)(const uint8_t* src, int srcStride, int width, int height, uint8_t* dst, int dstStride);
+
+// Y = (29 B + 150 G + 77 R + 128) >> 8 (BT.601, váhy so súčtom 256)
+void ConvertLumaScalar(const uint8_t* src, int srcStride, int width, int height, uint8_t* dst, int dstStride) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t* s = src + (size_t)y * srcStride;
+        uint8_t* d = dst + (size_t)y * dstStride;
+        for (int x = 0; x < width; x++) {
+            d[x] = (uint8_t)((29 * s[x * 4] + 150 * s[x * 4 + 1] + 77 * s[x * 4 + 2] + 128) >> 8);
+        }
+    }
+}
+
+// Súčty váh dvoch pixelov z madd (B*29 + G*150, R*77 + A*0) -> jas v dolných 32 bitoch
+inline __m128i LumaPairSSE2(__m128i pixels16, __m128i weights) {
+    __m128i products = _mm_madd_epi16(pixels16, weights);
+    return _mm_add_epi32(products, _mm_srli_epi64(products, 32));
+}
+
+void ConvertLumaSSE2(const uint8_t* src, int srcStride, int width, int height, uint8_t* dst, int dstStride) {
+    const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* s = src + (size_t)y * srcStride;
+        uint8_t* d = dst + (size_t)y * dstStride;
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(s + x * 4));
+            __m128i lo = _mm_shuffle_epi32(LumaPairSSE2(_mm_unpacklo_epi8(pixels, zero), weights), _MM_SHUFFLE(3, 3, 2, 0));
+            __m128i hi = _mm_shuffle_epi32(LumaPairSSE2(_mm_unpackhi_epi8(pixels, zero), weights), _MM_SHUFFLE(3, 3, 2, 0));
+            __m128i luma = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi64(lo, hi), round), 8);
+            luma = _mm_packs_epi32(luma, luma);
+            int packed = _mm_cvtsi128_si32(_mm_packus_epi16(luma, luma));
+            memcpy(d + x, &packed, 4);
+        }
+        ConvertLumaScalar(s + x * 4, srcStride, width - x, 1, d + x, dstStride);
+    }
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+// Rovnaký výpočet v oboch 128-bit polovičkách, 8 pixelov naraz
+void ConvertLumaAVX2(const uint8_t* src, int srcStride, int width, int height, uint8_t* dst, int dstStride) {
+    const __m256i weights = _mm256_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0, 29, 150, 77, 0, 29, 150, 77, 0);
+    const __m256i round = _mm256_set1_epi32(128);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* s = src + (size_t)y * srcStride;
+        uint8_t* d = dst + (size_t)y * dstStride;
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i*)(s + x * 4));
+            __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), weights);
+            __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), weights);
+            lo = _mm256_shuffle_epi32(_mm256_add_epi32(lo, _mm256_srli_epi64(lo, 32)), _MM_SHUFFLE(3, 3, 2, 0));
+            hi = _mm256_shuffle_epi32(_mm256_add_epi32(hi, _mm256_srli_epi64(hi, 32)), _MM_SHUFFLE(3, 3, 2, 0));
+            __m256i luma = _mm256_srli_epi32(_mm256_add_epi32(_mm256_unpacklo_epi64(lo, hi), round), 8);
+            luma = _mm256_packs_epi32(luma, luma);
+            luma = _mm256_packus_epi16(luma, luma);
+            int packedLo = _mm_cvtsi128_si32(_mm256_castsi256_si128(luma));
+            int packedHi = _mm_cvtsi128_si32(_mm256_extracti128_si256(luma, 1));
+            memcpy(d + x, &packedLo, 4);
+            memcpy(d + x + 4, &packedHi, 4);
+        }
+        ConvertLumaSSE2(s + x * 4, srcStride, width - x, 1, d + x, dstStride);
+    }
+}
+KERNEL_TARGET_END
+
+// BGR: šablóna má alfu nulovú, obraz sa maskuje. Early rejection na konci riadku.
+float MatchTemplateBGRScalar(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width * 4;
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                totalDiff += abs(imgRow[x * 4 + c] - tmplRow[x * 4 + c]);
+            }
+        }
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 3) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (width * height * 3);
+}
+
+// FixedWidth > 0: inštancia pre šírku zo SIZED_KERNEL_DIMS (násobky 4 pixelov,
+// skalárny zvyšok riadku odpadne). 0 = šírka za behu.
+template<int FixedWidth>
+float MatchTemplateBGRRowsSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    if (FixedWidth) width = FixedWidth;
+    const __m128i alphaMask = _mm_set1_epi32(0x00FFFFFF);
+    __m128i acc = _mm_setzero_si128();
+    int tail = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width * 4;
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i imgPixels = _mm_and_si128(_mm_loadu_si128((const __m128i*)(imgRow + x * 4)), alphaMask);
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(imgPixels, _mm_loadu_si128((const __m128i*)(tmplRow + x * 4))));
+        }
+        for (; x < width; x++) {
+            for (int c = 0; c < 3; c++) tail += abs(imgRow[x * 4 + c] - tmplRow[x * 4 + c]);
+        }
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+            if (diff > tolerance * pixelsTested * 3) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+    return (float)diff / (width * height * 3);
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+template<int FixedWidth>
+float MatchTemplateBGRRowsAVX2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    if (FixedWidth) width = FixedWidth;
+    const __m256i alphaMask = _mm256_set1_epi32(0x00FFFFFF);
+    __m256i acc = _mm256_setzero_si256();
+    __m128i rest = _mm_setzero_si128();
+    int tail = 0;
+
+    auto total = [&]() {
+        __m128i sum = _mm_add_epi64(_mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)), rest);
+        return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum))) + tail;
+    };
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width * 4;
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i imgPixels = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(imgRow + x * 4)), alphaMask);
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(imgPixels, _mm256_loadu_si256((const __m256i*)(tmplRow + x * 4))));
+        }
+        for (; x + 4 <= width; x += 4) {
+            __m128i imgPixels = _mm_and_si128(_mm_loadu_si128((const __m128i*)(imgRow + x * 4)), _mm256_castsi256_si128(alphaMask));
+            rest = _mm_add_epi64(rest, _mm_sad_epu8(imgPixels, _mm_loadu_si128((const __m128i*)(tmplRow + x * 4))));
+        }
+        for (; x < width; x++) {
+            for (int c = 0; c < 3; c++) tail += abs(imgRow[x * 4 + c] - tmplRow[x * 4 + c]);
+        }
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels && total() > tolerance * pixelsTested * 3) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)total() / (width * height * 3);
+}
+KERNEL_TARGET_END
+
+float MatchTemplateBGRSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    return MatchTemplateBGRRowsSSE2<0>(image, imgStride, tmpl, width, height, tolerance, earlyPixels);
+}
+
+float MatchTemplateBGRAVX2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    return MatchTemplateBGRRowsAVX2<0>(image, imgStride, tmpl, width, height, tolerance, earlyPixels);
+}
+
+// Luma: 1 bajt na pixel, šablóna 20x20 má 400 bajtov namiesto 1600
+float MatchTemplateLumaScalar(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width;
+        for (int x = 0; x < width; x++) {
+            totalDiff += abs(imgRow[x] - tmplRow[x]);
+        }
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (width * height);
+}
+
+// Zvyšok riadku jasu po 16, 8 a 4 bajtoch, posledné 0-3 pixely skalárne
+inline int LumaRowTailSSE2(const uint8_t* img, const uint8_t* tmpl, int x, int width, __m128i& acc) {
+    for (; x + 16 <= width; x += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(img + x)),
+            _mm_loadu_si128((const __m128i*)(tmpl + x))));
+    }
+    if (x + 8 <= width) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadl_epi64((const __m128i*)(img + x)),
+            _mm_loadl_epi64((const __m128i*)(tmpl + x))));
+        x += 8;
+    }
+    if (x + 4 <= width) {
+        int a, b;
+        memcpy(&a, img + x, 4);
+        memcpy(&b, tmpl + x, 4);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b)));
+        x += 4;
+    }
+    int tail = 0;
+    for (; x < width; x++) tail += abs(img[x] - tmpl[x]);
+    return tail;
+}
+
+// FixedWidth > 0: inštancia pre šírku zo SIZED_KERNEL_DIMS, rozdelenie riadku
+// na 32/16/8/4 bajtové časti sa vyrieši pri kompilácii. 0 = šírka za behu.
+template<int FixedWidth>
+float MatchTemplateLumaRowsSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    if (FixedWidth) width = FixedWidth;
+    __m128i acc = _mm_setzero_si128();
+    int tail = 0;
+
+    for (int y = 0; y < height; y++) {
+        tail += LumaRowTailSSE2(image + y * imgStride, tmpl + y * width, 0, width, acc);
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+            if (diff > tolerance * pixelsTested) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+    return (float)diff / (width * height);
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+template<int FixedWidth>
+float MatchTemplateLumaRowsAVX2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    if (FixedWidth) width = FixedWidth;
+    __m256i acc = _mm256_setzero_si256();
+    __m128i rest = _mm_setzero_si128();
+    int tail = 0;
+
+    auto total = [&]() {
+        __m128i sum = _mm_add_epi64(_mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)), rest);
+        return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum))) + tail;
+    };
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * width;
+        int x = 0;
+        for (; x + 32 <= width; x += 32) {
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(imgRow + x)),
+                _mm256_loadu_si256((const __m256i*)(tmplRow + x))));
+        }
+        tail += LumaRowTailSSE2(imgRow, tmplRow, x, width, rest);
+
+        int pixelsTested = (y + 1) * width;
+        if (pixelsTested >= earlyPixels && total() > tolerance * pixelsTested) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)total() / (width * height);
+}
+KERNEL_TARGET_END
+
+float MatchTemplateLumaSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    return MatchTemplateLumaRowsSSE2<0>(image, imgStride, tmpl, width, height, tolerance, earlyPixels);
+}
+
+float MatchTemplateLumaAVX2(const uint8_t* image, int imgStride, const uint8_t* tmpl,
+    int width, int height, int tolerance, int earlyPixels) {
+    return MatchTemplateLumaRowsAVX2<0>(image, imgStride, tmpl, width, height, tolerance, earlyPixels);
+}
+
+// Tabuľky [režim - CHANNELS_BGR][index šírky] podľa SIZED_KERNEL_DIMS, výška ostáva za behu
+#define WIDTH_KERNEL_ROW(KERNEL) { KERNEL<8>, KERNEL<16>, KERNEL<20>, KERNEL<24>, KERNEL<32>, KERNEL<48>, KERNEL<64> }
+
+const MatchTemplateSizedFn g_channelKernelsSSE2[2][SIZED_KERNEL_COUNT] = {
+    WIDTH_KERNEL_ROW(MatchTemplateBGRRowsSSE2), WIDTH_KERNEL_ROW(MatchTemplateLumaRowsSSE2) };
+const MatchTemplateSizedFn g_channelKernelsAVX2[2][SIZED_KERNEL_COUNT] = {
+    WIDTH_KERNEL_ROW(MatchTemplateBGRRowsAVX2), WIDTH_KERNEL_ROW(MatchTemplateLumaRowsAVX2) };
+
+#undef WIDTH_KERNEL_ROW
+
+// ===== MASKOVANÉ ŠABLÓNY =====
+// Pixely pozadia ikony (priehľadné alebo vyhladené okraje) sa neporovnávajú.
+// Maska je z alfy BMP alebo zo súboru <meno>.mask.bmp. Porovnáva sa
+// SAD(obraz AND maska, šablóna AND maska), takže ignorovaný bajt dá rozdiel 0.
+// Riadok sa číta len v rozsahu od prvého po posledný porovnaný pixel, celé
+// maskované riadky sa preskočia. Alfa sa pri maske neporovnáva (nesie masku),
+// skóre je priemerný rozdiel na porovnaný kanál.
+struct MaskedRow {
+    int y;
+    int begin, end;  // Bajty riadku [begin, end) s aspoň jedným porovnaným pixelom
+    int pixelsThrough;  // Porovnané pixely po tento riadok vrátane
+};
+
+struct MaskedPlane {
+    std::vector<uint8_t> data;  // Šablóna AND maska
+    std::vector<uint8_t> mask;  // 0xFF = porovnať, 0x00 = ignorovať (po bajtoch)
+    std::vector<MaskedRow> rows;  // Len riadky s porovnanými pixelmi
+    int rowBytes = 0;
+    int channels = 0;  // Porovnané bajty na pixel (3 pre BGRA bez alfy, 1 pre jas)
+    int activePixels = 0;
+};
+
+using MatchTemplateMaskedFn = float (*)(const uint8_t* image, int imgStride, const MaskedPlane& plane,
+    int tolerance, int earlyPixels);
+
+float MatchTemplateMaskedScalar(const uint8_t* image, int imgStride, const MaskedPlane& plane,
+    int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+
+    for (const MaskedRow& row : plane.rows) {
+        const uint8_t* imgRow = image + row.y * imgStride;
+        const uint8_t* tmplRow = plane.data.data() + row.y * plane.rowBytes;
+        const uint8_t* maskRow = plane.mask.data() + row.y * plane.rowBytes;
+        for (int x = row.begin; x < row.end; x++) {
+            totalDiff += abs((imgRow[x] & maskRow[x]) - tmplRow[x]);
+        }
+
+        if (row.pixelsThrough >= earlyPixels && totalDiff > tolerance * row.pixelsThrough * plane.channels) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (plane.activePixels * plane.channels);
+}
+
+// Bajty riadku [x, end) po 16, 8 a 4, zvyšok skalárne
+inline int MaskedRowTailSSE2(const uint8_t* img, const uint8_t* tmpl, const uint8_t* mask, int x, int end,
+    __m128i& acc) {
+    for (; x + 16 <= end; x += 16) {
+        __m128i imgBytes = _mm_and_si128(_mm_loadu_si128((const __m128i*)(img + x)), _mm_loadu_si128((const __m128i*)(mask + x)));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(imgBytes, _mm_loadu_si128((const __m128i*)(tmpl + x))));
+    }
+    if (x + 8 <= end) {
+        __m128i imgBytes = _mm_and_si128(_mm_loadl_epi64((const __m128i*)(img + x)), _mm_loadl_epi64((const __m128i*)(mask + x)));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(imgBytes, _mm_loadl_epi64((const __m128i*)(tmpl + x))));
+        x += 8;
+    }
+    if (x + 4 <= end) {
+        int a, b, m;
+        memcpy(&a, img + x, 4);
+        memcpy(&b, tmpl + x, 4);
+        memcpy(&m, mask + x, 4);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_cvtsi32_si128(a & m), _mm_cvtsi32_si128(b)));
+        x += 4;
+    }
+    int tail = 0;
+    for (; x < end; x++) tail += abs((img[x] & mask[x]) - tmpl[x]);
+    return tail;
+}
+
+float MatchTemplateMaskedSSE2(const uint8_t* image, int imgStride, const MaskedPlane& plane,
+    int tolerance, int earlyPixels) {
+    __m128i acc = _mm_setzero_si128();
+    int tail = 0;
+
+    for (const MaskedRow& row : plane.rows) {
+        const size_t offset = (size_t)row.y * plane.rowBytes;
+        tail += MaskedRowTailSSE2(image + row.y * imgStride, plane.data.data() + offset, plane.mask.data() + offset,
+            row.begin, row.end, acc);
+
+        if (row.pixelsThrough >= earlyPixels) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+            if (diff > tolerance * row.pixelsThrough * plane.channels) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+    return (float)diff / (plane.activePixels * plane.channels);
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+float MatchTemplateMaskedAVX2(const uint8_t* image, int imgStride, const MaskedPlane& plane,
+    int tolerance, int earlyPixels) {
+    __m256i acc = _mm256_setzero_si256();
+    __m128i rest = _mm_setzero_si128();
+    int tail = 0;
+
+    auto total = [&]() {
+        __m128i sum = _mm_add_epi64(_mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)), rest);
+        return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum))) + tail;
+    };
+
+    for (const MaskedRow& row : plane.rows) {
+        const uint8_t* imgRow = image + row.y * imgStride;
+        const uint8_t* tmplRow = plane.data.data() + (size_t)row.y * plane.rowBytes;
+        const uint8_t* maskRow = plane.mask.data() + (size_t)row.y * plane.rowBytes;
+        int x = row.begin;
+        for (; x + 32 <= row.end; x += 32) {
+            __m256i imgBytes = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(imgRow + x)),
+                _mm256_loadu_si256((const __m256i*)(maskRow + x)));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(imgBytes, _mm256_loadu_si256((const __m256i*)(tmplRow + x))));
+        }
+        tail += MaskedRowTailSSE2(imgRow, tmplRow, maskRow, x, row.end, rest);
+
+        if (row.pixelsThrough >= earlyPixels && total() > tolerance * row.pixelsThrough * plane.channels) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)total() / (plane.activePixels * plane.channels);
+}
+KERNEL_TARGET_END
+
+// Postaví rovinu z pixelov (pixelBytes na pixel) a masky pixelov keep (0/1).
+// Pri 4 bajtoch na pixel sa alfa neporovnáva.
+void BuildMaskedPlane(const uint8_t* pixels, int pixelBytes, const uint8_t* keep,
+    int width, int height, MaskedPlane& plane) {
+    plane.rowBytes = width * pixelBytes;
+    plane.channels = pixelBytes == 4 ? 3 : pixelBytes;
+    plane.data.assign((size_t)plane.rowBytes * height, 0);
+    plane.mask.assign((size_t)plane.rowBytes * height, 0);
+    plane.rows.clear();
+    plane.activePixels = 0;
+
+    for (int y = 0; y < height; y++) {
+        int first = -1, last = -1;
+        for (int x = 0; x < width; x++) {
+            if (!keep[(size_t)y * width + x]) continue;
+            if (first < 0) first = x;
+            last = x;
+            plane.activePixels++;
+            for (int c = 0; c < plane.channels; c++) {
+                size_t i = (size_t)y * plane.rowBytes + (size_t)x * pixelBytes + c;
+                plane.mask[i] = 0xFF;
+                plane.data[i] = pixels[i];
+            }
+        }
+        if (first < 0) continue;
+
+        // Rozsah sa zarovná na celé 16-bajtové SAD v rámci riadku, maskované
+        // bajty navyše dajú rozdiel 0 a skalárny zvyšok zväčša odpadne
+        int begin = first * pixelBytes, end = (last + 1) * pixelBytes;
+        int padded = min((end - begin + 15) & ~15, plane.rowBytes);
+        end = min(begin + padded, plane.rowBytes);
+        begin = end - padded;
+        plane.rows.push_back({ y, begin, end, plane.activePixels });
+    }
+}
+
+// ===== HUSTÁ MAPA SKÓRE =====
+// Pri vysokej tolerancii early rejection skoro nezaberie a každá pozícia
+// zaplatí celú šablónu. SAD nemá presnú posuvnú aktualizáciu: |a - b| sa
+// nerozloží na súčet cez stĺpce, ktorý by sa dal pri posune o pixel
+// prepočítať - po posune sa každý stĺpec šablóny porovnáva s iným stĺpcom
+// obrazu. Zdieľať sa dá načítaný riadok obrazu: MPSADBW z jedného loadu
+// spočíta 4-pixelové SAD pre 8 susedných pozícií naraz. Na 1-bajtovej rovine
+// (jas) tak 32 pozícií jedného riadku stojí 2 loady a 2 MPSADBW na 4 pixely
+// šablóny, 16-bitové súčty riadku šablóny sa potom rozšíria do 32-bit súčtov
+// pozícií. Pri BGRA by MPSADBW posúval po bajtoch, teda po štvrtinách pixela,
+// a PSADBW po pozíciách je tam lacnejší. Kernel je len pre AVX2, nižšie
+// úrovne počítajú mapu po pozíciách.
+constexpr int DENSE_BLOCK = 32;  // Pozícií v riadku na jeden priechod kernelu
+constexpr int DENSE_READ_MARGIN = 36;  // Bajty za šablónou ktoré kernel číta (8 + 32 - 4)
+
+// Skóre (priemerný rozdiel jasu, ako MatchTemplateLuma bez early rejection)
+// pre pozície [x0, x0 + blocks * DENSE_BLOCK) x [y0, y1). Volajúci zaručí,
+// že x0 + blocks * DENSE_BLOCK - DENSE_BLOCK + width + DENSE_READ_MARGIN <= šírka roviny.
+using DenseScoresFn = void (*)(const uint8_t* plane, int stride, const uint8_t* tmpl, int width, int height,
+    int x0, int blocks, int y0, int y1, float* scores, int scoresStride);
+
+KERNEL_TARGET_AVX2_BEGIN
+void DenseScoresLumaAVX2(const uint8_t* plane, int stride, const uint8_t* tmpl, int width, int height,
+    int x0, int blocks, int y0, int y1, float* scores, int scoresStride) {
+    const int quads = width / 4;
+    const float pixels = (float)(width * height);
+
+    for (int y = y0; y < y1; y++) {
+        float* out = scores + (size_t)(y - y0) * scoresStride;
+        for (int block = 0; block < blocks; block++) {
+            const int x = x0 + block * DENSE_BLOCK;
+            // Pozície x..x+7, x+8..x+15, x+16..x+23, x+24..x+31
+            __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+            __m256i sum2 = _mm256_setzero_si256(), sum3 = _mm256_setzero_si256();
+
+            for (int r = 0; r < height; r++) {
+                const uint8_t* row = plane + (size_t)(y + r) * stride + x;
+                const uint8_t* tmplRow = tmpl + r * width;
+                // 16-bit súčty riadku (najviac 256 * 255): a = [x..x+7 | x+16..x+23], b = [x+8..x+15 | x+24..x+31]
+                __m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+                int q = 0;
+                for (; q < quads; q++) {
+                    int quad;
+                    memcpy(&quad, tmplRow + q * 4, 4);
+                    const __m256i t = _mm256_set1_epi32(quad);
+                    a = _mm256_add_epi16(a, _mm256_mpsadbw_epu8(_mm256_loadu_si256((const __m256i*)(row + q * 4)), t, 0));
+                    b = _mm256_add_epi16(b, _mm256_mpsadbw_epu8(_mm256_loadu_si256((const __m256i*)(row + 8 + q * 4)), t, 0));
+                }
+                // Posledné 1-3 stĺpce šablóny: rozdiel pre 32 pozícií, poradie ako a, b
+                for (int j = q * 4; j < width; j++) {
+                    const __m256i image = _mm256_loadu_si256((const __m256i*)(row + j));
+                    const __m256i t = _mm256_set1_epi8((char)tmplRow[j]);
+                    __m256i diff = _mm256_sub_epi8(_mm256_max_epu8(image, t), _mm256_min_epu8(image, t));
+                    diff = _mm256_permute4x64_epi64(diff, 0xD8);
+                    a = _mm256_add_epi16(a, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(diff)));
+                    b = _mm256_add_epi16(b, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(diff, 1)));
+                }
+                sum0 = _mm256_add_epi32(sum0, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(a)));
+                sum2 = _mm256_add_epi32(sum2, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(a, 1)));
+                sum1 = _mm256_add_epi32(sum1, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(b)));
+                sum3 = _mm256_add_epi32(sum3, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(b, 1)));
+            }
+
+            const __m256 divisor = _mm256_set1_ps(pixels);
+            float* dst = out + (x - x0);
+            _mm256_storeu_ps(dst, _mm256_div_ps(_mm256_cvtepi32_ps(sum0), divisor));
+            _mm256_storeu_ps(dst + 8, _mm256_div_ps(_mm256_cvtepi32_ps(sum1), divisor));
+            _mm256_storeu_ps(dst + 16, _mm256_div_ps(_mm256_cvtepi32_ps(sum2), divisor));
+            _mm256_storeu_ps(dst + 24, _mm256_div_ps(_mm256_cvtepi32_ps(sum3), divisor));
+        }
+    }
+}
+KERNEL_TARGET_END
+
+// ===== OHRANIČENÝ SAD (STROM ZHLUKOV) =====
+// Celočíselný SAD roviny (BGRA, BGR alebo jas) pre strom zhlukov šablón.
+// Neskóruje, rozhoduje len či súčet prekročí hranicu: čiastočný súčet je
+// dolná hranica celého, takže skončiť po riadku so súčtom > bound je presné
+// (na rozdiel od early rejection podľa priemeru na pixel). imageMask sa
+// AND-uje na každé 4 bajty obrazu (0x00FFFFFF pre BGR, inak všetky bity).
+// Vráti celý SAD alebo čiastočný súčet > bound.
+using BoundedSadFn = int (*)(const uint8_t* image, int imgStride, const uint8_t* tmpl, int rowBytes, int height,
+    uint32_t imageMask, int bound);
+
+int BoundedSadScalar(const uint8_t* image, int imgStride, const uint8_t* tmpl, int rowBytes, int height,
+    uint32_t imageMask, int bound) {
+    const uint8_t maskBytes[4] = { (uint8_t)imageMask, (uint8_t)(imageMask >> 8),
+        (uint8_t)(imageMask >> 16), (uint8_t)(imageMask >> 24) };
+    int sum = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * rowBytes;
+        for (int i = 0; i < rowBytes; i++) sum += abs((imgRow[i] & maskBytes[i & 3]) - tmplRow[i]);
+        if (sum > bound) return sum;
+    }
+    return sum;
+}
+
+int BoundedSadSSE2(const uint8_t* image, int imgStride, const uint8_t* tmpl, int rowBytes, int height,
+    uint32_t imageMask, int bound) {
+    const __m128i mask = _mm_set1_epi32((int)imageMask);
+    const uint8_t maskBytes[4] = { (uint8_t)imageMask, (uint8_t)(imageMask >> 8),
+        (uint8_t)(imageMask >> 16), (uint8_t)(imageMask >> 24) };
+    __m128i acc = _mm_setzero_si128();
+    int tail = 0, sum = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * rowBytes;
+        int i = 0;
+        for (; i + 16 <= rowBytes; i += 16) {
+            __m128i imgBytes = _mm_and_si128(_mm_loadu_si128((const __m128i*)(imgRow + i)), mask);
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(imgBytes, _mm_loadu_si128((const __m128i*)(tmplRow + i))));
+        }
+        for (; i < rowBytes; i++) tail += abs((imgRow[i] & maskBytes[i & 3]) - tmplRow[i]);
+
+        sum = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc))) + tail;
+        if (sum > bound) return sum;
+    }
+    return sum;
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+int BoundedSadAVX2(const uint8_t* image, int imgStride, const uint8_t* tmpl, int rowBytes, int height,
+    uint32_t imageMask, int bound) {
+    const __m256i mask = _mm256_set1_epi32((int)imageMask);
+    const uint8_t maskBytes[4] = { (uint8_t)imageMask, (uint8_t)(imageMask >> 8),
+        (uint8_t)(imageMask >> 16), (uint8_t)(imageMask >> 24) };
+    __m256i acc = _mm256_setzero_si256();
+    __m128i rest = _mm_setzero_si128();
+    int tail = 0, sum = 0;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* imgRow = image + y * imgStride;
+        const uint8_t* tmplRow = tmpl + y * rowBytes;
+        int i = 0;
+        for (; i + 32 <= rowBytes; i += 32) {
+            __m256i imgBytes = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(imgRow + i)), mask);
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(imgBytes, _mm256_loadu_si256((const __m256i*)(tmplRow + i))));
+        }
+        if (i + 16 <= rowBytes) {
+            __m128i imgBytes = _mm_and_si128(_mm_loadu_si128((const __m128i*)(imgRow + i)), _mm256_castsi256_si128(mask));
+            rest = _mm_add_epi64(rest, _mm_sad_epu8(imgBytes, _mm_loadu_si128((const __m128i*)(tmplRow + i))));
+            i += 16;
+        }
+        for (; i < rowBytes; i++) tail += abs((imgRow[i] & maskBytes[i & 3]) - tmplRow[i]);
+
+        __m128i lanes = _mm_add_epi64(_mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)), rest);
+        sum = _mm_cvtsi128_si32(_mm_add_epi64(lanes, _mm_unpackhi_epi64(lanes, lanes))) + tail;
+        if (sum > bound) return sum;
+    }
+    return sum;
+}
+KERNEL_TARGET_END
+
+// ===== DISKRIMINAČNÉ PORADIE PIXELOV (RandomPixelTest) =====
+// Šablóna sa porovnáva v predpočítanom poradí pixelov: najprv tie, ktoré sa
+// najviac líšia od priemeru šablóny a od susedov (hrany, výrazné farby).
+// Nezhoda sa tak prejaví po pár pixeloch aj keď má šablóna ploché riadky.
+// offsets = bajtové posuny pixelov v obraze v tomto poradí,
+// orderedTmpl = pixely šablóny preusporiadané rovnako.
+constexpr int TEMPLATE_PIXELS = TEMPLATE_SIZE * TEMPLATE_SIZE;
+constexpr int ORDERED_EARLY_PIXELS = 8;  // Early rejection už po prvej skupine pixelov
+constexpr int ORDERED_EARLY_BASE = 100;  // EarlyPixelCount ktorému zodpovedá ORDERED_EARLY_PIXELS
+static_assert(TEMPLATE_PIXELS % 8 == 0, "Poradie pixelov sa porovnáva po skupinách 8 pixelov");
+
+// Prah early rejection v diskriminačnom poradí. Nezhoda sa tu prejaví skôr
+// ako po riadkoch, EarlyPixelCount sa preto škáluje: predvolených 100 = prvá
+// skupina 8 pixelov, 400 = 32 pixelov.
+inline int OrderedEarlyPixels(int earlyPixelCount) {
+    return (int)max((int64_t)ORDERED_EARLY_PIXELS,
+        min((int64_t)INT_MAX, (int64_t)earlyPixelCount * ORDERED_EARLY_PIXELS / ORDERED_EARLY_BASE));
+}
+
+float MatchTemplateOrderedScalar(const uint8_t* image, const int32_t* offsets,
+    const uint8_t* orderedTmpl, int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+
+    for (int i = 0; i < TEMPLATE_PIXELS; i += 8) {
+        for (int k = i; k < i + 8; k++) {
+            const uint8_t* pixel = image + offsets[k];
+            for (int c = 0; c < 4; c++) {
+                totalDiff += abs(pixel[c] - orderedTmpl[k * 4 + c]);
+            }
+        }
+
+        // Early rejection po každej skupine
+        if (i + 8 >= earlyPixels && totalDiff > tolerance * (i + 8) * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)totalDiff / (TEMPLATE_PIXELS * 4);
+}
+
+// SSE2 nemá gather, 4 pixely sa poskladajú z 32-bitových načítaní
+float MatchTemplateOrderedSSE2(const uint8_t* image, const int32_t* offsets,
+    const uint8_t* orderedTmpl, int tolerance, int earlyPixels) {
+    __m128i acc = _mm_setzero_si128();
+
+    for (int i = 0; i < TEMPLATE_PIXELS; i += 8) {
+        for (int k = i; k < i + 8; k += 4) {
+            __m128i imgPixels = _mm_setr_epi32(
+                *(const int*)(image + offsets[k]), *(const int*)(image + offsets[k + 1]),
+                *(const int*)(image + offsets[k + 2]), *(const int*)(image + offsets[k + 3]));
+            __m128i tmplPixels = _mm_loadu_si128((const __m128i*)(orderedTmpl + k * 4));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(imgPixels, tmplPixels));
+        }
+
+        if (i + 8 >= earlyPixels) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc)));
+            if (diff > tolerance * (i + 8) * 4) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc)));
+    return (float)diff / (TEMPLATE_PIXELS * 4);
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+// AVX2 načíta 8 pixelov jedným gather
+float MatchTemplateOrderedAVX2(const uint8_t* image, const int32_t* offsets,
+    const uint8_t* orderedTmpl, int tolerance, int earlyPixels) {
+    __m256i acc = _mm256_setzero_si256();
+
+    for (int i = 0; i < TEMPLATE_PIXELS; i += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(offsets + i));
+        __m256i imgPixels = _mm256_i32gather_epi32((const int*)image, index, 1);
+        __m256i tmplPixels = _mm256_loadu_si256((const __m256i*)(orderedTmpl + i * 4));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(imgPixels, tmplPixels));
+
+        if (i + 8 >= earlyPixels) {
+            __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum)));
+            if (diff > tolerance * (i + 8) * 4) return FLT_MAX;
+        }
+    }
+
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum)));
+    return (float)diff / (TEMPLATE_PIXELS * 4);
+}
+KERNEL_TARGET_END
+
+// Poradie pixelov šablóny podľa váhy: odchýlka od priemernej farby + rozdiel
+// k pravému a dolnému susedovi (alfa sa nepočíta, v šablónach je konštantná)
+void ComputePixelOrder(const uint8_t* data, uint16_t* order, uint8_t* orderedData) {
+    int mean[3] = {};
+    for (int p = 0; p < TEMPLATE_PIXELS; p++) {
+        for (int c = 0; c < 3; c++) mean[c] += data[p * 4 + c];
+    }
+    for (int c = 0; c < 3; c++) mean[c] /= TEMPLATE_PIXELS;
+
+    int weight[TEMPLATE_PIXELS];
+    for (int y = 0; y < TEMPLATE_SIZE; y++) {
+        for (int x = 0; x < TEMPLATE_SIZE; x++) {
+            const uint8_t* pixel = data + (y * TEMPLATE_SIZE + x) * 4;
+            int w = 0;
+            for (int c = 0; c < 3; c++) {
+                w += abs(pixel[c] - mean[c]);
+                if (x + 1 < TEMPLATE_SIZE) w += abs(pixel[c] - pixel[4 + c]);
+                if (y + 1 < TEMPLATE_SIZE) w += abs(pixel[c] - pixel[TEMPLATE_SIZE * 4 + c]);
+            }
+            weight[y * TEMPLATE_SIZE + x] = w;
+        }
+    }
+
+    for (int p = 0; p < TEMPLATE_PIXELS; p++) order[p] = (uint16_t)p;
+    std::stable_sort(order, order + TEMPLATE_PIXELS, [&](uint16_t a, uint16_t b) {
+        return weight[a] > weight[b];
+    });
+    for (int i = 0; i < TEMPLATE_PIXELS; i++) {
+        memcpy(orderedData + i * 4, data + order[i] * 4, 4);
+    }
+}
+
+// Koľko pixelov by porovnanie prečítalo pred early rejection, po skupinách
+// 8 pixelov v poradí riadkov alebo v diskriminačnom poradí. Len pre štatistiku.
+int CountPixelsTouched(const uint8_t* image, int stride, const uint8_t* tmpl, const uint16_t* order,
+    int tolerance, int earlyPixels) {
+    int totalDiff = 0;
+    for (int i = 0; i < TEMPLATE_PIXELS; i += 8) {
+        for (int k = i; k < i + 8; k++) {
+            int p = order ? order[k] : k;
+            const uint8_t* pixel = image + (p / TEMPLATE_SIZE) * stride + (p % TEMPLATE_SIZE) * 4;
+            for (int c = 0; c < 4; c++) {
+                totalDiff += abs(pixel[c] - tmpl[p * 4 + c]);
+            }
+        }
+        if (i + 8 >= earlyPixels && totalDiff > tolerance * (i + 8) * 4) return i + 8;
+    }
+    return TEMPLATE_PIXELS;
+}
+
+// ===== DÁVKOVÉ POROVNANIE VIACERÝCH ŠABLÓN =====
+// Blok BATCH_LANES šablón uložených prekladane po riadkoch. Riadok bloku:
+// [lane0 px0-15][lane1 px0-15]...[lane7 px0-15][lane0 px16-19]...[lane7 px16-19]
+// Riadok obrazu sa tak načíta raz a porovná so všetkými šablónami bloku.
+constexpr int BATCH_LANES = 8;
+constexpr int BLOCK_MAIN_PIXELS = TEMPLATE_SIZE / 8 * 8;
+constexpr int BLOCK_TAIL_PIXELS = TEMPLATE_SIZE - BLOCK_MAIN_PIXELS;
+constexpr int BLOCK_ROW_BYTES = BATCH_LANES * TEMPLATE_SIZE * 4;
+static_assert(BLOCK_TAIL_PIXELS == 0 || BLOCK_TAIL_PIXELS == 4, "Zvyšok riadku musí byť 0 alebo 4 pixely");
+
+struct alignas(64) CacheLine {
+    uint8_t bytes[64];
+};
+
+struct TemplateBlock {
+    std::vector<CacheLine> storage;  // TEMPLATE_SIZE riadkov po BLOCK_ROW_BYTES
+    int templateIds[BATCH_LANES];  // -1 = prázdna dráha
+    int laneCount = 0;
+
+    const uint8_t* Data() const { return storage.front().bytes; }
+    uint8_t* Data() { return storage.front().bytes; }
+
+    // Adresa 4 pixelov šablóny na pozícii (y, px) v prekladanom layoute
+    static size_t Offset(int lane, int y, int px) {
+        size_t row = (size_t)y * BLOCK_ROW_BYTES;
+        if (px < BLOCK_MAIN_PIXELS) {
+            return row + lane * BLOCK_MAIN_PIXELS * 4 + px * 4;
+        }
+        return row + BATCH_LANES * BLOCK_MAIN_PIXELS * 4 + lane * BLOCK_TAIL_PIXELS * 4 + (px - BLOCK_MAIN_PIXELS) * 4;
+    }
+};
+
+KERNEL_TARGET_AVX2_BEGIN
+// Horizontálny súčet SAD výsledkov 8 šablón, s[i] obsahuje 4 qword súčty šablóny i
+static inline __m256i ReduceLaneSums(const __m256i* s) {
+    __m256i h01 = _mm256_hadd_epi32(s[0], s[1]);
+    __m256i h23 = _mm256_hadd_epi32(s[2], s[3]);
+    __m256i h45 = _mm256_hadd_epi32(s[4], s[5]);
+    __m256i h67 = _mm256_hadd_epi32(s[6], s[7]);
+    __m256i a = _mm256_hadd_epi32(h01, h23);  // lo: šablóny 0-3 (q0+q1), hi: šablóny 0-3 (q2+q3)
+    __m256i b = _mm256_hadd_epi32(h45, h67);
+    return _mm256_add_epi32(
+        _mm256_permute2x128_si256(a, b, 0x20),
+        _mm256_permute2x128_si256(a, b, 0x31));
+}
+
+// AVX2 dávkové porovnanie s early rejection pre každú dráhu zvlášť.
+// Rejection prebieha v rovnakých bodoch ako MatchTemplateAVX2, skóre sú identické.
+void MatchTemplateBatchAVX2(const uint8_t* image, int imgStride, const TemplateBlock& block,
+    int tolerance, int earlyPixels, uint32_t laneMask, float* scores) {
+    const uint32_t allLanes = (1u << BATCH_LANES) - 1;
+    uint32_t rejected = ~laneMask & allLanes;
+    __m256i totals = _mm256_setzero_si256();
+    int pixelsTested = 0;
+
+    const uint8_t* rowData = block.Data();
+    for (int y = 0; y < TEMPLATE_SIZE; y++, rowData += BLOCK_ROW_BYTES) {
+        const uint8_t* imgRow = image + y * imgStride;
+
+        // Po 8 pixelov, obraz sa načíta raz pre všetky dráhy
+        for (int x = 0; x < BLOCK_MAIN_PIXELS; x += 8) {
+            __m256i imgPixels = _mm256_loadu_si256((const __m256i*)(imgRow + x * 4));
+
+            __m256i sads[BATCH_LANES];
+            for (int lane = 0; lane < BATCH_LANES; lane++) {
+                __m256i tmplPixels = _mm256_load_si256(
+                    (const __m256i*)(rowData + lane * BLOCK_MAIN_PIXELS * 4 + x * 4));
+                sads[lane] = _mm256_sad_epu8(imgPixels, tmplPixels);
+            }
+
+            totals = _mm256_add_epi32(totals, ReduceLaneSums(sads));
+            pixelsTested += 8;
+        }
+
+        // Zvyšné 4 pixely: dve dráhy na jeden SAD
+        if (BLOCK_TAIL_PIXELS) {
+            const uint8_t* tails = rowData + BATCH_LANES * BLOCK_MAIN_PIXELS * 4;
+            __m256i imgTail = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i*)(imgRow + BLOCK_MAIN_PIXELS * 4)));
+
+            __m256i t01 = _mm256_sad_epu8(imgTail, _mm256_load_si256((const __m256i*)(tails + 0)));
+            __m256i t23 = _mm256_sad_epu8(imgTail, _mm256_load_si256((const __m256i*)(tails + 32)));
+            __m256i t45 = _mm256_sad_epu8(imgTail, _mm256_load_si256((const __m256i*)(tails + 64)));
+            __m256i t67 = _mm256_sad_epu8(imgTail, _mm256_load_si256((const __m256i*)(tails + 96)));
+
+            // Výsledok v poradí [0,2,4,6 | 1,3,5,7], preusporiadaj na 0..7
+            __m256i tailSums = _mm256_hadd_epi32(_mm256_hadd_epi32(t01, t23), _mm256_hadd_epi32(t45, t67));
+            totals = _mm256_add_epi32(totals,
+                _mm256_permutevar8x32_epi32(tailSums, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+            pixelsTested += 4;
+        }
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels) {
+            __m256i over = _mm256_cmpgt_epi32(totals, _mm256_set1_epi32(tolerance * pixelsTested * 4));
+            rejected |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(over));
+            if (rejected == allLanes) {
+                for (int lane = 0; lane < BATCH_LANES; lane++) scores[lane] = FLT_MAX;
+                return;
+            }
+        }
+    }
+
+    alignas(32) int sums[BATCH_LANES];
+    _mm256_store_si256((__m256i*)sums, totals);
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        scores[lane] = (rejected >> lane) & 1 ? FLT_MAX : (float)sums[lane] / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+    }
+}
+KERNEL_TARGET_END
+
+// SSE2 dávkové porovnanie, rejection po každom riadku ako MatchTemplateSSE2
+void MatchTemplateBatchSSE2(const uint8_t* image, int imgStride, const TemplateBlock& block,
+    int tolerance, int earlyPixels, uint32_t laneMask, float* scores) {
+    const uint32_t allLanes = (1u << BATCH_LANES) - 1;
+    uint32_t rejected = ~laneMask & allLanes;
+    int totals[BATCH_LANES] = { 0 };
+    int pixelsTested = 0;
+
+    const uint8_t* blockData = block.Data();
+    for (int y = 0; y < TEMPLATE_SIZE && rejected != allLanes; y++) {
+        for (int x = 0; x < TEMPLATE_SIZE; x += 4) {
+            __m128i imgPixels = _mm_loadu_si128((const __m128i*)(image + y * imgStride + x * 4));
+
+            for (int lane = 0; lane < BATCH_LANES; lane++) {
+                if ((rejected >> lane) & 1) continue;
+
+                __m128i tmplPixels = _mm_load_si128(
+                    (const __m128i*)(blockData + TemplateBlock::Offset(lane, y, x)));
+                __m128i diff = _mm_sad_epu8(imgPixels, tmplPixels);
+                totals[lane] += _mm_cvtsi128_si32(diff) + _mm_cvtsi128_si32(_mm_srli_si128(diff, 8));
+            }
+            pixelsTested += 4;
+        }
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels) {
+            for (int lane = 0; lane < BATCH_LANES; lane++) {
+                if (totals[lane] > tolerance * pixelsTested * 4) rejected |= 1u << lane;
+            }
+        }
+    }
+
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        scores[lane] = (rejected >> lane) & 1 ? FLT_MAX : (float)totals[lane] / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+    }
+}
+
+KERNEL_TARGET_AVX512_BEGIN
+// AVX-512BW dávkové porovnanie. Rejection po každom riadku ako MatchTemplateAVX512,
+// skóre sú s ním identické. Súčty dráh sa skladajú len keď treba skontrolovať rejection.
+void MatchTemplateBatchAVX512(const uint8_t* image, int imgStride, const TemplateBlock& block,
+    int tolerance, int earlyPixels, uint32_t laneMask, float* scores) {
+    static_assert(BLOCK_MAIN_PIXELS == 16, "AVX-512 dávkový kernel očakáva 16 pixelov na dráhu");
+
+    const uint32_t allLanes = (1u << BATCH_LANES) - 1;
+    uint32_t rejected = ~laneMask & allLanes;
+    int pixelsTested = 0;
+
+    __m512i acc[BATCH_LANES];
+    for (int lane = 0; lane < BATCH_LANES; lane++) acc[lane] = _mm512_setzero_si512();
+    __m512i tailAcc0123 = _mm512_setzero_si512();
+    __m512i tailAcc4567 = _mm512_setzero_si512();
+
+    // Súčty všetkých 8 dráh ako int32x8
+    auto laneTotals = [&]() {
+        __m256i folded[BATCH_LANES];
+        for (int lane = 0; lane < BATCH_LANES; lane++) {
+            folded[lane] = _mm256_add_epi64(_mm512_castsi512_si256(acc[lane]), _mm512_extracti64x4_epi64(acc[lane], 1));
+        }
+        __m256i totals = ReduceLaneSums(folded);
+
+        if (BLOCK_TAIL_PIXELS) {
+            // Zvyšky: [l0q0,l0q1,l1q0,...], hadd dá poradie [0,1,4,5 | 2,3,6,7]
+            __m256i tailSums = _mm256_hadd_epi32(_mm512_cvtepi64_epi32(tailAcc0123), _mm512_cvtepi64_epi32(tailAcc4567));
+            totals = _mm256_add_epi32(totals,
+                _mm256_permutevar8x32_epi32(tailSums, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7)));
+        }
+        return totals;
+    };
+
+    const uint8_t* rowData = block.Data();
+    for (int y = 0; y < TEMPLATE_SIZE; y++, rowData += BLOCK_ROW_BYTES) {
+        const uint8_t* imgRow = image + y * imgStride;
+
+        // 16 pixelov každej dráhy jedným SAD
+        __m512i imgPixels = _mm512_loadu_si512(imgRow);
+        for (int lane = 0; lane < BATCH_LANES; lane++) {
+            acc[lane] = _mm512_add_epi64(acc[lane], _mm512_sad_epu8(imgPixels, _mm512_load_si512(rowData + lane * 64)));
+        }
+
+        // Zvyšné 4 pixely: štyri dráhy na jeden SAD
+        if (BLOCK_TAIL_PIXELS) {
+            const uint8_t* tails = rowData + BATCH_LANES * 64;
+            __m512i imgTail = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)(imgRow + 64)));
+            tailAcc0123 = _mm512_add_epi64(tailAcc0123, _mm512_sad_epu8(imgTail, _mm512_load_si512(tails)));
+            tailAcc4567 = _mm512_add_epi64(tailAcc4567, _mm512_sad_epu8(imgTail, _mm512_load_si512(tails + 64)));
+        }
+
+        pixelsTested += TEMPLATE_SIZE;
+
+        // Early rejection po každom riadku
+        if (pixelsTested >= earlyPixels) {
+            __m256i over = _mm256_cmpgt_epi32(laneTotals(), _mm256_set1_epi32(tolerance * pixelsTested * 4));
+            rejected |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(over));
+            if (rejected == allLanes) {
+                for (int lane = 0; lane < BATCH_LANES; lane++) scores[lane] = FLT_MAX;
+                return;
+            }
+        }
+    }
+
+    alignas(32) int sums[BATCH_LANES];
+    _mm256_store_si256((__m256i*)sums, laneTotals());
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        scores[lane] = (rejected >> lane) & 1 ? FLT_MAX : (float)sums[lane] / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+    }
+}
+KERNEL_TARGET_END
+
+// Skalárne dávkové porovnanie, každá dráha zvlášť
+void MatchTemplateBatchScalar(const uint8_t* image, int imgStride, const TemplateBlock& block,
+    int tolerance, int earlyPixels, uint32_t laneMask, float* scores) {
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        scores[lane] = FLT_MAX;
+        if (!((laneMask >> lane) & 1)) continue;
+
+        int totalDiff = 0;
+        int pixelsTested = 0;
+        bool rejected = false;
+
+        for (int y = 0; y < TEMPLATE_SIZE && !rejected; y++) {
+            for (int x = 0; x < TEMPLATE_SIZE; x += 4) {
+                const uint8_t* tmplPixels = block.Data() + TemplateBlock::Offset(lane, y, x);
+                for (int i = 0; i < 16; i++) {
+                    totalDiff += abs(image[y * imgStride + x * 4 + i] - tmplPixels[i]);
+                }
+            }
+            pixelsTested += TEMPLATE_SIZE;
+
+            // Early rejection po každom riadku
+            rejected = pixelsTested >= earlyPixels && totalDiff > tolerance * pixelsTested * 4;
+        }
+
+        if (!rejected) {
+            scores[lane] = (float)totalDiff / (TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+        }
+    }
+}
+
+// ===== PYRAMÍDOVÉ KERNELY =====
+// Zmenšenie na polovicu (floor priemeru 2x2) a hrubé porovnanie pre
+// pyramídu. Všetky verzie dávajú bitovo rovnaký výsledok.
+
+// dst má stride (srcWidth / 2) * 4
+void DownsampleImageScalar(const uint8_t* src, int srcWidth, int srcHeight, int srcStride, uint8_t* dst) {
+    int dstWidth = srcWidth / 2;
+    int dstHeight = srcHeight / 2;
+
+    for (int y = 0; y < dstHeight; y++) {
+        for (int x = 0; x < dstWidth; x++) {
+            int srcX = x * 2;
+            int srcY = y * 2;
+
+            // Priemer 2x2 oblasti
+            for (int c = 0; c < 4; c++) {
+                int sum = 0;
+                sum += src[srcY * srcStride + srcX * 4 + c];
+                sum += src[srcY * srcStride + (srcX + 1) * 4 + c];
+                sum += src[(srcY + 1) * srcStride + srcX * 4 + c];
+                sum += src[(srcY + 1) * srcStride + (srcX + 1) * 4 + c];
+
+                dst[(y * dstWidth + x) * 4 + c] = sum / 4;
+            }
+        }
+    }
+}
+
+// 4 pixely z dvoch riadkov -> 2 výstupné pixely ako 16-bit súčty >> 2
+inline __m128i DownsamplePairsSSE2(__m128i row0, __m128i row1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));  // px0, px1
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));  // px2, px3
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    return _mm_srli_epi16(sum, 2);
+}
+
+void DownsampleImageSSE2(const uint8_t* src, int srcWidth, int srcHeight, int srcStride, uint8_t* dst) {
+    int dstWidth = srcWidth / 2;
+    int dstHeight = srcHeight / 2;
+
+    for (int y = 0; y < dstHeight; y++) {
+        const uint8_t* row0 = src + (y * 2) * srcStride;
+        const uint8_t* row1 = row0 + srcStride;
+        uint8_t* out = dst + y * dstWidth * 4;
+
+        // 8 vstupných pixelov -> 4 výstupné
+        int x = 0;
+        for (; x + 4 <= dstWidth; x += 4) {
+            __m128i a = DownsamplePairsSSE2(
+                _mm_loadu_si128((const __m128i*)(row0 + x * 8)),
+                _mm_loadu_si128((const __m128i*)(row1 + x * 8)));
+            __m128i b = DownsamplePairsSSE2(
+                _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16)),
+                _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16)));
+            _mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(a, b));
+        }
+
+        for (; x < dstWidth; x++) {
+            for (int c = 0; c < 4; c++) {
+                int sum = row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c];
+                out[x * 4 + c] = sum / 4;
+            }
+        }
+    }
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+// 8 pixelov z dvoch riadkov -> 4 výstupné (v 128-bit pruhoch: 0,1 | 2,3)
+inline __m256i DownsamplePairsAVX2(__m256i row0, __m256i row1) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(row0, zero), _mm256_unpacklo_epi8(row1, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(row0, zero), _mm256_unpackhi_epi8(row1, zero));
+    __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+    return _mm256_srli_epi16(sum, 2);
+}
+
+void DownsampleImageAVX2(const uint8_t* src, int srcWidth, int srcHeight, int srcStride, uint8_t* dst) {
+    int dstWidth = srcWidth / 2;
+    int dstHeight = srcHeight / 2;
+
+    for (int y = 0; y < dstHeight; y++) {
+        const uint8_t* row0 = src + (y * 2) * srcStride;
+        const uint8_t* row1 = row0 + srcStride;
+        uint8_t* out = dst + y * dstWidth * 4;
+
+        // 16 vstupných pixelov -> 8 výstupných
+        int x = 0;
+        for (; x + 8 <= dstWidth; x += 8) {
+            __m256i a = DownsamplePairsAVX2(
+                _mm256_loadu_si256((const __m256i*)(row0 + x * 8)),
+                _mm256_loadu_si256((const __m256i*)(row1 + x * 8)));
+            __m256i b = DownsamplePairsAVX2(
+                _mm256_loadu_si256((const __m256i*)(row0 + x * 8 + 32)),
+                _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + 32)));
+            // packus pracuje po pruhoch: 0,1 | 4,5 | 2,3 | 6,7 -> preusporiadať
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256((__m256i*)(out + x * 4), packed);
+        }
+
+        for (; x < dstWidth; x++) {
+            for (int c = 0; c < 4; c++) {
+                int sum = row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c];
+                out[x * 4 + c] = sum / 4;
+            }
+        }
+    }
+}
+KERNEL_TARGET_END
+
+// Hrubé porovnanie zmenšenej šablóny (size x size). Pri pozícii nezarovnanej
+// na mriežku úrovne sa okraj zmenšenej šablóny mieša s pozadím, preto sa
+// porovnáva len vnútro. Early rejection po každom riadku.
+float QuickMatchScalar(const uint8_t* img, int stride, const uint8_t* tmpl, int size, int tolerance) {
+    int diff = 0;
+    int pixels = 0;
+
+    for (int y = 1; y < size - 1; y++) {
+        for (int x = 1; x < size - 1; x++) {
+            for (int c = 0; c < 4; c++) {
+                diff += abs(img[y * stride + x * 4 + c] - tmpl[y * size * 4 + x * 4 + c]);
+            }
+            pixels++;
+        }
+
+        if (pixels > 10 && diff > tolerance * pixels * 4) {
+            return FLT_MAX;
+        }
+    }
+
+    return (float)diff / (pixels * 4);
+}
+
+// SAD riadku po 4, 2 a 1 pixeli (bez čítania za koniec riadku)
+inline __m128i RowSadSSE2(const uint8_t* img, const uint8_t* tmpl, int pixels) {
+    __m128i sad = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 4 <= pixels; x += 4) {
+        sad = _mm_add_epi64(sad, _mm_sad_epu8(
+            _mm_loadu_si128((const __m128i*)(img + x * 4)),
+            _mm_loadu_si128((const __m128i*)(tmpl + x * 4))));
+    }
+    if (x + 2 <= pixels) {
+        sad = _mm_add_epi64(sad, _mm_sad_epu8(
+            _mm_loadl_epi64((const __m128i*)(img + x * 4)),
+            _mm_loadl_epi64((const __m128i*)(tmpl + x * 4))));
+        x += 2;
+    }
+    if (x < pixels) {
+        sad = _mm_add_epi64(sad, _mm_sad_epu8(
+            _mm_cvtsi32_si128(*(const int*)(img + x * 4)),
+            _mm_cvtsi32_si128(*(const int*)(tmpl + x * 4))));
+    }
+    return sad;
+}
+
+float QuickMatchSSE2(const uint8_t* img, int stride, const uint8_t* tmpl, int size, int tolerance) {
+    const int rowPixels = size - 2;
+    __m128i sad = _mm_setzero_si128();
+    int pixels = 0;
+
+    for (int y = 1; y < size - 1; y++) {
+        sad = _mm_add_epi64(sad, RowSadSSE2(img + y * stride + 4, tmpl + (y * size + 1) * 4, rowPixels));
+        pixels += rowPixels;
+
+        if (pixels > 10) {
+            int diff = _mm_cvtsi128_si32(_mm_add_epi64(sad, _mm_unpackhi_epi64(sad, sad)));
+            if (diff > tolerance * pixels * 4) return FLT_MAX;
+        }
+    }
+
+    int diff = _mm_cvtsi128_si32(_mm_add_epi64(sad, _mm_unpackhi_epi64(sad, sad)));
+    return (float)diff / (pixels * 4);
+}
+
+// ===== HASH DLAŽDÍC (DETEKCIA ZMIEN) =====
+constexpr int DIRTY_TILE_SIZE = 64;  // Dlaždica 64x64 pixelov
+
+// Hash po 64-bitových slovách ako akumulácia XXH3: acc += swap(w) + lo(w^k) * hi(w^k)
+// v štyroch dráhach. Kľúč k závisí od pozície slova v riadku aj od riadku,
+// takže posun obsahu v dlaždici hash zmení. Všetky verzie dávajú rovnaký výsledok.
+constexpr uint64_t TILE_HASH_KEYS[4] = {
+    0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x85EBCA77C2B2AE63ull
+};
+constexpr uint64_t TILE_HASH_STEP = 0x27D4EB2F165667C5ull;  // Kľúč ďalších 4 slov
+constexpr int TILE_HASH_ROW_STEPS = 16;  // Riadok dlaždice má najviac 8 krokov
+
+inline void TileHashWord(uint64_t* acc, int index, uint64_t word, uint64_t rowKey) {
+    uint64_t mixed = word ^ (TILE_HASH_KEYS[index & 3] + rowKey + (uint64_t)(index >> 2) * TILE_HASH_STEP);
+    acc[index & 3] += ((word << 32) | (word >> 32)) + (mixed & 0xFFFFFFFF) * (mixed >> 32);
+}
+
+// Slová za posledným celým 32-bajtovým blokom riadku, neúplné slovo doplnené nulami
+inline void TileHashTail(uint64_t* acc, const uint8_t* row, int first, int bytes, uint64_t rowKey) {
+    for (int i = first; i * 8 < bytes; i++) {
+        uint64_t word = 0;
+        memcpy(&word, row + i * 8, min(8, bytes - i * 8));
+        TileHashWord(acc, i, word, rowKey);
+    }
+}
+
+inline uint64_t TileHashFinish(const uint64_t* acc) {
+    uint64_t h = acc[0] ^ ((acc[1] << 16) | (acc[1] >> 48)) ^
+        ((acc[2] << 32) | (acc[2] >> 32)) ^ ((acc[3] << 48) | (acc[3] >> 16));
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t HashTileScalar(const uint8_t* data, int stride, int width, int height) {
+    uint64_t acc[4] = {};
+    for (int y = 0; y < height; y++) {
+        TileHashTail(acc, data + (size_t)y * stride, 0, width * 4, (uint64_t)y * TILE_HASH_ROW_STEPS * TILE_HASH_STEP);
+    }
+    return TileHashFinish(acc);
+}
+
+// Jeden 16-bajtový krok: dve slová, dve dráhy
+inline __m128i TileHashStepSSE2(__m128i acc, __m128i data, __m128i key) {
+    __m128i mixed = _mm_xor_si128(data, key);
+    acc = _mm_add_epi64(acc, _mm_shuffle_epi32(data, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_epi64(acc, _mm_mul_epu32(mixed, _mm_srli_epi64(mixed, 32)));
+}
+
+uint64_t HashTileSSE2(const uint8_t* data, int stride, int width, int height) {
+    const int bytes = width * 4;
+    const int chunks = bytes / 32;
+    const __m128i keyLo = _mm_set_epi64x((long long)TILE_HASH_KEYS[1], (long long)TILE_HASH_KEYS[0]);
+    const __m128i keyHi = _mm_set_epi64x((long long)TILE_HASH_KEYS[3], (long long)TILE_HASH_KEYS[2]);
+    const __m128i step = _mm_set1_epi64x((long long)TILE_HASH_STEP);
+    __m128i acc01 = _mm_setzero_si128();
+    __m128i acc23 = _mm_setzero_si128();
+    uint64_t tail[4] = {};
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = data + (size_t)y * stride;
+        uint64_t rowKey = (uint64_t)y * TILE_HASH_ROW_STEPS * TILE_HASH_STEP;
+        __m128i offset = _mm_set1_epi64x((long long)rowKey);
+
+        for (int c = 0; c < chunks; c++) {
+            acc01 = TileHashStepSSE2(acc01, _mm_loadu_si128((const __m128i*)(row + c * 32)), _mm_add_epi64(keyLo, offset));
+            acc23 = TileHashStepSSE2(acc23, _mm_loadu_si128((const __m128i*)(row + c * 32 + 16)), _mm_add_epi64(keyHi, offset));
+            offset = _mm_add_epi64(offset, step);
+        }
+        TileHashTail(tail, row, chunks * 4, bytes, rowKey);
+    }
+
+    uint64_t acc[4];
+    _mm_storeu_si128((__m128i*)acc, acc01);
+    _mm_storeu_si128((__m128i*)(acc + 2), acc23);
+    for (int lane = 0; lane < 4; lane++) acc[lane] += tail[lane];
+    return TileHashFinish(acc);
+}
+
+KERNEL_TARGET_AVX2_BEGIN
+uint64_t HashTileAVX2(const uint8_t* data, int stride, int width, int height) {
+    const int bytes = width * 4;
+    const int chunks = bytes / 32;
+    const __m256i keys = _mm256_set_epi64x((long long)TILE_HASH_KEYS[3], (long long)TILE_HASH_KEYS[2],
+        (long long)TILE_HASH_KEYS[1], (long long)TILE_HASH_KEYS[0]);
+    const __m256i step = _mm256_set1_epi64x((long long)TILE_HASH_STEP);
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t tail[4] = {};
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = data + (size_t)y * stride;
+        uint64_t rowKey = (uint64_t)y * TILE_HASH_ROW_STEPS * TILE_HASH_STEP;
+        __m256i key = _mm256_add_epi64(keys, _mm256_set1_epi64x((long long)rowKey));
+
+        for (int c = 0; c < chunks; c++) {
+            __m256i words = _mm256_loadu_si256((const __m256i*)(row + c * 32));
+            __m256i mixed = _mm256_xor_si256(words, key);
+            acc = _mm256_add_epi64(acc, _mm256_shuffle_epi32(words, _MM_SHUFFLE(2, 3, 0, 1)));
+            acc = _mm256_add_epi64(acc, _mm256_mul_epu32(mixed, _mm256_srli_epi64(mixed, 32)));
+            key = _mm256_add_epi64(key, step);
+        }
+        TileHashTail(tail, row, chunks * 4, bytes, rowKey);
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    for (int lane = 0; lane < 4; lane++) lanes[lane] += tail[lane];
+    return TileHashFinish(lanes);
+}
+KERNEL_TARGET_END
+
+// ===== VÝBER KERNELU PODĽA CPU =====
+enum KernelLevel {
+    KERNEL_SCALAR = 0,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    KERNEL_LEVEL_COUNT
+};
+constexpr int KERNEL_AUTO = -1;  // Najširší kernel ktorý CPU podporuje
+
+using MatchTemplateFn = float (*)(const uint8_t* image, int imgStride,
+    const uint8_t* tmpl, int tolerance, int earlyPixels);
+using MatchTemplateBatchFn = void (*)(const uint8_t* image, int imgStride, const TemplateBlock& block,
+    int tolerance, int earlyPixels, uint32_t laneMask, float* scores);
+using DownsampleImageFn = void (*)(const uint8_t* src, int srcWidth, int srcHeight, int srcStride, uint8_t* dst);
+using QuickMatchFn = float (*)(const uint8_t* img, int stride, const uint8_t* tmpl, int size, int tolerance);
+using HashTileFn = uint64_t (*)(const uint8_t* data, int stride, int width, int height);
+using MatchTemplateOrderedFn = float (*)(const uint8_t* image, const int32_t* offsets,
+    const uint8_t* orderedTmpl, int tolerance, int earlyPixels);
+
+struct KernelTable {
+    const char* configName;  // Hodnota kľúča Kernel v config.ini
+    const char* name;
+    MatchTemplateFn matchTemplate;
+    MatchTemplateBatchFn matchTemplateBatch;
+    DownsampleImageFn downsampleImage;
+    QuickMatchFn quickMatch;
+    HashTileFn hashTile;
+    MatchTemplateOrderedFn matchTemplateOrdered;
+    const MatchTemplateSizedFn (*sizedKernels)[SIZED_KERNEL_COUNT];  // nullptr = len všeobecný
+    MatchTemplateSizedFn matchTemplateGeneric;
+    MatchTemplateSizedFn matchTemplateBGR;
+    MatchTemplateSizedFn matchTemplateLuma;
+    ConvertLumaFn convertLuma;
+    const MatchTemplateSizedFn (*channelKernels)[SIZED_KERNEL_COUNT];  // nullptr = len všeobecné
+    MatchTemplateMaskedFn matchTemplateMasked;
+    DenseScoresFn denseScoresLuma;  // nullptr = mapa skóre po pozíciách
+    BoundedSadFn boundedSad;
+};
+
+const KernelTable g_kernelTables[KERNEL_LEVEL_COUNT] = {
+    { "scalar", "Scalar", MatchTemplateScalar, MatchTemplateBatchScalar, DownsampleImageScalar, QuickMatchScalar, HashTileScalar, MatchTemplateOrderedScalar,
+        nullptr, MatchTemplateGenericScalar, MatchTemplateBGRScalar, MatchTemplateLumaScalar, ConvertLumaScalar,
+        nullptr, MatchTemplateMaskedScalar, nullptr, BoundedSadScalar },
+    { "sse2", "SSE2", MatchTemplateSSE2, MatchTemplateBatchSSE2, DownsampleImageSSE2, QuickMatchSSE2, HashTileSSE2, MatchTemplateOrderedSSE2,
+        g_sizedKernelsSSE2, MatchTemplateGenericSSE2, MatchTemplateBGRSSE2, MatchTemplateLumaSSE2, ConvertLumaSSE2,
+        g_channelKernelsSSE2, MatchTemplateMaskedSSE2, nullptr, BoundedSadSSE2 },
+    // Vnútro zmenšenej šablóny má najviac 8 pixelov na riadok, širší QuickMatch
+    // než SSE2 len pridá redukciu navyše. Poradie pixelov odmieta po 8 pixeloch,
+    // 16-pixelový gather by čítal zbytočne. Šablóny iných rozmerov majú na
+    // AVX-512 AVX2 inštancie, bežné šírky by maskovanými loadmi nič nezískali.
+    { "avx2", "AVX2", MatchTemplateAVX2, MatchTemplateBatchAVX2, DownsampleImageAVX2, QuickMatchSSE2, HashTileAVX2, MatchTemplateOrderedAVX2,
+        g_sizedKernelsAVX2, MatchTemplateGenericSSE2, MatchTemplateBGRAVX2, MatchTemplateLumaAVX2, ConvertLumaAVX2,
+        g_channelKernelsAVX2, MatchTemplateMaskedAVX2, DenseScoresLumaAVX2, BoundedSadAVX2 },
+    { "avx512", "AVX-512BW", MatchTemplateAVX512, MatchTemplateBatchAVX512, DownsampleImageAVX2, QuickMatchSSE2, HashTileAVX2, MatchTemplateOrderedAVX2,
+        g_sizedKernelsAVX2, MatchTemplateGenericSSE2, MatchTemplateBGRAVX2, MatchTemplateLumaAVX2, ConvertLumaAVX2,
+        g_channelKernelsAVX2, MatchTemplateMaskedAVX2, DenseScoresLumaAVX2, BoundedSadAVX2 },
+};
+
+// Kernel pre šablónu width x height mimo TEMPLATE_SIZE: inštancia pre bežné
+// rozmery, inak všeobecný
+MatchTemplateSizedFn SelectSizedKernel(const KernelTable& kernels, int width, int height) {
+    int wi = SizedKernelIndex(width), hi = SizedKernelIndex(height);
+    if (kernels.sizedKernels && wi >= 0 && hi >= 0) return kernels.sizedKernels[wi][hi];
+    return kernels.matchTemplateGeneric;
+}
+
+// Kernel pre ChannelMode BGR alebo jas a šablónu danej šírky: inštancia pre
+// bežné šírky, inak všeobecný
+MatchTemplateSizedFn SelectChannelKernel(const KernelTable& kernels, int channelMode, int width) {
+    int wi = SizedKernelIndex(width);
+    if (kernels.channelKernels && wi >= 0) return kernels.channelKernels[channelMode - CHANNELS_BGR][wi];
+    return channelMode == CHANNELS_LUMA ? kernels.matchTemplateLuma : kernels.matchTemplateBGR;
+}
+
+int g_maxKernelLevel = KERNEL_SCALAR;  // Nastaví DetectKernelLevel() pri štarte
+
+// Zistí najširšiu SIMD úroveň podľa cpuid a podpory OS (XCR0)
+int DetectKernelLevel() {
+    int info[4];
+    CpuId(info, 0, 0);
+    int maxLeaf = info[0];
+
+    CpuId(info, 1, 0);
+    bool sse2 = (info[3] >> 26) & 1;
+    bool sse41 = (info[2] >> 19) & 1;  // AVX2 kernel používa _mm_extract_epi32
+    bool osxsave = (info[2] >> 27) & 1;
+    bool avx = (info[2] >> 28) & 1;
+
+    // OS musí ukladať YMM (bity 1-2) a pre AVX-512 aj opmask/ZMM (bity 5-7)
+    unsigned long long xcr0 = osxsave ? ReadXcr0() : 0;
+    bool osYmm = (xcr0 & 0x6) == 0x6;
+    bool osZmm = (xcr0 & 0xE6) == 0xE6;
+
+    bool avx2 = false, avx512bw = false;
+    if (maxLeaf >= 7) {
+        CpuId(info, 7, 0);
+        avx2 = avx && osYmm && sse41 && ((info[1] >> 5) & 1);
+        avx512bw = avx2 && osZmm && ((info[1] >> 16) & 1) && ((info[1] >> 30) & 1);  // F + BW
+    }
+
+    if (avx512bw) return KERNEL_AVX512;
+    if (avx2) return KERNEL_AVX2;
+    if (sse2) return KERNEL_SSE2;
+    return KERNEL_SCALAR;
+}
+
+// Vyžiadaná úroveň obmedzená na to, čo CPU podporuje
+int ResolveKernelLevel(int requested) {
+    if (requested == KERNEL_AUTO || requested > g_maxKernelLevel) return g_maxKernelLevel;
+    return max(requested, (int)KERNEL_SCALAR);
+}
+
+const KernelTable& GetKernels(int requested) {
+    return g_kernelTables[ResolveKernelLevel(requested)];
+}
+
+int ParseKernelLevel(const std::string& value) {
+    for (int level = 0; level < KERNEL_LEVEL_COUNT; level++) {
+        if (value == g_kernelTables[level].configName) return level;
+    }
+    return KERNEL_AUTO;
+}
+
+// ===== PYRAMÍDOVÉ VYHĽADÁVANIE =====
+constexpr int PYRAMID_MAX_LEVELS = 3;  // 20x20, 10x10, 5x5 šablóna
+
+// Pyramída snímky jedného regiónu. Úroveň 0 je pohľad priamo do snímky,
+// každá ďalšia má polovičné rozmery. Buffery sa medzi cyklami znovu používajú.
+class ImagePyramid {
+private:
+    std::vector<uint8_t> m_buffers[PYRAMID_MAX_LEVELS];
+    FrameView m_levels[PYRAMID_MAX_LEVELS];
+    int m_levelCount = 0;
+
+public:
+    void Build(const FrameView& base, int levels, const KernelTable& kernels) {
+        m_levels[0] = base;
+        m_levelCount = 1;
+
+        for (int level = 1; level < min(levels, PYRAMID_MAX_LEVELS); level++) {
+            const FrameView& src = m_levels[level - 1];
+            int width = src.width / 2;
+            int height = src.height / 2;
+            if (width < (TEMPLATE_SIZE >> level) || height < (TEMPLATE_SIZE >> level)) break;
+
+            m_buffers[level].resize((size_t)width * height * 4);
+            kernels.downsampleImage(src.data, src.width, src.height, src.stride, m_buffers[level].data());
+            m_levels[level] = { m_buffers[level].data(), base.x, base.y, width, height, width * 4 };
+            m_levelCount++;
+        }
+    }
+
+    int LevelCount() const { return m_levelCount; }
+    const FrameView& Level(int level) const { return m_levels[level]; }
+};
+
+class PyramidSearch {
+public:
+    struct Candidate {
+        int x, y;
+        float score;
+    };
+
+private:
+    // Lepší kandidát = nižšie skóre, pri rovnakom skoršia pozícia po riadkoch
+    static bool Better(const Candidate& a, const Candidate& b) {
+        if (a.score != b.score) return a.score < b.score;
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    }
+
+    static bool RowOrder(const Candidate& a, const Candidate& b) {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    }
+
+public:
+    // Coarse-to-fine: najhrubšia úroveň sa prehľadá celá, kandidáti sa potom
+    // premietajú o úroveň nižšie a overí sa ich okolie 3x3. Do candidates dá
+    // pozície v plnom rozlíšení na verifikáciu, zoradené po riadkoch.
+    // tmplPyramid[l - 1] je šablóna úrovne l.
+    // Na každej úrovni ostane najviac maxCandidates najlepších, na verifikáciu
+    // ide teda najviac 9 * maxCandidates pozícií bez ohľadu na kontrast obrazu.
+    void SearchPyramid(
+        const ImagePyramid& frame,
+        const uint8_t* const* tmplPyramid,
+        int levels, int tolerance, int maxCandidates, const KernelTable& kernels,
+        std::vector<Candidate>& candidates)
+    {
+        candidates.clear();
+        const int top = min(levels, frame.LevelCount()) - 1;
+        const int coarseTolerance = tolerance * 2;  // Voľnejšia tolerancia pre zmenšené úrovne
+
+        if (top <= 0) {
+            // Pyramída sa nedá postaviť (región pod dvojnásobok šablóny), over každú pozíciu
+            const FrameView& image = frame.Level(0);
+            for (int y = 0; y <= image.height - TEMPLATE_SIZE; y++) {
+                for (int x = 0; x <= image.width - TEMPLATE_SIZE; x++) {
+                    candidates.push_back({ x, y, 0.0f });
+                }
+            }
+            return;
+        }
+
+        // Rýchle vyhľadávanie na najmenšej úrovni, skóre všetkých pozícií
+        // do buffra workera (používa sa znova v ďalších cykloch)
+        const FrameView& coarse = frame.Level(top);
+        const int coarseSize = TEMPLATE_SIZE >> top;
+        const int columns = coarse.width - coarseSize + 1;
+        const int rows = coarse.height - coarseSize + 1;
+        thread_local std::vector<float> scores;
+        scores.resize((size_t)max(columns, 0) * max(rows, 0));
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < columns; x++) {
+                scores[(size_t)y * columns + x] = kernels.quickMatch(coarse.Pixel(x, y), coarse.stride,
+                    tmplPyramid[top - 1], coarseSize, coarseTolerance);
+            }
+        }
+
+        // Kandidát je len lokálne minimum 3x3 (susedia toho istého výskytu
+        // by zabrali miesto iným), najlepších maxCandidates drží max-halda
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < columns; x++) {
+                const float score = scores[(size_t)y * columns + x];
+                if (score >= coarseTolerance) continue;
+
+                bool minimum = true;
+                for (int ny = max(y - 1, 0); ny <= min(y + 1, rows - 1) && minimum; ny++) {
+                    for (int nx = max(x - 1, 0); nx <= min(x + 1, columns - 1); nx++) {
+                        if (scores[(size_t)ny * columns + nx] < score) {
+                            minimum = false;
+                            break;
+                        }
+                    }
+                }
+                if (!minimum) continue;
+
+                const Candidate candidate = { x, y, score };
+                if ((int)candidates.size() < maxCandidates) {
+                    candidates.push_back(candidate);
+                    std::push_heap(candidates.begin(), candidates.end(), Better);
+                }
+                else if (Better(candidate, candidates.front())) {
+                    std::pop_heap(candidates.begin(), candidates.end(), Better);
+                    candidates.back() = candidate;
+                    std::push_heap(candidates.begin(), candidates.end(), Better);
+                }
+            }
+        }
+
+        // Zjemňovanie po úrovniach
+        thread_local std::vector<Candidate> refined;
+        for (int level = top - 1; level >= 0 && !candidates.empty(); level--) {
+            const FrameView& image = frame.Level(level);
+            const int size = TEMPLATE_SIZE >> level;
+            refined.clear();
+
+            for (const auto& candidate : candidates) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int x = candidate.x * 2 + dx;
+                        int y = candidate.y * 2 + dy;
+                        if (x < 0 || y < 0 || x > image.width - size || y > image.height - size) continue;
+
+                        if (level == 0) {
+                            refined.push_back({ x, y, candidate.score });
+                            continue;
+                        }
+
+                        float score = kernels.quickMatch(image.Pixel(x, y), image.stride,
+                            tmplPyramid[level - 1], size, coarseTolerance);
+                        if (score < coarseTolerance) {
+                            refined.push_back({ x, y, score });
+                        }
+                    }
+                }
+            }
+
+            // Susedné kandidáty sa prekrývajú, každú pozíciu stačí overiť raz.
+            // Poradie po riadkoch zachová rovnaký tie-break ako štandardný sken.
+            std::sort(refined.begin(), refined.end(), RowOrder);
+            refined.erase(std::unique(refined.begin(), refined.end(), [](const Candidate& a, const Candidate& b) {
+                return a.x == b.x && a.y == b.y;
+            }), refined.end());
+
+            // Medziúrovne majú vlastné skóre, ďalej ide len najlepších maxCandidates
+            if (level > 0 && (int)refined.size() > maxCandidates) {
+                std::nth_element(refined.begin(), refined.begin() + maxCandidates, refined.end(), Better);
+                refined.resize(maxCandidates);
+                std::sort(refined.begin(), refined.end(), RowOrder);
+            }
+
+            candidates.swap(refined);
+        }
+    }
+    
+    // Verifikuj kandidátov v plnej veľkosti
+    float VerifyCandidate(
+        const uint8_t* image, int imgStride,
+        const uint8_t* tmpl, int tmplSize,
+        int x, int y, int tolerance, const KernelTable& kernels) 
+    {
+        // Použiť kernel vybraný podľa CPU
+        return kernels.matchTemplate(
+            &image[y * imgStride + x * 4],
+            imgStride,
+            tmpl,
+            tolerance,
+            100
+        );
+    }
+};
+
+// ===== WORK-STEALING THREAD POOL =====
+// Počet fyzických jadier (hyperthreading pri SAD kerneloch nepomáha)
+int GetPhysicalCoreCount() {
+#ifndef _WIN32
+    return max(1, (int)std::thread::hardware_concurrency());  // Mimo Windows logické jadrá
+#else
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(
+        length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length)) {
+        return max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    int cores = 0;
+    for (const auto& entry : info) {
+        if (entry.Relationship == RelationProcessorCore) cores++;
+    }
+    return max(1, cores);
+#endif
+}
+
+// Každý worker dostane súvislý rozsah indexov úloh. Vlastník berie úlohy zo
+// začiatku svojho rozsahu, nečinný worker ukradne polovicu zvyšku od konca
+// rozsahu iného workera. Volajúce vlákno pracuje ako worker 0.
+class WorkStealingPool {
+public:
+    using TaskFn = std::function<void(size_t taskIndex, int workerId)>;
+
+private:
+    struct alignas(64) WorkerRange {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    std::vector<std::thread> m_threads;
+    std::unique_ptr<WorkerRange[]> m_ranges;
+    int m_workerCount = 1;
+
+    std::mutex m_batchMutex;
+    std::condition_variable m_batchStart;
+    std::condition_variable m_batchDone;
+    uint64_t m_batchId = 0;
+    int m_activeWorkers = 0;  // Pomocné vlákna ešte pracujúce na aktuálnej dávke
+    const TaskFn* m_batchFn = nullptr;
+    bool m_stop = false;
+
+    bool PopLocal(int worker, size_t& taskIndex) {
+        WorkerRange& range = m_ranges[worker];
+        std::lock_guard<std::mutex> lock(range.mutex);
+        if (range.begin >= range.end) return false;
+        taskIndex = range.begin++;
+        return true;
+    }
+
+    bool Steal(int thief) {
+        for (int i = 1; i < m_workerCount; i++) {
+            WorkerRange& victim = m_ranges[(thief + i) % m_workerCount];
+            size_t stolenBegin, stolenEnd;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.begin >= victim.end) continue;
+
+                size_t take = (victim.end - victim.begin + 1) / 2;
+                stolenEnd = victim.end;
+                stolenBegin = victim.end - take;
+                victim.end = stolenBegin;
+            }
+
+            WorkerRange& own = m_ranges[thief];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = stolenBegin;
+            own.end = stolenEnd;
+            return true;
+        }
+        return false;
+    }
+
+    void RunWorker(int worker, const TaskFn& fn) {
+        size_t taskIndex;
+        do {
+            while (PopLocal(worker, taskIndex)) {
+                fn(taskIndex, worker);
+            }
+        } while (Steal(worker));
+    }
+
+    void WorkerLoop(int worker) {
+        uint64_t seenBatch = 0;
+        for (;;) {
+            const TaskFn* fn;
+            {
+                std::unique_lock<std::mutex> lock(m_batchMutex);
+                m_batchStart.wait(lock, [&] { return m_stop || m_batchId != seenBatch; });
+                if (m_stop) return;
+                seenBatch = m_batchId;
+                fn = m_batchFn;
+            }
+
+            RunWorker(worker, *fn);
+
+            std::lock_guard<std::mutex> lock(m_batchMutex);
+            if (--m_activeWorkers == 0) {
+                m_batchDone.notify_all();
+            }
+        }
+    }
+
+public:
+    // workerCount <= 0 = počet fyzických jadier
+    void Start(int workerCount) {
+        Stop();
+
+        m_workerCount = workerCount > 0 ? workerCount : GetPhysicalCoreCount();
+        m_ranges.reset(new WorkerRange[m_workerCount]);
+        m_stop = false;
+
+        for (int w = 1; w < m_workerCount; w++) {
+            m_threads.emplace_back(&WorkStealingPool::WorkerLoop, this, w);
+        }
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_batchMutex);
+            m_stop = true;
+        }
+        m_batchStart.notify_all();
+
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+        m_threads.clear();
+    }
+
+    int WorkerCount() const { return m_workerCount; }
+
+    // Spustí úlohy 0..taskCount-1 a počká kým všetky skončia
+    void RunBatch(size_t taskCount, const TaskFn& fn) {
+        if (taskCount == 0) return;
+
+        if (m_workerCount == 1) {
+            for (size_t i = 0; i < taskCount; i++) fn(i, 0);
+            return;
+        }
+
+        // Rovnomerné počiatočné rozdelenie, zvyšok dorovná kradnutie
+        for (int w = 0; w < m_workerCount; w++) {
+            std::lock_guard<std::mutex> lock(m_ranges[w].mutex);
+            m_ranges[w].begin = taskCount * w / m_workerCount;
+            m_ranges[w].end = taskCount * (w + 1) / m_workerCount;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_batchMutex);
+            m_batchFn = &fn;
+            m_activeWorkers = m_workerCount - 1;
+            m_batchId++;
+        }
+        m_batchStart.notify_all();
+
+        RunWorker(0, fn);
+
+        // Čakaj aj na workerov ktorí nič nedostali, aby nikto nedržal fn po návrate
+        std::unique_lock<std::mutex> lock(m_batchMutex);
+        m_batchDone.wait(lock, [&] { return m_activeWorkers == 0; });
+        m_batchFn = nullptr;
+    }
+
+    ~WorkStealingPool() {
+        Stop();
+    }
+};
+
+// ===== SUCCESSIVE ELIMINATION (INTEGRÁLNY OBRAZ) =====
+// Pre okno I a šablónu T platí SAD(I,T) >= Σ_kanál |ΣI − ΣT| (trojuholníková
+// nerovnosť). Rozdelením okna na bloky sa hranica zvyšuje a stále je presná:
+// úroveň 0 = celé okno, 1 = 2x2 blokov, 2 = 4x4 blokov.
+constexpr int SEA_MAX_LEVELS = 3;
+constexpr int SEA_BLOCK_COUNT = 1 + 4 + 16;
+
+// Index prvého bloku úrovne v poli súčtov
+inline int SeaLevelOffset(int level) {
+    return ((1 << (2 * level)) - 1) / 3;
+}
+
+// Súčty kanálov BGRA po blokoch všetkých úrovní, 4 hodnoty na blok
+void ComputeBlockSums(const uint8_t* tmpl, uint32_t* sums) {
+    for (int level = 0; level < SEA_MAX_LEVELS; level++) {
+        int n = 1 << level;
+        for (int by = 0; by < n; by++) {
+            for (int bx = 0; bx < n; bx++) {
+                uint32_t* blockSum = &sums[(SeaLevelOffset(level) + by * n + bx) * 4];
+                blockSum[0] = blockSum[1] = blockSum[2] = blockSum[3] = 0;
+
+                for (int y = by * TEMPLATE_SIZE / n; y < (by + 1) * TEMPLATE_SIZE / n; y++) {
+                    for (int x = bx * TEMPLATE_SIZE / n; x < (bx + 1) * TEMPLATE_SIZE / n; x++) {
+                        for (int c = 0; c < 4; c++) {
+                            blockSum[c] += tmpl[(y * TEMPLATE_SIZE + x) * 4 + c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Integrálny obraz so 4 prekladanými kanálmi. Súčty sú uint32, rozdiely rohov
+// pretečú modulo 2^32 a výsledok okna je aj tak presný.
+class IntegralImage {
+private:
+    std::vector<uint32_t> m_data;
+    int m_stride = 0;  // Položiek na riadok (width + 1)
+
+    const uint32_t* At(int x, int y) const {
+        return &m_data[((size_t)y * m_stride + x) * 4];
+    }
+
+public:
+    void Build(const FrameView& view) {
+        m_stride = view.width + 1;
+        m_data.assign((size_t)m_stride * (view.height + 1) * 4, 0);
+
+        const __m128i zero = _mm_setzero_si128();
+        for (int y = 0; y < view.height; y++) {
+            const uint8_t* src = view.Pixel(0, y);
+            const uint32_t* above = At(0, y);
+            uint32_t* dst = &m_data[((size_t)(y + 1) * m_stride) * 4];
+            __m128i rowSum = zero;
+
+            for (int x = 0; x < view.width; x++) {
+                // BGRA bajty -> 4x int32
+                __m128i pixel = _mm_cvtsi32_si128(*(const int*)(src + x * 4));
+                pixel = _mm_unpacklo_epi16(_mm_unpacklo_epi8(pixel, zero), zero);
+                rowSum = _mm_add_epi32(rowSum, pixel);
+
+                __m128i total = _mm_add_epi32(rowSum, _mm_loadu_si128((const __m128i*)(above + (x + 1) * 4)));
+                _mm_storeu_si128((__m128i*)(dst + (x + 1) * 4), total);
+            }
+        }
+    }
+
+    // Položka (x, y) = súčty BGRA obdĺžnika [0, x) × [0, y)
+    const uint32_t* Corner(int x, int y) const { return At(x, y); }
+    int RowStride() const { return m_stride * 4; }  // uint32 na riadok
+};
+
+// |a − b| po kanáloch (len SSE2)
+inline __m128i AbsDiff4(__m128i a, __m128i b) {
+    __m128i diff = _mm_sub_epi32(a, b);
+    __m128i sign = _mm_srai_epi32(diff, 31);
+    return _mm_sub_epi32(_mm_xor_si128(diff, sign), sign);
+}
+
+inline int HorizontalSum4(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+// Súčty BGRA bloku [x0, x1) × [y0, y1) okna s ľavým horným rohom origin
+inline __m128i SeaBlockSum(const uint32_t* origin, int rowStride, int x0, int y0, int x1, int y1) {
+    const uint32_t* top = origin + y0 * rowStride;
+    const uint32_t* bottom = origin + y1 * rowStride;
+    __m128i a = _mm_loadu_si128((const __m128i*)(top + x0 * 4));
+    __m128i b = _mm_loadu_si128((const __m128i*)(top + x1 * 4));
+    __m128i c = _mm_loadu_si128((const __m128i*)(bottom + x0 * 4));
+    __m128i d = _mm_loadu_si128((const __m128i*)(bottom + x1 * 4));
+    return _mm_add_epi32(_mm_sub_epi32(d, _mm_add_epi32(b, c)), a);
+}
+
+// Vyradí šablóny (bity mask), ktorých dolná hranica SAD na pozícii (x, y) je
+// aspoň limit. Súčty okna sa počítajú raz pre všetky šablóny, vyššia úroveň
+// len ak nejaká šablóna prežila nižšiu.
+uint32_t SeaFilter(const IntegralImage& sat, int x, int y,
+    const uint32_t* const* tmplSums, uint32_t mask, int limit, int levels) {
+    const uint32_t* origin = sat.Corner(x, y);
+    const int rowStride = sat.RowStride();
+
+    // Úroveň 0 je najčastejšia a stačí na väčšinu pozícií
+    __m128i window = SeaBlockSum(origin, rowStride, 0, 0, TEMPLATE_SIZE, TEMPLATE_SIZE);
+    for (uint32_t bits = mask; bits; bits &= bits - 1) {
+        int lane = LowestSetBit(bits);
+        if (HorizontalSum4(AbsDiff4(window, _mm_loadu_si128((const __m128i*)tmplSums[lane]))) >= limit) {
+            mask &= ~(1u << lane);
+        }
+    }
+
+    __m128i blockSums[SEA_BLOCK_COUNT];
+    for (int level = 1; level < levels && mask; level++) {
+        int n = 1 << level;
+        int first = SeaLevelOffset(level);
+
+        // Hranice blokov: i * TEMPLATE_SIZE / n, n je mocnina dvoch
+        for (int by = 0; by < n; by++) {
+            int y0 = (by * TEMPLATE_SIZE) >> level, y1 = ((by + 1) * TEMPLATE_SIZE) >> level;
+            for (int bx = 0; bx < n; bx++) {
+                int x0 = (bx * TEMPLATE_SIZE) >> level, x1 = ((bx + 1) * TEMPLATE_SIZE) >> level;
+                blockSums[first + by * n + bx] = SeaBlockSum(origin, rowStride, x0, y0, x1, y1);
+            }
+        }
+
+        for (uint32_t bits = mask; bits; bits &= bits - 1) {
+            int lane = LowestSetBit(bits);
+            const uint32_t* sums = tmplSums[lane];
+
+            __m128i bound = _mm_setzero_si128();
+            for (int i = first; i < first + n * n; i++) {
+                bound = _mm_add_epi32(bound, AbsDiff4(blockSums[i], _mm_loadu_si128((const __m128i*)(sums + i * 4))));
+            }
+            if (HorizontalSum4(bound) >= limit) mask &= ~(1u << lane);
+        }
+    }
+
+    return mask;
+}
+
+// ===== PIPELINE: ZACHYTENIE -> HĽADANIE -> AKCIA =====
+constexpr int FRAME_POOL_SIZE = 3;  // Snímka v zachytávaní, v hľadaní a jedna rezerva
+
+// Ohraničený ring pre jedného producenta a jedného konzumenta. Push/Pop sú
+// bez zámku, mutex slúži len na uspanie konzumenta v WaitPop.
+template<typename T, size_t Capacity>
+class SpscRing {
+private:
+    T m_items[Capacity + 1];
+    alignas(64) std::atomic<size_t> m_head{ 0 };  // Číta konzument
+    alignas(64) std::atomic<size_t> m_tail{ 0 };  // Zapisuje producent
+    std::mutex m_waitMutex;
+    std::condition_variable m_pushed;
+
+public:
+    bool Push(const T& item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % (Capacity + 1);
+        if (next == m_head.load(std::memory_order_acquire)) return false;
+
+        m_items[tail] = item;
+        m_tail.store(next, std::memory_order_release);
+
+        // Prázdny zámok: konzument je buď pred kontrolou, alebo už čaká
+        { std::lock_guard<std::mutex> lock(m_waitMutex); }
+        m_pushed.notify_one();
+        return true;
+    }
+
+    bool TryPop(T& item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return false;
+
+        item = m_items[head];
+        m_head.store((head + 1) % (Capacity + 1), std::memory_order_release);
+        return true;
+    }
+
+    bool WaitPop(T& item, int timeoutMs) {
+        if (TryPop(item)) return true;
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        return m_pushed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&] { return TryPop(item); });
+    }
+};
+
+// Kópia oblasti regiónov v zarovnanom buffri z poolu
+struct PooledFrame {
+    std::vector<CacheLine> storage;  // Rastie len keď sa oblasť zväčší
+    CapturedFrame frame;  // data ukazuje do storage
+};
+
+// Buffery kolujú: free (hľadanie -> zachytenie) a ready (zachytenie -> hľadanie)
+struct FramePool {
+    PooledFrame frames[FRAME_POOL_SIZE];
+    SpscRing<int, FRAME_POOL_SIZE> free;
+    SpscRing<int, FRAME_POOL_SIZE> ready;
+
+    FramePool() {
+        for (int i = 0; i < FRAME_POOL_SIZE; i++) free.Push(i);
+    }
+};
+
+// ===== GLOBÁLNE PREMENNÉ =====
+// Odvodené dáta šablóny ležia v jednom bloku, každá rovina začína na
+// TEMPLATE_PLANE_ALIGN. Blok je buď vlastný buffer šablóny, alebo záznam
+// v zmapovanom balíku šablón, ktorý sa použije na mieste bez kopírovania.
+constexpr size_t TEMPLATE_PLANE_ALIGN = 64;
+
+struct TemplateLayout {
+    bool defaultPath = false;  // TEMPLATE_SIZE bez masky: súčty blokov, poradie pixelov, pyramída
+    bool masked = false;
+    size_t data = 0;  // BGRA, vždy na začiatku bloku
+    size_t luma = 0, bgr = 0, keep = 0;
+    size_t blockSums = 0, pixelOrder = 0, orderedData = 0;
+    size_t pyramid[PYRAMID_MAX_LEVELS - 1] = {};
+    size_t bytes = 0;
+};
+
+TemplateLayout ComputeTemplateLayout(int width, int height, bool masked) {
+    TemplateLayout layout;
+    layout.masked = masked;
+    layout.defaultPath = width == TEMPLATE_SIZE && height == TEMPLATE_SIZE && !masked;
+    const size_t pixels = (size_t)width * height;
+    auto place = [&](size_t& offset, size_t size) {
+        offset = layout.bytes;
+        layout.bytes += (size + TEMPLATE_PLANE_ALIGN - 1) & ~(TEMPLATE_PLANE_ALIGN - 1);
+    };
+
+    place(layout.data, pixels * 4);
+    place(layout.luma, pixels);
+    place(layout.bgr, pixels * 4);
+    if (masked) place(layout.keep, pixels);
+    if (layout.defaultPath) {
+        place(layout.blockSums, SEA_BLOCK_COUNT * 4 * sizeof(uint32_t));
+        place(layout.pixelOrder, TEMPLATE_PIXELS * sizeof(uint16_t));
+        place(layout.orderedData, TEMPLATE_PIXELS * 4);
+        for (int level = 1; level < PYRAMID_MAX_LEVELS; level++) {
+            const size_t size = TEMPLATE_SIZE >> level;
+            place(layout.pyramid[level - 1], size * size * 4);
+        }
+    }
+    return layout;
+}
+
+struct Template {
+    std::string filename;
+    int width = TEMPLATE_SIZE;
+    int height = TEMPLATE_SIZE;
+    bool active = true;  // Či sa má testovať
+    std::shared_ptr<const void> storage;  // Drží blok (vlastný buffer alebo zmapovaný balík)
+    const uint8_t* data = nullptr;  // BGRA data (4 bajty na pixel), začiatok bloku
+    const uint8_t* luma = nullptr;  // Jas pre ChannelMode luma (1 bajt na pixel)
+    const uint8_t* bgr = nullptr;  // BGRA s nulovou alfou pre ChannelMode BGR
+    const uint8_t* keep = nullptr;  // Maska pixelov (1 = porovnať), nullptr = bez masky
+    // Len pre TEMPLATE_SIZE x TEMPLATE_SIZE (dávkový kernel, prefilter, pyramída, poradie pixelov)
+    const uint32_t* blockSums = nullptr;  // Súčty kanálov po blokoch pre SeaFilter
+    const uint16_t* pixelOrder = nullptr;  // Diskriminačné poradie pixelov pre RandomPixelTest
+    const uint8_t* orderedData = nullptr;  // Pixely šablóny v poradí pixelOrder
+    const uint8_t* pyramid[PYRAMID_MAX_LEVELS - 1] = {};  // Zmenšené úrovne 1..PYRAMID_MAX_LEVELS-1
+    MaskedPlane maskedBGR;  // Pri maske: BGR pre ChannelMode BGRA aj BGR
+    MaskedPlane maskedLuma;  // Pri maske: jas pre ChannelMode luma
+
+    // Šablóny iných rozmerov sa hľadajú po jednej cez MatchTemplateSizedFn
+    bool IsDefaultSize() const { return width == TEMPLATE_SIZE && height == TEMPLATE_SIZE; }
+    bool IsMasked() const { return keep != nullptr; }
+    // Dávkový kernel, prefilter, pyramída a poradie pixelov: TEMPLATE_SIZE bez masky
+    bool UsesDefaultPath() const { return IsDefaultSize() && !IsMasked(); }
+    // Porovnávaná rovina v ChannelMode (BGR s vynulovanou alfou)
+    const uint8_t* Plane(int mode) const {
+        return mode == CHANNELS_LUMA ? luma : mode == CHANNELS_BGR ? bgr : data;
+    }
+    size_t BlockBytes() const { return ComputeTemplateLayout(width, height, IsMasked()).bytes; }
+};
+
+// Nasmeruje roviny šablóny do bloku (šírka, výška a maska podľa layout),
+// storage drží blok pri živote. Maskované roviny sú malé a odvodia sa tu.
+void BindTemplate(Template& tmpl, const uint8_t* block, const TemplateLayout& layout,
+    std::shared_ptr<const void> storage) {
+    tmpl.storage = std::move(storage);
+    tmpl.data = block + layout.data;
+    tmpl.luma = block + layout.luma;
+    tmpl.bgr = block + layout.bgr;
+    tmpl.keep = layout.masked ? block + layout.keep : nullptr;
+    tmpl.blockSums = layout.defaultPath ? (const uint32_t*)(block + layout.blockSums) : nullptr;
+    tmpl.pixelOrder = layout.defaultPath ? (const uint16_t*)(block + layout.pixelOrder) : nullptr;
+    tmpl.orderedData = layout.defaultPath ? block + layout.orderedData : nullptr;
+    for (int level = 1; level < PYRAMID_MAX_LEVELS; level++) {
+        tmpl.pyramid[level - 1] = layout.defaultPath ? block + layout.pyramid[level - 1] : nullptr;
+    }
+
+    tmpl.maskedBGR = MaskedPlane();
+    tmpl.maskedLuma = MaskedPlane();
+    if (layout.masked) {
+        BuildMaskedPlane(tmpl.data, 4, tmpl.keep, tmpl.width, tmpl.height, tmpl.maskedBGR);
+        BuildMaskedPlane(tmpl.luma, 1, tmpl.keep, tmpl.width, tmpl.height, tmpl.maskedLuma);
+    }
+}
+
+// Predpočíta odvodené dáta šablóny (po načítaní alebo zachytení) do vlastného
+// bloku. pixels je BGRA width x height, keep maska pixelov (nullptr = bez masky).
+void PrepareTemplate(Template& tmpl, const uint8_t* pixels, const uint8_t* keep = nullptr) {
+    const KernelTable& kernels = GetKernels(KERNEL_AUTO);
+    const TemplateLayout layout = ComputeTemplateLayout(tmpl.width, tmpl.height, keep != nullptr);
+    const size_t pixelCount = (size_t)tmpl.width * tmpl.height;
+    auto storage = std::make_shared<std::vector<CacheLine>>((layout.bytes + sizeof(CacheLine) - 1) / sizeof(CacheLine));
+    uint8_t* block = (uint8_t*)storage->data();
+
+    memcpy(block + layout.data, pixels, pixelCount * 4);
+    kernels.convertLuma(pixels, tmpl.width * 4, tmpl.width, tmpl.height, block + layout.luma, tmpl.width);
+    uint8_t* bgr = block + layout.bgr;
+    memcpy(bgr, pixels, pixelCount * 4);
+    for (size_t i = 3; i < pixelCount * 4; i += 4) bgr[i] = 0;
+    if (keep) memcpy(block + layout.keep, keep, pixelCount);
+
+    if (layout.defaultPath) {
+        ComputeBlockSums(pixels, (uint32_t*)(block + layout.blockSums));
+        ComputePixelOrder(pixels, (uint16_t*)(block + layout.pixelOrder), block + layout.orderedData);
+
+        const uint8_t* src = pixels;
+        for (int level = 1; level < PYRAMID_MAX_LEVELS; level++) {
+            int srcSize = TEMPLATE_SIZE >> (level - 1);
+            uint8_t* dst = block + layout.pyramid[level - 1];
+            kernels.downsampleImage(src, srcSize, srcSize, srcSize * 4, dst);
+            src = dst;
+        }
+    }
+
+    BindTemplate(tmpl, block, layout, std::move(storage));
+}
+
+struct SearchRegion {
+    int x, y, width, height;
+    std::string name;
+    bool active = true;
+};
+
+struct MatchResult {
+    int templateId;
+    int x, y;
+    float score;
+    std::chrono::steady_clock::time_point timestamp;
+    int width = TEMPLATE_SIZE, height = TEMPLATE_SIZE;  // Rozmery šablóny (x, y je stred)
+};
+
+// Všetky zhody jednej snímky. Po zverejnení sa nemenia.
+struct MatchBatch {
+    uint64_t frameSequence = 0;  // CapturedFrame::sequence, 0 = snímka nebola zachytená
+    std::chrono::steady_clock::time_point captureTime;
+    std::vector<MatchResult> matches;
+};
+
+// Pevné sloty batchov s atomickým indexom zverejneného (ako trojitý buffer,
+// ale pre viac čitateľov). Zapisovateľ plní slot ktorý nie je zverejnený a
+// nikto ho nedrží, potom atomicky prepne index. Čitateľ zvýši počítadlo
+// slotu a overí že je stále zverejnený, inak to skúsi znova. Latest() ani
+// Publish() teda neberú zámok a v ustálenom stave sa nealokuje.
+constexpr int MATCH_BATCH_SLOTS = 8;  // Zverejnený + zapisovaný + batche držané čitateľmi
+
+class MatchPublisher;
+
+// Držaný batch, slot sa neprepíše kým existuje (len presun, nie kópia)
+class MatchBatchRef {
+private:
+    const MatchBatch* m_batch = nullptr;
+    std::atomic<int>* m_refs = nullptr;
+
+    friend class MatchPublisher;
+    MatchBatchRef(const MatchBatch* batch, std::atomic<int>* refs) : m_batch(batch), m_refs(refs) {}
+
+public:
+    MatchBatchRef() = default;
+    MatchBatchRef(MatchBatchRef&& other) noexcept : m_batch(other.m_batch), m_refs(other.m_refs) {
+        other.m_batch = nullptr;
+        other.m_refs = nullptr;
+    }
+    MatchBatchRef& operator=(MatchBatchRef&& other) noexcept {
+        if (this != &other) {
+            if (m_refs) m_refs->fetch_sub(1, std::memory_order_release);
+            m_batch = other.m_batch;
+            m_refs = other.m_refs;
+            other.m_batch = nullptr;
+            other.m_refs = nullptr;
+        }
+        return *this;
+    }
+    MatchBatchRef(const MatchBatchRef&) = delete;
+    MatchBatchRef& operator=(const MatchBatchRef&) = delete;
+    ~MatchBatchRef() {
+        if (m_refs) m_refs->fetch_sub(1, std::memory_order_release);
+    }
+
+    const MatchBatch* operator->() const { return m_batch; }
+    const MatchBatch& operator*() const { return *m_batch; }
+    const MatchBatch* get() const { return m_batch; }
+    explicit operator bool() const { return m_batch != nullptr; }
+};
+
+class MatchPublisher {
+private:
+    MatchBatch m_slots[MATCH_BATCH_SLOTS];
+    std::atomic<int> m_refs[MATCH_BATCH_SLOTS] = {};  // Čitatelia držiaci slot
+    std::atomic<int> m_published{ 0 };  // Slot 0 je na začiatku prázdny batch
+
+    // Len na uspanie čakajúcich vo WaitCycle. Zapisovateľ ho berie iba na
+    // zvýšenie počítadla, Latest() ho nepoužíva.
+    std::mutex m_waitMutex;
+    std::condition_variable m_publishedSignal;
+    uint64_t m_cycleCount = 0;  // Zverejnenia aj potvrdenia
+    uint64_t m_currentSequence = 0;  // Posledná snímka ktorej zverejnené zhody zodpovedajú
+    std::chrono::steady_clock::time_point m_confirmedTime;  // Kedy bola zachytená
+    uint64_t m_confirmedBatch = 0;  // frameSequence zverejneného batchu ku ktorému patrí
+
+public:
+    // Prázdny batch na naplnenie (volá len zapisovateľ). Voľný slot je vždy,
+    // kým súčasne nedrží batch viac čitateľov než MATCH_BATCH_SLOTS - 2,
+    // inak sa počká kým niektorý pustí.
+    MatchBatch* BeginBatch() {
+        while (true) {
+            const int published = m_published.load();
+            for (int i = 0; i < MATCH_BATCH_SLOTS; i++) {
+                // Čitateľ ktorý slot získa až po tejto kontrole uvidí iný
+                // zverejnený index a pustí ho
+                if (i == published || m_refs[i].load() != 0) continue;
+                m_slots[i].frameSequence = 0;
+                m_slots[i].matches.clear();
+                return &m_slots[i];
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void Publish(MatchBatch* batch) {
+        m_published.store((int)(batch - m_slots));
+        {
+            std::lock_guard<std::mutex> lock(m_waitMutex);
+            m_currentSequence = batch->frameSequence;
+            m_confirmedTime = batch->captureTime;
+            m_confirmedBatch = batch->frameSequence;
+            m_cycleCount++;
+        }
+        m_publishedSignal.notify_all();
+    }
+
+    // Snímka sequence je rovnaká ako sameAsSequence. Ak zverejnené zhody patria
+    // k sameAsSequence, platia aj pre ňu a cyklus sa ráta ako nový (bez kopírovania).
+    void Confirm(uint64_t sameAsSequence, uint64_t sequence, std::chrono::steady_clock::time_point captureTime) {
+        {
+            std::lock_guard<std::mutex> lock(m_waitMutex);
+            if (m_currentSequence != sameAsSequence) return;
+            m_currentSequence = sequence;
+            m_confirmedTime = captureTime;
+            m_cycleCount++;
+        }
+        m_publishedSignal.notify_all();
+    }
+
+    // Počká na ďalší cyklus (zverejnenie alebo potvrdenie) po poslednom videnom,
+    // seen sa aktualizuje. confirmedTime = zachytenie najnovšej snímky pre ktorú
+    // zhody platia. Prázdny ak do timeoutu žiadny cyklus neprišiel.
+    MatchBatchRef WaitCycle(uint64_t& seen, int timeoutMs, std::chrono::steady_clock::time_point& confirmedTime) {
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        if (!m_publishedSignal.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+            [&] { return m_cycleCount != seen; })) {
+            return MatchBatchRef();
+        }
+        seen = m_cycleCount;
+        MatchBatchRef batch = Latest();
+        // Batch zverejnený medzi uložením indexu a zámkom má vlastný čas
+        confirmedTime = batch->frameSequence == m_confirmedBatch ? m_confirmedTime : batch->captureTime;
+        return batch;
+    }
+
+    // Posledný zverejnený batch (konzistentný, bez zámku, zapisovateľa neblokuje)
+    MatchBatchRef Latest() {
+        while (true) {
+            const int slot = m_published.load();
+            m_refs[slot].fetch_add(1);
+            if (m_published.load() == slot) {
+                return MatchBatchRef(&m_slots[slot], &m_refs[slot]);
+            }
+            m_refs[slot].fetch_sub(1);
+        }
+    }
+};
+
+// Globálne nastavenia
+struct Settings {
+    bool clickOnMatch = false;
+    bool doubleClick = false;
+    int tolerance = 10;  // 0-255, nižšie = presnejšie
+    int earlyPixelCount = 100;  // Počet pixelov pre early rejection
+    bool randomPixelTest = false;  // Diskriminačné poradie pixelov vs po riadkoch
+    int channelMode = CHANNELS_BGRA;  // ChannelMode: porovnávané kanály
+    bool exactMatch = false;  // Len zhody pixel po pixeli cez hash okien (tolerancia sa nepoužije)
+    int denseTolerance = 40;  // Od tejto tolerancie jas ide cez hustú mapu skóre, 0 = nikdy
+    bool useClusterTree = false;  // Šablóny rovnakého rozmeru cez strom zhlukov (bez pyramídy, dávok a dlaždíc)
+    int kernelLevel = KERNEL_AUTO;  // KernelLevel alebo KERNEL_AUTO
+    bool showFPS = true;
+    bool enableLearning = true;
+    bool usePyramidSearch = true;  // Nové - pyramídové vyhľadávanie
+    int pyramidLevels = PYRAMID_MAX_LEVELS;  // Počet úrovní vrátane plného rozlíšenia
+    int pyramidCandidates = 64;  // Najviac kandidátov na úroveň pyramídy pre jednu šablónu
+    bool useBatchedKernel = true;  // Porovnávať bloky šablón naraz
+    int seaLevels = 2;  // Úrovne successive elimination prefiltra, 0 = vypnutý
+    bool useDirtyTiles = true;  // Prehľadávať len dlaždice zmenené od minulej snímky
+    bool useTracking = false;  // Najprv overiť okolie minulých zhôd
+    int trackingRadius = 8;  // Okno overenia +-pixely okolo minulej pozície
+    int trackingRefreshMs = 250;  // Najdlhší čas medzi celými prehľadaniami pri sledovaní
+    bool useSpatialPriors = false;  // Hľadať šablóny najprv v naučenej oblasti
+    int priorMargin = 8;  // Okraj naučenej oblasti okolo posledných hitov (pixely)
+    int priorRefreshMs = 2000;  // Celé prehľadanie a nové oblasti po tomto čase
+    bool multiInstance = false;  // Všetky výskyty šablóny v regióne vs len najlepší
+    int maxInstances = 16;  // Najviac výskytov jednej šablóny v regióne
+    bool useDXGI = true;  // Nové - použiť DXGI capture
+    bool watchTemplates = true;  // Sledovať ./obr/ a načítať zmeny za behu
+    bool useTemplatePack = true;  // Šablóny zo zmapovaného balíka obr.pack, prepisuje sa pri zmene ./obr/
+    std::string frameSourcePath;  // .bmp alebo adresár namiesto obrazovky (prázdne = obrazovka)
+    int currentRegionSet = 0;  // Ktorý set regiónov používame
+    int workerThreads = 0;  // 0 = počet fyzických jadier
+    int bandHeight = 64;  // Výška pásma riadkov pre jednu úlohu
+    int targetFPS = 60;  // Najviac zachytení za sekundu pre GDI a súbor (DXGI tempo určujú snímky), 0 = bez obmedzenia
+    int maxLatencyMs = 100;  // Najdlhšie čakanie na snímku (DXGI) a na voľný buffer
+    int clickMaxAgeMs = 100;  // Najstaršia potvrdená zhoda na ktorú sa klikne
+} g_settings;
+
+// Uzol stromu zhlukov šablón jedného rozmeru bez masky. Reprezentant je
+// člen podstromu, polomer najväčší SAD reprezentanta k členom podstromu
+// v každom ChannelMode. Členovia podstromu ležia v clusterMembers za sebou.
+struct ClusterNode {
+    int rep = -1;  // Index šablóny
+    int radius[CHANNEL_MODE_COUNT] = {};
+    int firstChild = 0, childCount = 0;  // Deti v clusterChildren, 0 = list
+    int first = 0, count = 0;  // Členovia v clusterMembers[first, first + count)
+
+    bool IsLeaf() const { return childCount == 0; }
+};
+
+// Polomery úrovní stromu zhlukov zdola, priemerný rozdiel na kanál BGRA
+// prvku k vodcovi skupiny
+constexpr int CLUSTER_LEVEL_RADII[] = { 2, 4, 8, 16, 32 };
+constexpr int CLUSTER_LEVELS = sizeof(CLUSTER_LEVEL_RADII) / sizeof(CLUSTER_LEVEL_RADII[0]);
+
+// Sada šablón sa nikdy nemení na mieste. Zmena postaví novú verziu a vymení
+// ukazovateľ, čitateľ si raz za cyklus vezme aktuálnu verziu a drží ju kým
+// ju používa. Stará verzia zanikne s posledným čitateľom.
+struct TemplateSet {
+    uint64_t version = 0;
+    std::vector<Template> templates;
+    std::vector<TemplateBlock> blocks;  // Prekladané kópie templates pre dávkový kernel
+    std::vector<int> singles;  // Šablóny mimo blokov (iné rozmery, maska)
+    std::vector<ClusterNode> clusterNodes;  // Uzly stromov zhlukov
+    std::vector<int> clusterChildren;  // Deti uzlov, úsek na uzol
+    std::vector<int> clusterRoots;  // Koreň stromu pre každý rozmer šablón bez masky
+    std::vector<int> clusterMembers;  // Šablóny v poradí podstromov
+    std::vector<int> clusterDistances;  // [pozícia v clusterMembers][ChannelMode] SAD k reprezentantovi listu
+    int minWidth = TEMPLATE_SIZE, minHeight = TEMPLATE_SIZE;  // Rozmery šablón v sade
+    int maxWidth = TEMPLATE_SIZE, maxHeight = TEMPLATE_SIZE;
+};
+
+// Globálne dáta
+std::shared_ptr<const TemplateSet> g_templateSet = std::make_shared<TemplateSet>();  // Len cez Acquire/Publish
+std::mutex g_templateWriteMutex;  // Serializuje zapisovateľov sady, čitatelia ho nepoužívajú
+std::vector<SearchRegion> g_searchRegions;
+MatchPublisher g_matchPublisher;  // Zhody poslednej spracovanej snímky
+FramePool g_framePool;
+std::atomic<bool> g_running(true);
+std::atomic<int> g_fps(0);
+std::atomic<float> g_lastProcessTime(0.0f);
+std::atomic<float> g_lastLatency(0.0f);  // Od zachytenia snímky po zverejnenie zhôd (ms)
+std::atomic<float> g_changedTilePercent(0.0f);  // Podiel zmenených dlaždíc v poslednej snímke
+std::atomic<int> g_priorTemplates(0);  // Šablóny s naučenou oblasťou
+std::atomic<int> g_skippedFrames(0);  // Cykly bez novej snímky za poslednú sekundu
+std::atomic<uint64_t> g_sampledPositions(0);  // Vzorkované pozície pre štatistiku prečítaných pixelov
+std::atomic<uint64_t> g_pixelsRowOrder(0);  // Prečítané pixely na vzorkách v poradí riadkov
+std::atomic<uint64_t> g_pixelsOrdered(0);  // Prečítané pixely na vzorkách v diskriminačnom poradí
+std::atomic<bool> g_searchActive(false);
+std::atomic<int> g_currentMatchIndex(0);
+
+// Aktuálna verzia sady šablón (bez zámku, drží ju kým je potrebná)
+std::shared_ptr<const TemplateSet> AcquireTemplateSet() {
+    return std::atomic_load_explicit(&g_templateSet, std::memory_order_acquire);
+}
+
+FileFrameSource g_fileFrameSource;
+std::mutex g_captureMutex;  // Drží sa počas celej doby kým je snímka zachytená
+PyramidSearch g_pyramidSearch;
+WorkStealingPool g_workerPool;
+
+// Učenie - štatistiky pre každú šablónu
+// Štatistiky učenia majú konštantnú veľkosť a aktualizáciu v O(1) na hit
+constexpr int STATS_RECENT_HITS = 64;  // Kruhový buffer posledných pozícií
+constexpr int STATS_HEAT_COLS = 32;  // Mriežka tepla cez obrazovku, bunka 60x60 pri 1920x1080
+constexpr int STATS_HEAT_ROWS = 18;
+constexpr double STATS_HEAT_HALF_LIFE = 600.0;  // Sekundy, za ktoré teplo bunky klesne na polovicu
+
+struct TemplateStats {
+    int hitCount = 0;
+    POINT avgPosition = { 0, 0 };
+    float probability = 0.0f;
+    int regionPreference[10] = { 0 };  // Ktoré regióny preferuje
+    std::chrono::steady_clock::time_point lastHitTime;
+
+    // Priebežný priemer a rozptyl pozície (Welford), m2 = súčet štvorcov odchýlok
+    double meanX = 0.0, meanY = 0.0;
+    double m2X = 0.0, m2Y = 0.0;
+
+    // Posledné pozície, recentNext ukazuje na najstaršiu keď je buffer plný
+    POINT recent[STATS_RECENT_HITS] = {};
+    int recentCount = 0;
+    int recentNext = 0;
+
+    // Teplo bunky je heat * heatScale. Starnutie všetkých buniek naraz len
+    // zmenší heatScale, nový hit pridá 1 / heatScale.
+    float heat[STATS_HEAT_COLS * STATS_HEAT_ROWS] = {};
+    double heatScale = 1.0;
+
+    static int HeatCell(POINT pos) {
+        int col = min(max((int)(pos.x * STATS_HEAT_COLS / SCREEN_WIDTH), 0), STATS_HEAT_COLS - 1);
+        int row = min(max((int)(pos.y * STATS_HEAT_ROWS / SCREEN_HEIGHT), 0), STATS_HEAT_ROWS - 1);
+        return row * STATS_HEAT_COLS + col;
+    }
+
+    float Heat(int cell) const {
+        return (float)(heat[cell] * heatScale);
+    }
+
+    // Rozptyl pozície (0 pri menej ako dvoch hitoch)
+    double VarianceX() const { return hitCount > 1 ? m2X / (hitCount - 1) : 0.0; }
+    double VarianceY() const { return hitCount > 1 ? m2Y / (hitCount - 1) : 0.0; }
+
+    void AddHit(POINT pos, std::chrono::steady_clock::time_point now) {
+        if (hitCount > 0 && now > lastHitTime) {
+            double elapsed = std::chrono::duration<double>(now - lastHitTime).count();
+            heatScale *= exp2(-elapsed / STATS_HEAT_HALF_LIFE);
+            if (heatScale < 1e-20) NormalizeHeat();
+        }
+        hitCount++;
+        lastHitTime = now;
+
+        double dx = pos.x - meanX, dy = pos.y - meanY;
+        meanX += dx / hitCount;
+        meanY += dy / hitCount;
+        m2X += dx * (pos.x - meanX);
+        m2Y += dy * (pos.y - meanY);
+        avgPosition = { (LONG)meanX, (LONG)meanY };
+
+        recent[recentNext] = pos;
+        recentNext = (recentNext + 1) % STATS_RECENT_HITS;
+        recentCount = min(recentCount + 1, STATS_RECENT_HITS);
+
+        heat[HeatCell(pos)] += (float)(1.0 / heatScale);
+    }
+
+    // Prepočíta bunky na skutočné teplo, heatScale = 1
+    void NormalizeHeat() {
+        for (auto& cell : heat) cell = (float)(cell * heatScale);
+        heatScale = 1.0;
+    }
+
+    // i-ta posledná pozícia od najstaršej (i < recentCount)
+    POINT Recent(int i) const {
+        int oldest = recentCount < STATS_RECENT_HITS ? 0 : recentNext;
+        return recent[(oldest + i) % STATS_RECENT_HITS];
+    }
+};
+std::vector<TemplateStats> g_templateStats;  // Indexované podľa sady, ktorú naposledy spracoval MatchFrame
+std::mutex g_statsMutex;  // Chráni preradenie g_templateStats pri výmene sady
+
+// ===== POMOCNÉ FUNKCIE =====
+
+// Načíta BMP súbor (32-bit BGRA). Súbor nemusí byť dôveryhodný (aj snímky
+// prehrávania), hlavička sa preto overí celá skôr než sa alokuje buffer:
+// podpis, veľkosť info hlavičky, kompresia, rozmery do maxDim a dáta v súbore.
+bool LoadBMP32(const std::string& filename, std::vector<uint8_t>& data, int& width, int& height, int maxDim) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+
+    // BMP header
+    char header[54];
+    if (!file.read(header, 54)) return false;
+    file.seekg(0, std::ios::end);
+    const int64_t fileSize = (int64_t)file.tellg();
+
+    const uint32_t dataOffset = *(uint32_t*)&header[10];
+    const uint32_t infoSize = *(uint32_t*)&header[14];
+    const int64_t rawWidth = *(int32_t*)&header[18];
+    const int64_t rawHeight = *(int32_t*)&header[22];
+    int bpp = *(short*)&header[28];
+    const uint32_t compression = *(uint32_t*)&header[30];
+
+    if (header[0] != 'B' || header[1] != 'M' || infoSize < 40 || dataOffset < 14 + (uint64_t)infoSize) {
+        std::cerr << "Neplatná hlavička BMP " << filename << "!" << std::endl;
+        return false;
+    }
+    if (bpp != 32) {
+        std::cerr << "Podporované sú len 32-bit BMP súbory!" << std::endl;
+        return false;
+    }
+
+    // BI_RGB, alebo BI_BITFIELDS s maskami v poradí BGRA (za 40 B hlavičkou)
+    if (compression == 3) {
+        uint32_t masks[3];
+        if (dataOffset < 54 + sizeof(masks) || !file.seekg(54) || !file.read((char*)masks, sizeof(masks)) ||
+            masks[0] != 0x00FF0000 || masks[1] != 0x0000FF00 || masks[2] != 0x000000FF) {
+            std::cerr << "Nepodporované masky BMP " << filename << "!" << std::endl;
+            return false;
+        }
+    }
+    else if (compression != 0) {
+        std::cerr << "Komprimované BMP nie sú podporované (" << filename << ")!" << std::endl;
+        return false;
+    }
+
+    // Záporná výška = riadky uložené zhora nadol (v 64 bitoch, -INT_MIN pretečie)
+    const bool topDown = rawHeight < 0;
+    const int64_t absHeight = topDown ? -rawHeight : rawHeight;
+    if (rawWidth <= 0 || absHeight <= 0 || rawWidth > maxDim || absHeight > maxDim ||
+        (int64_t)dataOffset + rawWidth * 4 * absHeight > fileSize) {
+        std::cerr << "Nepodporované rozmery alebo neúplné dáta BMP " << filename << "!" << std::endl;
+        return false;
+    }
+    width = (int)rawWidth;
+    height = (int)absHeight;
+
+    // Bottom-up BMP sa číta rovno na pretočené miesto
+    const int rowBytes = width * 4;
+    data.resize((size_t)rowBytes * height);
+    file.seekg(dataOffset, std::ios::beg);
+    for (int row = 0; row < height; row++) {
+        int y = topDown ? row : height - 1 - row;
+        file.read((char*)data.data() + (size_t)y * rowBytes, rowBytes);
+    }
+
+    return (bool)file;
+}
+
+// Uloží 32-bit BMP
+bool SaveBMP32(const std::string& filename, const uint8_t* data, int width, int height) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+
+    // BMP header
+    int fileSize = 54 + width * height * 4;
+    char header[54] = { 0 };
+
+    // Signature
+    header[0] = 'B'; header[1] = 'M';
+    // File size
+    *(int*)&header[2] = fileSize;
+    // Data offset
+    *(int*)&header[10] = 54;
+    // Info header size
+    *(int*)&header[14] = 40;
+    // Width, height
+    *(int*)&header[18] = width;
+    *(int*)&header[22] = height;
+    // Planes
+    *(short*)&header[26] = 1;
+    // BPP
+    *(short*)&header[28] = 32;
+
+    file.write(header, 54);
+
+    // Zapíš pixel data (bottom-up)
+    for (int y = height - 1; y >= 0; y--) {
+        file.write((char*)&data[y * width * 4], width * 4);
+    }
+
+    return true;
+}
+
+void LoadConfig(const std::string& filename = "config.ini") {
+    std::ifstream file(filename);
+    if (!file) return;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.find("=") != std::string::npos) {
+            std::string key = line.substr(0, line.find("="));
+            std::string value = line.substr(line.find("=") + 1);
+
+            if (key == "ClickOnMatch") g_settings.clickOnMatch = std::stoi(value);
+            else if (key == "DoubleClick") g_settings.doubleClick = std::stoi(value);
+            else if (key == "Tolerance") g_settings.tolerance = std::stoi(value);
+            else if (key == "EarlyPixelCount") g_settings.earlyPixelCount = std::stoi(value);
+            else if (key == "RandomPixelTest") g_settings.randomPixelTest = std::stoi(value);
+            else if (key == "ExactMatch") g_settings.exactMatch = std::stoi(value);
+            else if (key == "DenseTolerance") g_settings.denseTolerance = std::stoi(value);
+            else if (key == "ClusterTree") g_settings.useClusterTree = std::stoi(value);
+            else if (key == "Channels") {
+                for (int mode = 0; mode < CHANNEL_MODE_COUNT; mode++) {
+                    if (value == CHANNEL_MODE_NAMES[mode]) g_settings.channelMode = mode;
+                }
+            }
+            else if (key == "UseAVX2") g_settings.kernelLevel = std::stoi(value) ? KERNEL_AUTO : KERNEL_SSE2;  // Starší config.ini
+            else if (key == "Kernel") g_settings.kernelLevel = ParseKernelLevel(value);
+            else if (key == "ShowFPS") g_settings.showFPS = std::stoi(value);
+            else if (key == "EnableLearning") g_settings.enableLearning = std::stoi(value);
+            else if (key == "UsePyramidSearch") g_settings.usePyramidSearch = std::stoi(value);
+            else if (key == "PyramidLevels") g_settings.pyramidLevels = min(max(std::stoi(value), 2), PYRAMID_MAX_LEVELS);
+            else if (key == "PyramidCandidates") g_settings.pyramidCandidates = max(std::stoi(value), 1);
+            else if (key == "WatchTemplates") g_settings.watchTemplates = std::stoi(value);
+            else if (key == "TemplatePack") g_settings.useTemplatePack = std::stoi(value);
+            else if (key == "UseBatchedKernel") g_settings.useBatchedKernel = std::stoi(value);
+            else if (key == "DirtyTiles") g_settings.useDirtyTiles = std::stoi(value);
+            else if (key == "Tracking") g_settings.useTracking = std::stoi(value);
+            else if (key == "TrackingRadius") g_settings.trackingRadius = max(std::stoi(value), 0);
+            else if (key == "TrackingRefresh") g_settings.trackingRefreshMs = max(std::stoi(value), 0);
+            else if (key == "SpatialPriors") g_settings.useSpatialPriors = std::stoi(value);
+            else if (key == "PriorMargin") g_settings.priorMargin = max(std::stoi(value), 0);
+            else if (key == "PriorRefresh") g_settings.priorRefreshMs = max(std::stoi(value), 0);
+            else if (key == "MultiInstance") g_settings.multiInstance = std::stoi(value);
+            else if (key == "MaxInstances") g_settings.maxInstances = max(std::stoi(value), 1);
+            else if (key == "SEALevels") g_settings.seaLevels = min(max(std::stoi(value), 0), SEA_MAX_LEVELS);
+            else if (key == "UseDXGI") g_settings.useDXGI = std::stoi(value);
+            else if (key == "FrameSource") g_settings.frameSourcePath = value;
+            else if (key == "WorkerThreads") g_settings.workerThreads = std::stoi(value);
+            else if (key == "TargetFPS") g_settings.targetFPS = max(std::stoi(value), 0);
+            else if (key == "MaxLatency") g_settings.maxLatencyMs = max(std::stoi(value), 1);
+            else if (key == "MaxClickAge") g_settings.clickMaxAgeMs = max(std::stoi(value), 1);
+            else if (key == "BandHeight") g_settings.bandHeight = max(1, std::stoi(value));
+        }
+    }
+}
+
+void SaveConfig(const std::string& filename = "config.ini") {
+    std::ofstream file(filename);
+    if (!file) return;
+
+    file << "[Settings]\n";
+    file << "ClickOnMatch=" << g_settings.clickOnMatch << "\n";
+    file << "DoubleClick=" << g_settings.doubleClick << "\n";
+    file << "Tolerance=" << g_settings.tolerance << "\n";
+    file << "EarlyPixelCount=" << g_settings.earlyPixelCount << "\n";
+    file << "RandomPixelTest=" << g_settings.randomPixelTest << "\n";
+    file << "Channels=" << CHANNEL_MODE_NAMES[g_settings.channelMode] << "\n";
+    file << "DenseTolerance=" << g_settings.denseTolerance << "\n";
+    file << "ExactMatch=" << g_settings.exactMatch << "\n";
+    file << "ClusterTree=" << g_settings.useClusterTree << "\n";
+    file << "Kernel=" << (g_settings.kernelLevel == KERNEL_AUTO ? "auto" : g_kernelTables[g_settings.kernelLevel].configName) << "\n";
+    file << "ShowFPS=" << g_settings.showFPS << "\n";
+    file << "EnableLearning=" << g_settings.enableLearning << "\n";
+    file << "UsePyramidSearch=" << g_settings.usePyramidSearch << "\n";
+    file << "PyramidLevels=" << g_settings.pyramidLevels << "\n";
+    file << "PyramidCandidates=" << g_settings.pyramidCandidates << "\n";
+    file << "UseBatchedKernel=" << g_settings.useBatchedKernel << "\n";
+    file << "WatchTemplates=" << g_settings.watchTemplates << "\n";
+    file << "TemplatePack=" << g_settings.useTemplatePack << "\n";
+    file << "SEALevels=" << g_settings.seaLevels << "\n";
+    file << "DirtyTiles=" << g_settings.useDirtyTiles << "\n";
+    file << "Tracking=" << g_settings.useTracking << "\n";
+    file << "TrackingRadius=" << g_settings.trackingRadius << "\n";
+    file << "TrackingRefresh=" << g_settings.trackingRefreshMs << "\n";
+    file << "SpatialPriors=" << g_settings.useSpatialPriors << "\n";
+    file << "PriorMargin=" << g_settings.priorMargin << "\n";
+    file << "PriorRefresh=" << g_settings.priorRefreshMs << "\n";
+    file << "MultiInstance=" << g_settings.multiInstance << "\n";
+    file << "MaxInstances=" << g_settings.maxInstances << "\n";
+    file << "UseDXGI=" << g_settings.useDXGI << "\n";
+    file << "FrameSource=" << g_settings.frameSourcePath << "\n";
+    file << "WorkerThreads=" << g_settings.workerThreads << "\n";
+    file << "BandHeight=" << g_settings.bandHeight << "\n";
+    file << "TargetFPS=" << g_settings.targetFPS << "\n";
+    file << "MaxLatency=" << g_settings.maxLatencyMs << "\n";
+    file << "MaxClickAge=" << g_settings.clickMaxAgeMs << "\n";
+}
+
+// Hlavička learning_stats.dat, starší súbor bez nej začína priamo počtom šablón
+constexpr uint32_t LEARNING_STATS_MAGIC = 0x3253544C;  // "LTS2"
+
+// Uloženie štatistík učenia
+void SaveLearningStats(const std::string& filename = "learning_stats.dat") {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return;
+
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+
+    // Hlavička a rozmery štruktúr, súbor s inými rozmermi sa nenačíta
+    uint32_t header[4] = { LEARNING_STATS_MAGIC, STATS_RECENT_HITS, STATS_HEAT_COLS, STATS_HEAT_ROWS };
+    file.write((char*)header, sizeof(header));
+
+    // Ulož počet šablón
+    uint64_t count = g_templateStats.size();
+    file.write((char*)&count, sizeof(count));
+
+    // Pre každú šablónu
+    for (size_t i = 0; i < count; i++) {
+        const auto& stats = g_templateStats[i];
+
+        // Ulož základné dáta a priebežný priemer/rozptyl
+        file.write((char*)&stats.hitCount, sizeof(stats.hitCount));
+        file.write((char*)&stats.probability, sizeof(stats.probability));
+        file.write((char*)&stats.meanX, sizeof(stats.meanX));
+        file.write((char*)&stats.meanY, sizeof(stats.meanY));
+        file.write((char*)&stats.m2X, sizeof(stats.m2X));
+        file.write((char*)&stats.m2Y, sizeof(stats.m2Y));
+
+        // Ulož čas posledného hitu (ako počet sekúnd od epochy)
+        auto timeSinceEpoch = stats.lastHitTime.time_since_epoch();
+        long long seconds = std::chrono::duration_cast<std::chrono::seconds>(timeSinceEpoch).count();
+        file.write((char*)&seconds, sizeof(seconds));
+
+        // Posledné pozície od najstaršej
+        file.write((char*)&stats.recentCount, sizeof(stats.recentCount));
+        for (int j = 0; j < stats.recentCount; j++) {
+            POINT p = stats.Recent(j);
+            file.write((char*)&p, sizeof(POINT));
+        }
+
+        // Teplo buniek už so započítaným starnutím
+        for (int cell = 0; cell < STATS_HEAT_COLS * STATS_HEAT_ROWS; cell++) {
+            float heat = stats.Heat(cell);
+            file.write((char*)&heat, sizeof(heat));
+        }
+    }
+
+    std::cout << "Štatistiky učenia uložené do: " << filename << std::endl;
+}
+
+// Starý formát: hitCount, avgPosition, probability, história (max 100), čas.
+// História sa prehrá cez AddHit, počet hitov a priemer ostanú zo súboru.
+bool LoadLegacyTemplateStats(std::ifstream& file, TemplateStats& stats) {
+    int hitCount;
+    POINT avgPosition;
+    float probability;
+    size_t histSize;
+    file.read((char*)&hitCount, sizeof(hitCount));
+    file.read((char*)&avgPosition, sizeof(avgPosition));
+    file.read((char*)&probability, sizeof(probability));
+    file.read((char*)&histSize, sizeof(histSize));
+    if (!file || histSize > 100) return false;
+
+    stats = TemplateStats();
+    auto now = std::chrono::steady_clock::now();
+    for (size_t j = 0; j < histSize; j++) {
+        POINT p;
+        file.read((char*)&p, sizeof(POINT));
+        stats.AddHit(p, now);
+    }
+
+    double varianceX = stats.VarianceX(), varianceY = stats.VarianceY();
+    stats.hitCount = hitCount;
+    stats.avgPosition = avgPosition;
+    stats.probability = probability;
+    stats.meanX = avgPosition.x;
+    stats.meanY = avgPosition.y;
+    stats.m2X = varianceX * max(hitCount - 1, 0);
+    stats.m2Y = varianceY * max(hitCount - 1, 0);
+
+    long long seconds;
+    file.read((char*)&seconds, sizeof(seconds));
+    stats.lastHitTime = std::chrono::steady_clock::time_point(std::chrono::seconds(seconds));
+    return (bool)file;
+}
+
+bool LoadTemplateStats(std::ifstream& file, TemplateStats& stats) {
+    stats = TemplateStats();
+    file.read((char*)&stats.hitCount, sizeof(stats.hitCount));
+    file.read((char*)&stats.probability, sizeof(stats.probability));
+    file.read((char*)&stats.meanX, sizeof(stats.meanX));
+    file.read((char*)&stats.meanY, sizeof(stats.meanY));
+    file.read((char*)&stats.m2X, sizeof(stats.m2X));
+    file.read((char*)&stats.m2Y, sizeof(stats.m2Y));
+    stats.avgPosition = { (LONG)stats.meanX, (LONG)stats.meanY };
+
+    long long seconds;
+    file.read((char*)&seconds, sizeof(seconds));
+    stats.lastHitTime = std::chrono::steady_clock::time_point(std::chrono::seconds(seconds));
+
+    int recentCount;
+    file.read((char*)&recentCount, sizeof(recentCount));
+    if (!file || recentCount < 0 || recentCount > STATS_RECENT_HITS) return false;
+    for (int j = 0; j < recentCount; j++) {
+        file.read((char*)&stats.recent[j], sizeof(POINT));
+    }
+    stats.recentCount = recentCount;
+    stats.recentNext = recentCount % STATS_RECENT_HITS;
+
+    file.read((char*)stats.heat, sizeof(stats.heat));
+    return (bool)file;
+}
+
+// Načítanie štatistík učenia
+void LoadLearningStats(const std::string& filename = "learning_stats.dat") {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cout << "Súbor so štatistikami neexistuje, začínam s prázdnymi." << std::endl;
+        return;
+    }
+
+    uint32_t header[4] = {};
+    file.read((char*)header, sizeof(header));
+    const bool legacy = header[0] != LEARNING_STATS_MAGIC;
+    if (!legacy && (header[1] != STATS_RECENT_HITS || header[2] != STATS_HEAT_COLS || header[3] != STATS_HEAT_ROWS)) {
+        std::cout << "Štatistiky učenia majú iné rozmery, začínam s prázdnymi." << std::endl;
+        return;
+    }
+
+    uint64_t count = 0;
+    if (legacy) {
+        file.clear();
+        file.seekg(0);
+        size_t legacyCount;
+        file.read((char*)&legacyCount, sizeof(legacyCount));
+        count = legacyCount;
+    }
+    else {
+        file.read((char*)&count, sizeof(count));
+    }
+    if (!file) return;
+
+    // Poškodený súbor nesmie alokovať nezmyselný počet
+    count = min(count, (uint64_t)MAX_TEMPLATES * 100);
+
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+
+    // Uisti sa že máme správny počet štatistík
+    g_templateStats.resize(max((size_t)count, AcquireTemplateSet()->templates.size()));
+
+    size_t loaded = 0;
+    for (; loaded < count; loaded++) {
+        bool ok = legacy ? LoadLegacyTemplateStats(file, g_templateStats[loaded]) : LoadTemplateStats(file, g_templateStats[loaded]);
+        if (!ok) {
+            g_templateStats[loaded] = TemplateStats();
+            break;
+        }
+    }
+
+    std::cout << "Načítané štatistiky pre " << loaded << " šablón" << (legacy ? " (starý formát)." : ".") << std::endl;
+}
+
+// Poskladá šablóny TEMPLATE_SIZE do prekladaných blokov pre dávkový kernel,
+// ostatné rozmery dá do singles a zistí rozsah rozmerov sady
+void BuildTemplateBlocks(TemplateSet& set) {
+    set.blocks.clear();
+    set.singles.clear();
+
+    std::vector<int> ids;
+    set.minWidth = set.minHeight = set.templates.empty() ? TEMPLATE_SIZE : MAX_TEMPLATE_DIM;
+    set.maxWidth = set.maxHeight = set.templates.empty() ? TEMPLATE_SIZE : 0;
+    for (int t = 0; t < (int)set.templates.size(); t++) {
+        const Template& tmpl = set.templates[t];
+        if (tmpl.UsesDefaultPath()) ids.push_back(t);
+        else set.singles.push_back(t);
+        set.minWidth = min(set.minWidth, tmpl.width);
+        set.minHeight = min(set.minHeight, tmpl.height);
+        set.maxWidth = max(set.maxWidth, tmpl.width);
+        set.maxHeight = max(set.maxHeight, tmpl.height);
+    }
+
+    for (int first = 0; first < (int)ids.size(); first += BATCH_LANES) {
+        TemplateBlock block;
+        block.storage.resize(TEMPLATE_SIZE * BLOCK_ROW_BYTES / sizeof(CacheLine));
+        block.laneCount = min(BATCH_LANES, (int)ids.size() - first);
+
+        for (int lane = 0; lane < BATCH_LANES; lane++) {
+            // Prázdne dráhy dostanú kópiu prvej šablóny, výsledok sa ignoruje
+            bool used = lane < block.laneCount;
+            block.templateIds[lane] = used ? ids[first + lane] : -1;
+            const auto& tmpl = set.templates[ids[used ? first + lane : first]];
+
+            for (int y = 0; y < TEMPLATE_SIZE; y++) {
+                for (int x = 0; x < TEMPLATE_SIZE; x += 4) {
+                    memcpy(block.Data() + TemplateBlock::Offset(lane, y, x),
+                        &tmpl.data[(y * TEMPLATE_SIZE + x) * 4], 16);
+                }
+            }
+        }
+
+        set.blocks.push_back(std::move(block));
+    }
+}
+
+// SAD dvoch šablón rovnakého rozmeru v ChannelMode, nad bound len čiastočný
+int TemplateDistance(const Template& a, const Template& b, int mode, const KernelTable& kernels, int bound = INT_MAX) {
+    const int rowBytes = a.width * CHANNEL_MODE_PIXEL_BYTES[mode];
+    return kernels.boundedSad(a.Plane(mode), rowBytes, b.Plane(mode), rowBytes, a.height, 0xFFFFFFFF, bound);
+}
+
+// Uzol počas stavby stromu, list má šablóny, vnútorný uzol deti
+struct ClusterDraft {
+    int rep;
+    std::vector<int> members;
+    std::vector<int> children;  // Indexy do konceptov
+};
+
+// Zapíše koncept s podstromom do sady, členovia podstromu ostanú za sebou
+int EmitClusterNode(TemplateSet& set, const std::vector<ClusterDraft>& drafts, int draft, const KernelTable& kernels) {
+    const ClusterDraft& source = drafts[draft];
+    const int index = (int)set.clusterNodes.size();
+    set.clusterNodes.emplace_back();
+    const int first = (int)set.clusterMembers.size();
+
+    std::vector<int> children;
+    for (int child : source.children) children.push_back(EmitClusterNode(set, drafts, child, kernels));
+    set.clusterMembers.insert(set.clusterMembers.end(), source.members.begin(), source.members.end());
+    set.clusterDistances.resize(set.clusterMembers.size() * CHANNEL_MODE_COUNT);
+
+    ClusterNode& node = set.clusterNodes[index];
+    node.rep = source.rep;
+    node.first = first;
+    node.count = (int)set.clusterMembers.size() - first;
+    node.firstChild = (int)set.clusterChildren.size();
+    node.childCount = (int)children.size();
+    set.clusterChildren.insert(set.clusterChildren.end(), children.begin(), children.end());
+
+    for (int k = first; k < first + node.count; k++) {
+        for (int mode = 0; mode < CHANNEL_MODE_COUNT; mode++) {
+            const int d = TemplateDistance(set.templates[node.rep], set.templates[set.clusterMembers[k]], mode, kernels);
+            node.radius[mode] = max(node.radius[mode], d);
+            if (node.IsLeaf()) set.clusterDistances[(size_t)k * CHANNEL_MODE_COUNT + mode] = d;
+        }
+    }
+    return index;
+}
+
+// Strom zhlukov šablón jedného rozmeru, stavia sa zdola po úrovniach
+// CLUSTER_LEVEL_RADII. Prvok sa pridá k najbližšiemu vodcovi v polomere
+// úrovne, inak je sám vodcom. Skupina aspoň dvoch prvkov je nový uzol
+// s reprezentantom vodcu, osamotený prvok postúpi o úroveň vyššie. Na
+// najnižšej úrovni sú skupiny šablón listy (aj osamotená šablóna).
+// Delenie zhora podľa dvoch vzdialených šablón by rozdelilo rodinu takmer
+// rovnakých šablón, keď sú všetky rodiny od seba skoro rovnako ďaleko.
+int BuildClusterTree(TemplateSet& set, const std::vector<int>& ids, const KernelTable& kernels) {
+    const Template& shape = set.templates[ids[0]];
+    const int channels = shape.width * shape.height * CHANNEL_MODE_COMPARED[CHANNELS_BGRA];
+
+    std::vector<ClusterDraft> drafts;
+    std::vector<int> items;  // Koncepty aktuálnej úrovne, na najnižšej šablóny
+    for (int level = 0; level < CLUSTER_LEVELS; level++) {
+        const bool leaves = level == 0;
+        const std::vector<int>& source = leaves ? ids : items;
+        auto rep = [&](int item) { return leaves ? item : drafts[item].rep; };
+        const int limit = CLUSTER_LEVEL_RADII[level] * channels;
+
+        std::vector<std::vector<int>> groups;
+        for (int item : source) {
+            int best = -1, bestDistance = limit + 1;
+            for (int g = 0; g < (int)groups.size(); g++) {
+                int d = TemplateDistance(set.templates[rep(groups[g][0])], set.templates[rep(item)],
+                    CHANNELS_BGRA, kernels, bestDistance - 1);
+                if (d < bestDistance) {
+                    best = g;
+                    bestDistance = d;
+                }
+            }
+            if (best < 0) groups.push_back({ item });
+            else groups[best].push_back(item);
+        }
+
+        std::vector<int> next;
+        for (const auto& group : groups) {
+            if (!leaves && group.size() == 1) {
+                next.push_back(group[0]);
+                continue;
+            }
+            drafts.push_back({ rep(group[0]), {}, {} });
+            (leaves ? drafts.back().members : drafts.back().children) = group;
+            next.push_back((int)drafts.size() - 1);
+        }
+        items.swap(next);
+    }
+
+    // Zvyšné vrcholy pod jeden koreň (rôznorodé, test sa preskočí podľa polomeru)
+    int root = items[0];
+    if (items.size() > 1) {
+        drafts.push_back({ drafts[items[0]].rep, {}, items });
+        root = (int)drafts.size() - 1;
+    }
+    return EmitClusterNode(set, drafts, root, kernels);
+}
+
+// Strom zhlukov pre každý rozmer šablón bez masky (v poradí prvej šablóny rozmeru)
+void BuildClusterTrees(TemplateSet& set) {
+    const KernelTable& kernels = GetKernels(KERNEL_AUTO);
+    set.clusterNodes.clear();
+    set.clusterChildren.clear();
+    set.clusterRoots.clear();
+    set.clusterMembers.clear();
+    set.clusterDistances.clear();
+
+    std::vector<std::vector<int>> groups;
+    for (int t = 0; t < (int)set.templates.size(); t++) {
+        const Template& tmpl = set.templates[t];
+        if (tmpl.IsMasked()) continue;
+        size_t g = 0;
+        while (g < groups.size() && (set.templates[groups[g][0]].width != tmpl.width ||
+            set.templates[groups[g][0]].height != tmpl.height)) g++;
+        if (g == groups.size()) groups.emplace_back();
+        groups[g].push_back(t);
+    }
+
+    for (const auto& group : groups) set.clusterRoots.push_back(BuildClusterTree(set, group, kernels));
+}
+
+// Zverejní novú verziu sady. Volajúci drží g_templateWriteMutex.
+void PublishTemplateSet(std::shared_ptr<TemplateSet> set) {
+    set->version = AcquireTemplateSet()->version + 1;
+    BuildTemplateBlocks(*set);
+    BuildClusterTrees(*set);
+    std::atomic_store_explicit(&g_templateSet, std::shared_ptr<const TemplateSet>(std::move(set)),
+        std::memory_order_release);
+}
+
+// Maska šablóny: biele pixely <meno>.mask.bmp sa porovnávajú, čierne nie.
+// Bez súboru rozhoduje alfa BMP (>= 128 porovnať), ak nie je všade rovnaká -
+// BMP z GDI majú alfu 0 všade, z DXGI 255 všade. Prázdne keep = bez masky.
+// false = šablóna bez porovnaných pixelov alebo maska iného rozmeru.
+bool LoadTemplateMask(const std::filesystem::path& file, const std::vector<uint8_t>& pixels,
+    int width, int height, std::vector<uint8_t>& keep) {
+    const size_t count = (size_t)width * height;
+    keep.assign(count, 1);
+
+    std::filesystem::path maskFile = file;
+    maskFile.replace_extension(".mask.bmp");
+    std::error_code ec;
+    if (std::filesystem::exists(maskFile, ec)) {
+        std::vector<uint8_t> mask;
+        int maskWidth, maskHeight;
+        if (!LoadBMP32(maskFile.string(), mask, maskWidth, maskHeight, MAX_TEMPLATE_DIM) || maskWidth != width || maskHeight != height) {
+            std::cerr << "Maska " << maskFile.filename().string() << " nesedí so šablónou!" << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            keep[i] = mask[i * 4] + mask[i * 4 + 1] + mask[i * 4 + 2] >= 3 * 128;
+        }
+    } else {
+        bool uniformAlpha = true;
+        for (size_t i = 1; i < count && uniformAlpha; i++) uniformAlpha = pixels[i * 4 + 3] == pixels[3];
+        if (!uniformAlpha) {
+            for (size_t i = 0; i < count; i++) keep[i] = pixels[i * 4 + 3] >= 128;
+        }
+    }
+
+    size_t kept = std::count(keep.begin(), keep.end(), (uint8_t)1);
+    if (kept == 0) {
+        std::cerr << "Šablóna " << file.filename().string() << " má celú masku prázdnu!" << std::endl;
+        return false;
+    }
+    if (kept == count) keep.clear();
+    return true;
+}
+
+// ===== BALÍK ŠABLÓN =====
+// Pri tisícoch šablón štart zdržuje čítanie BMP a výpočet odvodených dát.
+// Balík <adresár>.pack nesie hotové bloky šablón (TemplateLayout) zarovnané
+// na TEMPLATE_PLANE_ALIGN, index a pre každý zdroj veľkosť, čas zápisu
+// a hash obsahu. Pri načítaní sa zmapuje a šablóny s nezmeneným zdrojom
+// ukazujú priamo doň. Zdroj s iným časom sa načíta a prepočíta len ak sa
+// zmenil aj jeho obsah. Balík sa prepíše len keď sa sada zmenila.
+constexpr uint32_t TEMPLATE_PACK_MAGIC = 0x4B504D44;  // "DMPK"
+constexpr uint32_t TEMPLATE_PACK_VERSION = 1;  // Zvýšiť pri zmene TemplateLayout alebo výpočtu odvodených dát
+constexpr uint32_t PACK_MASKED = 1;
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t templateSize, pyramidLevels;  // Rozloženie blokov od nich závisí
+    uint32_t count;
+    uint32_t namesBytes;
+    uint64_t indexOffset;  // PackEntry[count]
+    uint64_t namesOffset;  // Mená súborov za sebou, bez ukončovacej nuly
+};
+
+struct PackEntry {
+    uint64_t offset;  // Blok šablóny od začiatku balíka
+    uint64_t sourceSize, sourceTime;  // Zdrojové BMP
+    uint64_t maskSize, maskTime;  // <meno>.mask.bmp, 0 = bez súboru
+    uint64_t contentHash;  // Pixely a maska zdroja
+    uint32_t nameOffset, nameLength;
+    int32_t width, height;
+    uint32_t flags;  // PACK_MASKED
+    uint32_t reserved;
+};
+
+// Súbor zmapovaný len na čítanie, pamäť platí kým objekt žije. Otvára sa so
+// zdieľaním mazania, aby sa dal premenovať aj keď ho ešte drží stará sada.
+class MappedFile {
+private:
+#ifdef _WIN32
+    HANDLE m_mapping = nullptr;
+#endif
+    const uint8_t* m_view = nullptr;
+    size_t m_size = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+#ifdef _WIN32
+    ~MappedFile() {
+        if (m_view) UnmapViewOfFile(m_view);
+        if (m_mapping) CloseHandle(m_mapping);
+    }
+
+    bool Open(const std::string& path) {
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER size = {};
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);  // Mapovanie drží súbor otvorený
+        if (!m_mapping) return false;
+
+        m_view = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_view) return false;
+        m_size = (size_t)size.QuadPart;
+        return true;
+    }
+#else
+    ~MappedFile() {
+        if (m_view) munmap((void*)m_view, m_size);
+    }
+
+    bool Open(const std::string& path) {
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0) return false;
+
+        struct stat info = {};
+        void* view = MAP_FAILED;
+        if (fstat(file, &info) == 0 && info.st_size > 0) {
+            view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        }
+        close(file);  // Mapovanie drží súbor otvorený
+        if (view == MAP_FAILED) return false;
+
+        m_view = (const uint8_t*)view;
+        m_size = (size_t)info.st_size;
+        return true;
+    }
+#endif
+
+    const uint8_t* Data() const { return m_view; }
+    size_t Size() const { return m_size; }
+};
+
+std::string TemplatePackPath(const std::string& dir) {
+    std::filesystem::path path(dir);
+    if (!path.has_filename()) path = path.parent_path();
+    return path.string() + ".pack";
+}
+
+// FNV-1a, pokračuje od hash
+uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Veľkosť a čas zápisu zdroja, 0 ak neexistuje
+void StatPackSource(const std::filesystem::path& file, uint64_t& size, uint64_t& time) {
+    std::error_code ec;
+    size = std::filesystem::file_size(file, ec);
+    if (ec) { size = time = 0; return; }
+    time = (uint64_t)std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+    if (ec) time = 0;
+}
+
+// Zmapuje balík a vráti jeho platné záznamy podľa mena. nullptr = balík
+// chýba, je poškodený alebo z inej verzie.
+std::shared_ptr<MappedFile> OpenTemplatePack(const std::string& packPath,
+    std::unordered_map<std::string, const PackEntry*>& index) {
+    index.clear();
+    auto pack = std::make_shared<MappedFile>();
+    if (!pack->Open(packPath) || pack->Size() < sizeof(PackHeader)) return nullptr;
+
+    const uint8_t* base = pack->Data();
+    const PackHeader& header = *(const PackHeader*)base;
+    if (header.magic != TEMPLATE_PACK_MAGIC || header.version != TEMPLATE_PACK_VERSION ||
+        header.templateSize != TEMPLATE_SIZE || header.pyramidLevels != PYRAMID_MAX_LEVELS ||
+        header.indexOffset % alignof(PackEntry) != 0 ||
+        header.indexOffset > pack->Size() || header.count > (pack->Size() - header.indexOffset) / sizeof(PackEntry) ||
+        header.namesOffset > pack->Size() || header.namesBytes > pack->Size() - header.namesOffset) {
+        return nullptr;
+    }
+
+    const PackEntry* entries = (const PackEntry*)(base + header.indexOffset);
+    const char* names = (const char*)(base + header.namesOffset);
+    for (uint32_t i = 0; i < header.count; i++) {
+        const PackEntry& entry = entries[i];
+        if (entry.width < MIN_TEMPLATE_DIM || entry.height < MIN_TEMPLATE_DIM ||
+            entry.width > MAX_TEMPLATE_DIM || entry.height > MAX_TEMPLATE_DIM ||
+            entry.nameOffset > header.namesBytes || entry.nameLength > header.namesBytes - entry.nameOffset ||
+            entry.offset % TEMPLATE_PLANE_ALIGN != 0 || entry.offset > pack->Size()) {
+            continue;
+        }
+        size_t bytes = ComputeTemplateLayout(entry.width, entry.height, entry.flags & PACK_MASKED).bytes;
+        if (bytes > pack->Size() - entry.offset) continue;
+        index[std::string(names + entry.nameOffset, entry.nameLength)] = &entry;
+    }
+    return pack;
+}
+
+// Šablóna ukazuje priamo do zmapovaného bloku záznamu
+void BindPackedTemplate(Template& tmpl, const PackEntry& entry, const std::shared_ptr<MappedFile>& pack) {
+    tmpl.width = entry.width;
+    tmpl.height = entry.height;
+    BindTemplate(tmpl, pack->Data() + entry.offset,
+        ComputeTemplateLayout(entry.width, entry.height, entry.flags & PACK_MASKED), pack);
+}
+
+// Zapíše bloky sady (entries[i] patrí templates[i], offset a meno sa doplnia)
+// do nového balíka a vymení ho za starý. Starý môže byť ešte zmapovaný
+// predošlou sadou, preto sa len premenuje na .old a zmaže pri ďalšom zápise.
+bool WriteTemplatePack(const std::string& packPath, const TemplateSet& set, std::vector<PackEntry>& entries) {
+    const std::string tempPath = packPath + ".tmp";
+    const std::string oldPath = packPath + ".old";
+
+    PackHeader header = {};
+    header.magic = TEMPLATE_PACK_MAGIC;
+    header.version = TEMPLATE_PACK_VERSION;
+    header.templateSize = TEMPLATE_SIZE;
+    header.pyramidLevels = PYRAMID_MAX_LEVELS;
+    header.count = (uint32_t)entries.size();
+
+    std::string names;
+    uint64_t offset = (sizeof(PackHeader) + TEMPLATE_PLANE_ALIGN - 1) & ~(uint64_t)(TEMPLATE_PLANE_ALIGN - 1);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Template& tmpl = set.templates[i];
+        entries[i].offset = offset;
+        entries[i].nameOffset = (uint32_t)names.size();
+        entries[i].nameLength = (uint32_t)tmpl.filename.size();
+        names += tmpl.filename;
+        offset += tmpl.BlockBytes();  // Násobok TEMPLATE_PLANE_ALIGN
+    }
+    header.indexOffset = offset;
+    header.namesOffset = offset + entries.size() * sizeof(PackEntry);
+    header.namesBytes = (uint32_t)names.size();
+
+    bool written;
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (file) {
+            file.write((const char*)&header, sizeof(header));
+            for (size_t i = 0; i < entries.size(); i++) {
+                const Template& tmpl = set.templates[i];
+                static const char padding[TEMPLATE_PLANE_ALIGN] = {};
+                file.write(padding, (std::streamsize)(entries[i].offset - (uint64_t)file.tellp()));
+                file.write((const char*)tmpl.data, (std::streamsize)tmpl.BlockBytes());
+            }
+            file.write((const char*)entries.data(), (std::streamsize)(entries.size() * sizeof(PackEntry)));
+            file.write(names.data(), (std::streamsize)names.size());
+        }
+        file.close();
+        written = !file.fail();
+    }
+
+    // Pri každej chybe sa nedopísaný .tmp zmaže, pôvodný balík ostáva
+    auto fail = [&]() {
+        std::error_code removeError;
+        std::filesystem::remove(tempPath, removeError);
+        return false;
+    };
+    if (!written) return fail();
+
+    std::error_code ec;
+    std::filesystem::remove(oldPath, ec);
+    if (ec) return fail();
+    bool hadPack = std::filesystem::exists(packPath, ec);
+    if (ec) return fail();
+    if (hadPack) {
+        std::filesystem::rename(packPath, oldPath, ec);
+        if (ec) return fail();
+    }
+    std::filesystem::rename(tempPath, packPath, ec);
+    if (ec) {
+        if (hadPack) std::filesystem::rename(oldPath, packPath, ec);
+        return fail();
+    }
+    return true;
+}
+
+// Načíta všetky .bmp z adresára do novej sady (zoradené podľa názvu, aby
+// indexy štatistík zostali stabilné). S balíkom sa nezmenené šablóny
+// použijú zo zmapovaného balíka a balík sa po zmene prepíše. Volá sa len
+// z jedného vlákna (štart, potom TemplateWatcher).
+std::shared_ptr<TemplateSet> LoadTemplateSet(const std::string& path, bool usePack = false) {
+    auto set = std::make_shared<TemplateSet>();
+
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+        const auto& file = entry.path();
+        if (file.extension() == ".bmp" && file.stem().extension() != ".mask") files.push_back(file);
+    }
+    std::sort(files.begin(), files.end());
+
+    const std::string packPath = TemplatePackPath(path);
+    std::unordered_map<std::string, const PackEntry*> packed;
+    std::shared_ptr<MappedFile> pack = usePack ? OpenTemplatePack(packPath, packed) : nullptr;
+    std::vector<PackEntry> entries;  // Záznam balíka pre každú šablónu sady
+    size_t unchanged = 0;  // Šablóny so záznamom zhodným so starým balíkom
+    size_t computed = 0;
+
+    for (const auto& file : files) {
+        Template tmpl;
+        tmpl.filename = file.filename().string();
+        std::filesystem::path maskFile = file;
+        maskFile.replace_extension(".mask.bmp");
+
+        PackEntry entry = {};
+        StatPackSource(file, entry.sourceSize, entry.sourceTime);
+        StatPackSource(maskFile, entry.maskSize, entry.maskTime);
+        auto found = packed.find(tmpl.filename);
+        const PackEntry* old = found != packed.end() ? found->second : nullptr;
+
+        if (old && old->sourceSize == entry.sourceSize && old->sourceTime == entry.sourceTime &&
+            old->maskSize == entry.maskSize && old->maskTime == entry.maskTime) {
+            BindPackedTemplate(tmpl, *old, pack);
+            set->templates.push_back(tmpl);
+            entries.push_back(*old);
+            unchanged++;
+            continue;
+        }
+
+        std::vector<uint8_t> pixels, keep;
+        int width, height;
+        if (!LoadBMP32(file.string(), pixels, width, height, MAX_TEMPLATE_DIM)) continue;
+        if (width < MIN_TEMPLATE_DIM || height < MIN_TEMPLATE_DIM ||
+            width > MAX_TEMPLATE_DIM || height > MAX_TEMPLATE_DIM) {
+            continue;
+        }
+        if (!LoadTemplateMask(file, pixels, width, height, keep)) continue;
+
+        entry.width = width;
+        entry.height = height;
+        entry.flags = keep.empty() ? 0 : PACK_MASKED;
+        entry.contentHash = HashBytes(keep.data(), keep.size(), HashBytes(pixels.data(), pixels.size()));
+
+        // Nový čas zápisu bez zmeny obsahu (kópia, checkout): blok z balíka platí
+        if (old && old->contentHash == entry.contentHash && old->width == entry.width &&
+            old->height == entry.height && old->flags == entry.flags) {
+            BindPackedTemplate(tmpl, *old, pack);
+        } else {
+            tmpl.width = width;
+            tmpl.height = height;
+            PrepareTemplate(tmpl, pixels.data(), keep.empty() ? nullptr : keep.data());
+            computed++;
+
+            std::cout << "Načítaná šablóna: " << tmpl.filename;
+            if (tmpl.IsMasked()) std::cout << " (maska: " << tmpl.maskedBGR.activePixels << " pixelov)";
+            std::cout << std::endl;
+        }
+        set->templates.push_back(tmpl);
+        entries.push_back(entry);
+    }
+
+    if (!usePack) return set;
+    if (unchanged == set->templates.size() && unchanged == packed.size()) {
+        std::cout << "Balík šablón: " << unchanged << " šablón bez zmeny" << std::endl;
+        return set;
+    }
+
+    // Prepísaný balík nahradí staré bloky aj vlastné buffre novo načítaných
+    std::shared_ptr<MappedFile> written;
+    if (WriteTemplatePack(packPath, *set, entries)) written = OpenTemplatePack(packPath, packed);
+    if (!written || packed.size() != set->templates.size()) {
+        std::cerr << "Balík šablón " << packPath << " sa nepodarilo zapísať, šablóny ostanú v pamäti." << std::endl;
+        return set;
+    }
+    for (auto& tmpl : set->templates) BindPackedTemplate(tmpl, *packed[tmpl.filename], written);
+    std::cout << "Balík šablón: " << unchanged << " bez zmeny, " << computed << " prepočítaných, "
+        << set->templates.size() - unchanged - computed << " s novým časom" << std::endl;
+
+    return set;
+}
+
+// Znovu načíta ./obr/ a vymení sadu, spracovanie medzitým beží so starou
+void ReloadTemplates() {
+    auto set = LoadTemplateSet("./obr/", g_settings.useTemplatePack);
+
+    std::lock_guard<std::mutex> lock(g_templateWriteMutex);
+    PublishTemplateSet(set);
+    std::cout << "Sada šablón v" << set->version << ": " << set->templates.size() << " šablón" << std::endl;
+}
+
+// Načíta všetky obrázky z adresára
+void LoadTemplates() {
+    // Načítaj konfiguráciu
+    LoadConfig();
+
+    // Vytvor adresár ak neexistuje
+    std::filesystem::create_directories("./obr/");
+    ReloadTemplates();
+
+    // Načítaj štatistiky učenia (indexované podľa zoradenej sady)
+    g_templateStats.clear();
+    LoadLearningStats();
+    g_templateStats.resize(max(g_templateStats.size(), AcquireTemplateSet()->templates.size()));
+
+    std::cout << "Načítaných šablón: " << AcquireTemplateSet()->templates.size() << std::endl;
+}
+
+// Preradí štatistiky k novej verzii sady podľa názvu súboru
+void RemapTemplateStats(const TemplateSet& from, const TemplateSet& to) {
+    std::unordered_map<std::string, size_t> oldIndex;
+    for (size_t i = 0; i < from.templates.size(); i++) {
+        oldIndex[from.templates[i].filename] = i;
+    }
+
+    // Presun zo starých položiek už pod zámkom, DisplayThread ich číta
+    std::vector<TemplateStats> remapped(to.templates.size());
+    std::lock_guard<std::mutex> lock(g_statsMutex);
+    for (size_t i = 0; i < to.templates.size(); i++) {
+        auto it = oldIndex.find(to.templates[i].filename);
+        if (it != oldIndex.end() && it->second < g_templateStats.size()) {
+            remapped[i] = std::move(g_templateStats[it->second]);
+        }
+    }
+    g_templateStats.swap(remapped);
+}
+
+// Úloha pre worker pool: jedna šablóna (alebo blok šablón) v jednom regióne,
+// pozície [x0, x1) x [y0, y1)
+struct ScanTask {
+    int region;  // Index do výrezov aktívnych regiónov
+    int unit;  // Index šablóny, pri dávkovom kerneli index bloku
+    int x0, x1;
+    int y0, y1;
+    int tile = -1;  // Dlaždica pozícií ktorej výsledok sa pamätá, -1 = bez detekcie zmien
+};
+
+// Najlepšia pozícia nájdená jednou úlohou
+struct ScanResult {
+    float score = FLT_MAX;
+    int x = -1, y = -1;
+};
+
+// Zhoda šablóny v regióne, pozícia je ľavý horný roh vo výreze regiónu
+struct RegionHit {
+    int region;
+    int templateId;
+    ScanResult result;
+};
+
+// ===== VIACNÁSOBNÉ VÝSKYTY (MultiInstance) =====
+// Mriežka buniek rozmerov šablóny nad pozíciami ľavého horného rohu. Dve
+// pozície v jednej bunke sa vždy prekrývajú, v bunke stačí najlepšia.
+// Jeden výskyt zasiahne najviac 2x2 bunky, preto halda drží 4x viac buniek
+// než výskytov ktoré sa nakoniec zverejnia.
+constexpr int INSTANCE_CELLS_PER_MATCH = 4;
+
+// Skoršia = lepšie skóre, pri rovnakom skoršia pozícia po riadkoch
+inline bool BetterResult(const ScanResult& a, const ScanResult& b) {
+    if (a.score != b.score) return a.score < b.score;
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+}
+
+// Obmedzená halda pozícií pod toleranciou, najviac jedna na bunku.
+// Koreň je najhoršia pozícia, nahradí ju lepšia keď je halda plná.
+struct InstanceHeap {
+    std::vector<ScanResult> items;
+    int capacity = 0;
+    int cellWidth = TEMPLATE_SIZE, cellHeight = TEMPLATE_SIZE;
+
+    void Reset(int maxInstances, int width, int height) {
+        items.clear();
+        capacity = maxInstances * INSTANCE_CELLS_PER_MATCH;
+        cellWidth = width;
+        cellHeight = height;
+    }
+
+    void Offer(int x, int y, float score) {
+        const ScanResult result = { score, x, y };
+        const bool full = (int)items.size() >= capacity;
+        if (full && !BetterResult(result, items.front())) return;
+
+        // Horšia než najhoršia nebola, takže aj bunka s ňou sa oplatí hľadať
+        const int cellX = x / cellWidth, cellY = y / cellHeight;
+        for (auto& item : items) {
+            if (item.x / cellWidth != cellX || item.y / cellHeight != cellY) continue;
+            if (BetterResult(result, item)) {
+                item = result;
+                std::make_heap(items.begin(), items.end(), BetterResult);
+            }
+            return;
+        }
+
+        if (full) {
+            std::pop_heap(items.begin(), items.end(), BetterResult);
+            items.back() = result;
+        }
+        else {
+            items.push_back(result);
+        }
+        std::push_heap(items.begin(), items.end(), BetterResult);
+    }
+};
+
+// Greedy NMS: od najlepšieho kandidáta berie tie, ktoré sa neprekrývajú so
+// žiadnym prijatým, kým ich nie je maxInstances. Prijatý výskyt je v mriežke
+// buniek, prekryv sa hľadá len v susedných 3x3 bunkách.
+void SuppressInstances(std::vector<ScanResult>& candidates, int positionsX, int positionsY,
+    int width, int height, int maxInstances, std::vector<ScanResult>& accepted) {
+    accepted.clear();
+    std::sort(candidates.begin(), candidates.end(), BetterResult);
+
+    const int cols = (positionsX + width - 1) / width;
+    const int rows = (positionsY + height - 1) / height;
+    thread_local std::vector<int> grid;  // Index prijatého + 1, 0 = prázdna bunka
+    grid.assign((size_t)cols * rows, 0);
+
+    for (const auto& candidate : candidates) {
+        if ((int)accepted.size() >= maxInstances) break;
+        const int cellX = candidate.x / width, cellY = candidate.y / height;
+
+        bool overlaps = false;
+        for (int cy = max(cellY - 1, 0); cy <= min(cellY + 1, rows - 1) && !overlaps; cy++) {
+            for (int cx = max(cellX - 1, 0); cx <= min(cellX + 1, cols - 1) && !overlaps; cx++) {
+                int index = grid[(size_t)cy * cols + cx];
+                if (!index) continue;
+                const ScanResult& other = accepted[index - 1];
+                overlaps = abs(other.x - candidate.x) < width && abs(other.y - candidate.y) < height;
+            }
+        }
+        if (overlaps) continue;
+
+        accepted.push_back(candidate);
+        grid[(size_t)cellY * cols + cellX] = (int)accepted.size();
+    }
+}
+
+// Porovnanie jednej šablóny na pozíciách výrezu. Pri RandomPixelTest ide
+// v diskriminačnom poradí pixelov, posuny sa prepočítajú raz pre stride výrezu.
+// Šablóny iných rozmerov než TEMPLATE_SIZE idú cez kernel pre ich rozmer.
+// Kanálové režimy BGR a jas majú vlastné kernely pre ľubovoľný rozmer,
+// maskované šablóny idú cez maskovaný kernel vo všetkých režimoch.
+class TemplateProbe {
+private:
+    const FrameView& m_view;
+    const Template& m_tmpl;
+    const Settings& m_settings;
+    const KernelTable& m_kernels;
+    MatchTemplateSizedFn m_sized = nullptr;
+    const uint8_t* m_sizedData = nullptr;  // Dáta šablóny pre m_sized (BGRA, BGR alebo jas)
+    const MaskedPlane* m_masked = nullptr;
+    bool m_luma = false;
+    bool m_ordered = false;
+    int32_t m_offsets[TEMPLATE_PIXELS];
+
+public:
+    TemplateProbe(const FrameView& view, const Template& tmpl, const Settings& settings, const KernelTable& kernels)
+        : m_view(view), m_tmpl(tmpl), m_settings(settings), m_kernels(kernels) {
+        if (tmpl.IsMasked()) {
+            m_luma = settings.channelMode == CHANNELS_LUMA;
+            m_masked = m_luma ? &tmpl.maskedLuma : &tmpl.maskedBGR;
+            return;
+        }
+        if (settings.channelMode == CHANNELS_LUMA) {
+            m_sized = SelectChannelKernel(kernels, CHANNELS_LUMA, tmpl.width);
+            m_sizedData = tmpl.luma;
+            m_luma = true;
+            return;
+        }
+        if (settings.channelMode == CHANNELS_BGR) {
+            m_sized = SelectChannelKernel(kernels, CHANNELS_BGR, tmpl.width);
+            m_sizedData = tmpl.bgr;
+            return;
+        }
+        if (!tmpl.IsDefaultSize()) {
+            m_sized = SelectSizedKernel(kernels, tmpl.width, tmpl.height);
+            m_sizedData = tmpl.data;
+            return;
+        }
+        m_ordered = settings.randomPixelTest;
+        if (!m_ordered) return;
+        for (int i = 0; i < TEMPLATE_PIXELS; i++) {
+            int p = tmpl.pixelOrder[i];
+            m_offsets[i] = (p / TEMPLATE_SIZE) * view.stride + (p % TEMPLATE_SIZE) * 4;
+        }
+    }
+
+    float Score(int x, int y) const {
+        if (m_masked) {
+            return m_luma ?
+                m_kernels.matchTemplateMasked(m_view.LumaPixel(x, y), m_view.lumaStride, *m_masked,
+                    m_settings.tolerance, m_settings.earlyPixelCount) :
+                m_kernels.matchTemplateMasked(m_view.Pixel(x, y), m_view.stride, *m_masked,
+                    m_settings.tolerance, m_settings.earlyPixelCount);
+        }
+        if (m_luma) {
+            return m_sized(m_view.LumaPixel(x, y), m_view.lumaStride, m_sizedData, m_tmpl.width, m_tmpl.height,
+                m_settings.tolerance, m_settings.earlyPixelCount);
+        }
+        if (m_sized) {
+            return m_sized(m_view.Pixel(x, y), m_view.stride, m_sizedData, m_tmpl.width, m_tmpl.height,
+                m_settings.tolerance, m_settings.earlyPixelCount);
+        }
+        if (m_ordered) {
+            return m_kernels.matchTemplateOrdered(m_view.Pixel(x, y), m_offsets, m_tmpl.orderedData,
+                m_settings.tolerance, OrderedEarlyPixels(m_settings.earlyPixelCount));
+        }
+        return m_kernels.matchTemplate(m_view.Pixel(x, y), m_view.stride, m_tmpl.data,
+            m_settings.tolerance, m_settings.earlyPixelCount);
+    }
+};
+
+// Skóre všetkých pozícií obdĺžnika bez early rejection, pre prahovanie
+// a hľadanie viacerých výskytov nad celou mapou
+struct ScoreMap {
+    int x0 = 0, y0 = 0;
+    int width = 0, height = 0;
+    std::vector<float> scores;  // Po riadkoch, width x height
+
+    float At(int x, int y) const { return scores[(size_t)(y - y0) * width + (x - x0)]; }
+};
+
+// Hustá mapa sa oplatí len keď early rejection nezaberie a kernel ju vie
+bool UseDenseScores(const Template& tmpl, const Settings& settings, const KernelTable& kernels) {
+    return settings.denseTolerance > 0 && settings.tolerance >= settings.denseTolerance &&
+        settings.channelMode == CHANNELS_LUMA && !tmpl.IsMasked() && kernels.denseScoresLuma;
+}
+
+// Mapa skóre pozícií [x0, x1) x [y0, y1) výrezu. Jas bez masky ide cez
+// DenseScoresFn po blokoch DENSE_BLOCK pozícií, zvyšok pri pravom okraji
+// (a ostatné režimy) cez TemplateProbe s plným súčtom. Hodnoty sa zhodujú
+// so skóre kernelov po pozíciách bez early rejection.
+void ComputeScoreMap(const FrameView& view, const Template& tmpl, const Settings& settings,
+    const KernelTable& kernels, int x0, int x1, int y0, int y1, ScoreMap& map) {
+    map.x0 = x0;
+    map.y0 = y0;
+    map.width = x1 - x0;
+    map.height = y1 - y0;
+    map.scores.resize((size_t)map.width * map.height);
+
+    int blocks = 0;
+    if (settings.channelMode == CHANNELS_LUMA && !tmpl.IsMasked() && kernels.denseScoresLuma) {
+        const int lastStart = view.width - tmpl.width - DENSE_READ_MARGIN;  // Najväčšie x bloku
+        if (lastStart >= x0) blocks = min(map.width / DENSE_BLOCK, (lastStart - x0) / DENSE_BLOCK + 1);
+        if (blocks > 0) {
+            kernels.denseScoresLuma(view.luma, view.lumaStride, tmpl.luma, tmpl.width, tmpl.height,
+                x0, blocks, y0, y1, map.scores.data(), map.width);
+        }
+    }
+
+    const int xDense = x0 + blocks * DENSE_BLOCK;
+    if (xDense == x1) return;
+
+    Settings full = settings;
+    full.earlyPixelCount = INT_MAX;
+    full.randomPixelTest = false;
+    const TemplateProbe probe(view, tmpl, full, kernels);
+    for (int y = y0; y < y1; y++) {
+        float* row = map.scores.data() + (size_t)(y - y0) * map.width - x0;
+        for (int x = xDense; x < x1; x++) row[x] = probe.Score(x, y);
+    }
+}
+
+// Vzorkovanie priemerného počtu prečítaných pixelov na pozíciu v oboch
+// poradiach (každá PIXEL_STATS_SAMPLE-ta pozícia ktorá prešla prefiltrom)
+constexpr int PIXEL_STATS_SAMPLE = 1024;
+
+struct PixelTouchStats {
+    int countdown = PIXEL_STATS_SAMPLE;
+    uint64_t samples = 0, rowOrder = 0, ordered = 0;
+
+    void Position(const FrameView& view, int x, int y, const Template& tmpl, const Settings& settings) {
+        if (!tmpl.UsesDefaultPath() || settings.channelMode != CHANNELS_BGRA || --countdown) return;
+        countdown = PIXEL_STATS_SAMPLE;
+        samples++;
+        rowOrder += CountPixelsTouched(view.Pixel(x, y), view.stride, tmpl.data, nullptr,
+            settings.tolerance, settings.earlyPixelCount);
+        ordered += CountPixelsTouched(view.Pixel(x, y), view.stride, tmpl.data, tmpl.pixelOrder,
+            settings.tolerance, OrderedEarlyPixels(settings.earlyPixelCount));
+    }
+
+    ~PixelTouchStats() {
+        if (!samples) return;
+        g_sampledPositions += samples;
+        g_pixelsRowOrder += rowOrder;
+        g_pixelsOrdered += ordered;
+    }
+};
+
+// Štandardné vyhľadávanie v obdĺžniku pozícií
+// sat == nullptr vypne successive elimination prefilter (len pre TEMPLATE_SIZE),
+// instances != nullptr zbiera aj všetky pozície pod toleranciou
+void ScanTemplateBand(const FrameView& view, const IntegralImage* sat, const Template& tmpl,
+    const Settings& settings, const KernelTable& kernels, int x0, int x1, int y0, int y1, ScanResult& result,
+    InstanceHeap* instances = nullptr) {
+    // Pozícia so SAD >= limit nemôže prejsť toleranciou
+    const int limit = settings.tolerance * TEMPLATE_SIZE * TEMPLATE_SIZE * 4;
+    const uint32_t* sums = tmpl.blockSums;
+
+    if (x1 - x0 >= DENSE_BLOCK && UseDenseScores(tmpl, settings, kernels)) {
+        thread_local ScoreMap map;
+        ComputeScoreMap(view, tmpl, settings, kernels, x0, x1, y0, y1, map);
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                float score = map.At(x, y);
+                if (instances && score < settings.tolerance) instances->Offer(x, y, score);
+
+                if (score < result.score) {
+                    result.score = score;
+                    result.x = x;
+                    result.y = y;
+                }
+            }
+        }
+        return;
+    }
+
+    const TemplateProbe probe(view, tmpl, settings, kernels);
+    PixelTouchStats touched;
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            if (sat && !SeaFilter(*sat, x, y, &sums, 1, limit, settings.seaLevels)) continue;
+
+            touched.Position(view, x, y, tmpl, settings);
+            float score = probe.Score(x, y);
+            if (instances && score < settings.tolerance) instances->Offer(x, y, score);
+
+            if (score < result.score) {
+                result.score = score;
+                result.x = x;
+                result.y = y;
+            }
+        }
+    }
+}
+
+// Štandardné vyhľadávanie bloku šablón v obdĺžniku pozícií, results (a instances
+// ak nie je nullptr) má BATCH_LANES prvkov. laneMask = dráhy bloku ktoré sa hľadajú.
+void ScanBlockBand(const FrameView& view, const IntegralImage* sat, const TemplateBlock& block,
+    const std::vector<Template>& templates, uint32_t laneMask,
+    const Settings& settings, const KernelTable& kernels, int x0, int x1, int y0, int y1, ScanResult* results,
+    InstanceHeap* instances = nullptr) {
+    const int limit = settings.tolerance * TEMPLATE_SIZE * TEMPLATE_SIZE * 4;
+    const uint32_t* sums[BATCH_LANES] = {};
+    for (int lane = 0; lane < block.laneCount; lane++) {
+        sums[lane] = templates[block.templateIds[lane]].blockSums;
+    }
+
+    float scores[BATCH_LANES];
+    PixelTouchStats touched;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            // Prefilter vyradí dráhy naraz, kernel beží len ak nejaká ostala
+            uint32_t positionMask = sat ? SeaFilter(*sat, x, y, sums, laneMask, limit, settings.seaLevels) : laneMask;
+            if (!positionMask) continue;
+
+            touched.Position(view, x, y, templates[block.templateIds[LowestSetBit(positionMask)]], settings);
+
+            kernels.matchTemplateBatch(view.Pixel(x, y), view.stride,
+                block, settings.tolerance, settings.earlyPixelCount, positionMask, scores);
+
+            for (int lane = 0; lane < block.laneCount; lane++) {
+                if (instances && ((positionMask >> lane) & 1) && scores[lane] < settings.tolerance) {
+                    instances[lane].Offer(x, y, scores[lane]);
+                }
+                if (((positionMask >> lane) & 1) && scores[lane] < results[lane].score) {
+                    results[lane].score = scores[lane];
+                    results[lane].x = x;
+                    results[lane].y = y;
+                }
+            }
+        }
+    }
+}
+
+// Pyramídové vyhľadávanie celého regiónu
+void ScanTemplatePyramid(const ImagePyramid& pyramid, const Template& tmpl,
+    const Settings& settings, const KernelTable& kernels, ScanResult& result, InstanceHeap* instances = nullptr) {
+    const FrameView& view = pyramid.Level(0);
+    // Pri všetkých výskytoch musí hrubá úroveň pustiť aspoň toľko kandidátov
+    const int maxCandidates = settings.multiInstance ?
+        max(settings.pyramidCandidates, settings.maxInstances) : settings.pyramidCandidates;
+    thread_local std::vector<PyramidSearch::Candidate> candidates;
+    g_pyramidSearch.SearchPyramid(pyramid, tmpl.pyramid, settings.pyramidLevels, settings.tolerance,
+        maxCandidates, kernels, candidates);
+
+    // Verifikuj kandidátov (sú v rámci hraníc a zoradené po riadkoch)
+    for (const auto& candidate : candidates) {
+        float score = g_pyramidSearch.VerifyCandidate(
+            view.data, view.stride,
+            tmpl.data, TEMPLATE_SIZE,
+            candidate.x, candidate.y, settings.tolerance, kernels
+        );
+        if (instances && score < settings.tolerance) instances->Offer(candidate.x, candidate.y, score);
+
+        if (score < result.score) {
+            result.score = score;
+            result.x = candidate.x;
+            result.y = candidate.y;
+        }
+    }
+}
+
+// Stav jedného regiónu medzi cyklami pre detekciu zmien. Hashe sú z dlaždíc
+// pixelov, výsledky sa pamätajú po dlaždiciach pozícií (ľavý horný roh
+// šablóny). Okno šablóny siaha šírka - 1 pixelov doprava a výška - 1 dole,
+// preto zmenená dlaždica pixelov vynúti aj dlaždice pozícií vľavo a hore.
+// Mriežka pozícií je pre najmenšiu šablónu sady, dosah pre najväčšiu.
+struct RegionTiles {
+    int x = 0, y = 0, width = 0, height = 0;  // Výrez z ktorého sú hashe
+    int cols = 0, rows = 0;  // Dlaždice pixelov
+    int posCols = 0, posRows = 0;  // Dlaždice pozícií, pri pyramíde jedna na celý región
+    int units = 0, lanes = 0;
+    std::vector<uint64_t> hashes;
+    std::vector<uint8_t> changed;  // Dlaždice pixelov zmenené od minulého cyklu
+    std::vector<uint8_t> rescan;  // Dlaždice pozícií ktoré treba prehľadať
+    std::vector<ScanResult> results;  // [jednotka][dlaždica pozícií][dráha]
+    std::vector<InstanceHeap> instances;  // Rovnaké indexy, len pri MultiInstance
+    int changedCount = 0;
+
+    // Prepočíta hashe a určí dlaždice pozícií na prehľadanie. reset = výsledky
+    // z minula neplatia (iné šablóny alebo nastavenia), prehľadá sa všetko.
+    void Update(const FrameView& view, const TemplateSet& set, bool wholeRegion, int unitCount, int laneCount,
+        bool withInstances, bool reset, const KernelTable& kernels) {
+        const int positionsX = view.width - set.minWidth + 1;
+        const int positionsY = view.height - set.minHeight + 1;
+        int newPosCols = wholeRegion ? 1 : (positionsX + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+        int newPosRows = wholeRegion ? 1 : (positionsY + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+
+        if (view.x != x || view.y != y || view.width != width || view.height != height) {
+            x = view.x;
+            y = view.y;
+            width = view.width;
+            height = view.height;
+            cols = (width + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+            rows = (height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+            hashes.assign((size_t)cols * rows, 0);
+            changed.resize(hashes.size());
+            reset = true;
+        }
+        if (newPosCols != posCols || newPosRows != posRows || unitCount != units || laneCount != lanes) {
+            posCols = newPosCols;
+            posRows = newPosRows;
+            units = unitCount;
+            lanes = laneCount;
+            results.assign((size_t)units * posCols * posRows * lanes, ScanResult());
+            reset = true;
+        }
+        if (withInstances != (instances.size() == results.size())) {
+            instances.clear();
+            if (withInstances) instances.resize(results.size());
+            reset = true;
+        }
+
+        changedCount = 0;
+        for (int ty = 0; ty < rows; ty++) {
+            for (int tx = 0; tx < cols; tx++) {
+                int px = tx * DIRTY_TILE_SIZE, py = ty * DIRTY_TILE_SIZE;
+                uint64_t hash = kernels.hashTile(view.Pixel(px, py), view.stride,
+                    min(DIRTY_TILE_SIZE, width - px), min(DIRTY_TILE_SIZE, height - py));
+
+                size_t i = (size_t)ty * cols + tx;
+                changed[i] = reset || hash != hashes[i];
+                hashes[i] = hash;
+                changedCount += changed[i];
+            }
+        }
+
+        rescan.assign((size_t)posCols * posRows, 0);
+        if (wholeRegion) {
+            rescan[0] = changedCount > 0;
+            return;
+        }
+        if (!changedCount) return;
+
+        // Dlaždica pozícií číta pixely do x1 + šírka - 1 (a rovnako po riadkoch)
+        for (int py = 0; py < posRows; py++) {
+            int ty0 = py, ty1 = min((min((py + 1) * DIRTY_TILE_SIZE, positionsY) + set.maxHeight - 2) / DIRTY_TILE_SIZE, rows - 1);
+            for (int px = 0; px < posCols; px++) {
+                int tx0 = px, tx1 = min((min((px + 1) * DIRTY_TILE_SIZE, positionsX) + set.maxWidth - 2) / DIRTY_TILE_SIZE, cols - 1);
+
+                bool dirty = false;
+                for (int ty = ty0; ty <= ty1 && !dirty; ty++) {
+                    for (int tx = tx0; tx <= tx1 && !dirty; tx++) {
+                        dirty = changed[(size_t)ty * cols + tx] != 0;
+                    }
+                }
+                rescan[(size_t)py * posCols + px] = dirty;
+            }
+        }
+    }
+
+    // Prehľadá všetky dlaždice pozícií bez ohľadu na hashe
+    void RescanAll() {
+        rescan.assign(rescan.size(), 1);
+    }
+
+    ScanResult* Results(int unit, int tile) {
+        return &results[((size_t)unit * posCols * posRows + tile) * lanes];
+    }
+
+    InstanceHeap* Instances(int unit, int tile) {
+        return &instances[((size_t)unit * posCols * posRows + tile) * lanes];
+    }
+};
+
+// Stav ScanFrame medzi snímkami jedného pipeline (súčasť MatcherContext)
+struct FrameScanState {
+    // Detekcia zmien: výsledky nezmenených dlaždíc ostávajú z minulých cyklov
+    std::vector<RegionTiles> regionTiles;
+    uint64_t tilesKey[13] = {};
+    std::chrono::steady_clock::time_point lastFullScan;
+    uint64_t tilesSkipHash = 0;
+
+    // Buffery po regiónoch, aby sa nealokovali každú snímku
+    std::vector<IntegralImage> integrals;
+    std::vector<ImagePyramid> pyramids;
+};
+
+// Oblasť ktorú pokrývajú všetky aktívne regióny (prázdna ak žiadny nie je)
+RECT ActiveRegionArea() {
+    RECT area = { LONG_MAX, LONG_MAX, LONG_MIN, LONG_MIN };
+    for (const auto& region : g_searchRegions) {
+        if (!region.active) continue;
+        area.left = min(area.left, (LONG)region.x);
+        area.top = min(area.top, (LONG)region.y);
+        area.right = max(area.right, (LONG)(region.x + region.width));
+        area.bottom = max(area.bottom, (LONG)(region.y + region.height));
+    }
+    return area;
+}
+
+// Prehľadá celé regióny (pri detekcii zmien len zmenené dlaždice) a doplní
+// do hits najlepšiu pozíciu každej šablóny ktorá prešla toleranciou.
+// Pri MultiInstance doplní až MaxInstances neprekrývajúcich sa výskytov.
+// Šablóny so skipTemplates[t] != 0 sa vynechajú (prázdne = žiadna).
+// scanPriors beží po detekcii zmien a môže doplniť hits aj skipTemplates,
+// pri nezmenenej snímke sa nevolá.
+// false = snímka je rovnaká ako minule a nie je čo zverejniť.
+bool ScanFrame(FrameScanState& state, const std::vector<FrameView>& views, const TemplateSet& templateSet,
+    const Settings& settings, const KernelTable& kernels, std::vector<uint8_t>& skipTemplates,
+    std::vector<RegionHit>& hits, const std::function<void()>& scanPriors = nullptr) {
+    const auto& templates = templateSet.templates;
+    const auto& blocks = templateSet.blocks;
+    const int templateCount = (int)templates.size();
+    const auto now = std::chrono::steady_clock::now();
+
+    // Dávkový kernel skenuje bloky BATCH_LANES šablón, pyramída ide po jednej
+    // Dávkový kernel porovnáva všetky dráhy v poradí riadkov, pri RandomPixelTest
+    // sa ide po jednej šablóne v jej diskriminačnom poradí. Dávkový kernel,
+    // pyramída a prefilter sú pre BGRA, iné kanálové režimy idú po jednej šablóne.
+    const bool bgra = settings.channelMode == CHANNELS_BGRA;
+    const bool usePyramid = settings.usePyramidSearch && bgra;
+    const bool batched = settings.useBatchedKernel && !usePyramid && !settings.randomPixelTest && bgra;
+    const int lanes = batched ? BATCH_LANES : 1;
+
+    // Pri dávkovom kerneli sú za blokmi šablóny iných rozmerov, každá ako
+    // jednotka s jedinou dráhou 0
+    const int blockCount = batched ? (int)blocks.size() : 0;
+    const int unitCount = batched ? blockCount + (int)templateSet.singles.size() : templateCount;
+    auto unitTemplate = [&](int unit, int lane) {
+        if (!batched) return lane == 0 ? unit : -1;
+        if (unit < blockCount) return blocks[unit].templateIds[lane];
+        return lane == 0 ? templateSet.singles[unit - blockCount] : -1;
+    };
+
+    // Rozmery jednotky (blok má všetky dráhy TEMPLATE_SIZE) a či sa zmestí do výrezu
+    auto unitSize = [&](int unit) -> const Template& { return templates[unitTemplate(unit, 0)]; };
+    auto unitFits = [&](const FrameView& view, int unit) {
+        return view.width >= unitSize(unit).width && view.height >= unitSize(unit).height;
+    };
+
+    // Detekcia zmien: výsledky nezmenených dlaždíc ostávajú z minulých cyklov.
+    // Iné šablóny, nastavenia alebo regióny ich zneplatnia, raz za sekundu sa
+    // prehľadá všetko (poistka proti kolízii hashu).
+    std::vector<RegionTiles>& regionTiles = state.regionTiles;
+    const bool useTiles = settings.useDirtyTiles;
+    bool reset = false;
+    int changedTiles = 0, totalTiles = 0;
+    if (useTiles) {
+        const uint64_t key[13] = {
+            templateSet.version, (uint64_t)settings.tolerance, (uint64_t)settings.earlyPixelCount,
+            (uint64_t)ResolveKernelLevel(settings.kernelLevel), (uint64_t)settings.pyramidLevels,
+            (uint64_t)batched, (uint64_t)usePyramid, (uint64_t)settings.randomPixelTest,
+            (uint64_t)settings.multiInstance, (uint64_t)settings.maxInstances,
+            (uint64_t)settings.pyramidCandidates, (uint64_t)settings.channelMode, (uint64_t)settings.denseTolerance
+        };
+        reset = memcmp(key, state.tilesKey, sizeof(key)) != 0 || regionTiles.size() != views.size() ||
+            now - state.lastFullScan >= std::chrono::seconds(1);
+        if (reset) state.lastFullScan = now;
+        memcpy(state.tilesKey, key, sizeof(key));
+
+        regionTiles.resize(views.size());
+        g_workerPool.RunBatch(views.size(), [&](size_t i, int) {
+            regionTiles[i].Update(views[i], templateSet, usePyramid, unitCount, lanes,
+                settings.multiInstance, reset, kernels);
+        });
+
+        for (const auto& tiles : regionTiles) {
+            changedTiles += tiles.changedCount;
+            totalTiles += (int)tiles.hashes.size();
+        }
+        g_changedTilePercent = totalTiles ? 100.0f * changedTiles / totalTiles : 0.0f;
+
+        // Rovnaká snímka ako minule: nie je čo hľadať ani zverejniť
+        if (!reset && !changedTiles && !views.empty()) return false;
+    }
+
+    if (scanPriors) scanPriors();
+
+    // Ktoré šablóny jednotky sa hľadajú (bit na dráhu)
+    std::vector<uint32_t> unitMasks(unitCount, 0);
+    uint64_t skipHash = 14695981039346656037ull;  // FNV-1a vynechaných šablón
+    for (int t = 0; t < templateCount; t++) {
+        bool skipped = !skipTemplates.empty() && skipTemplates[t];
+        skipHash = (skipHash ^ (uint64_t)skipped) * 1099511628211ull;
+    }
+    for (int u = 0; u < unitCount; u++) {
+        for (int lane = 0; lane < lanes; lane++) {
+            int t = unitTemplate(u, lane);
+            if (t >= 0 && templates[t].active && (skipTemplates.empty() || !skipTemplates[t])) unitMasks[u] |= 1u << lane;
+        }
+    }
+
+    // Iné vynechané šablóny: uložené výsledky nezmenených dlaždíc chýbajú
+    // pre šablóny ktoré minule vynechané boli, prehľadá sa všetko
+    if (useTiles && skipHash != state.tilesSkipHash && !reset) {
+        for (auto& tiles : regionTiles) tiles.RescanAll();
+    }
+    state.tilesSkipHash = skipHash;
+
+    // Rozdeľ prácu na úlohy (región, šablóna, pásmo riadkov). Poradie úloh
+    // je región -> šablóna -> pásmo, takže spájanie výsledkov je deterministické.
+    // S detekciou zmien sú úlohy len zmenené dlaždice pozícií.
+    // Šablóny iných rozmerov než TEMPLATE_SIZE nemajú pyramídu, idú štandardne.
+    std::vector<ScanTask> tasks;
+    for (int i = 0; i < (int)views.size(); i++) {
+        for (int u = 0; u < unitCount; u++) {
+            if (!unitMasks[u] || !unitFits(views[i], u)) continue;
+            const int columns = views[i].width - unitSize(u).width + 1;
+            const int rows = views[i].height - unitSize(u).height + 1;
+            const bool pyramid = usePyramid && unitSize(u).UsesDefaultPath();
+
+            if (useTiles) {
+                const RegionTiles& tiles = regionTiles[i];
+                for (int tile = 0; tile < (int)tiles.rescan.size(); tile++) {
+                    if (!tiles.rescan[tile]) continue;
+                    if (usePyramid) {
+                        tasks.push_back({ i, u, 0, columns, 0, rows, tile });
+                        continue;
+                    }
+                    int x0 = tile % tiles.posCols * DIRTY_TILE_SIZE;
+                    int y0 = tile / tiles.posCols * DIRTY_TILE_SIZE;
+                    tasks.push_back({ i, u, x0, min(x0 + DIRTY_TILE_SIZE, columns),
+                        y0, min(y0 + DIRTY_TILE_SIZE, rows), tile });
+                }
+            }
+            else if (pyramid) {
+                // Hrubá úroveň pyramídy sa prehľadáva celá, pásma by ju len opakovali
+                tasks.push_back({ i, u, 0, columns, 0, rows });
+            }
+            else {
+                for (int y0 = 0; y0 < rows; y0 += settings.bandHeight) {
+                    tasks.push_back({ i, u, 0, columns, y0, min(y0 + settings.bandHeight, rows) });
+                }
+            }
+        }
+    }
+
+    // Integrálne obrazy pre prefilter, jeden na región (len štandardné vyhľadávanie)
+    std::vector<IntegralImage>& integrals = state.integrals;
+    const bool useSea = settings.seaLevels > 0 && !usePyramid && bgra && !tasks.empty();
+    if (useSea) {
+        integrals.resize(views.size());
+        g_workerPool.RunBatch(views.size(), [&](size_t i, int) {
+            integrals[i].Build(views[i]);
+        });
+    }
+
+    // Pyramída každého regiónu sa stavia raz a zdieľajú ju všetky šablóny
+    std::vector<ImagePyramid>& pyramids = state.pyramids;
+    if (usePyramid) {
+        pyramids.resize(views.size());
+        g_workerPool.RunBatch(views.size(), [&](size_t i, int) {
+            if (useTiles && !regionTiles[i].rescan[0]) return;
+            pyramids[i].Build(views[i], settings.pyramidLevels, kernels);
+        });
+    }
+
+    const bool multi = settings.multiInstance;
+    std::vector<ScanResult> results(useTiles ? 0 : tasks.size() * lanes);
+    std::vector<InstanceHeap> instances(useTiles || !multi ? 0 : tasks.size() * lanes);
+    g_workerPool.RunBatch(tasks.size(), [&](size_t taskIndex, int) {
+        const ScanTask& task = tasks[taskIndex];
+        const FrameView& view = views[task.region];
+        const IntegralImage* sat = useSea ? &integrals[task.region] : nullptr;
+        ScanResult* taskResults = useTiles ?
+            regionTiles[task.region].Results(task.unit, task.tile) : &results[taskIndex * lanes];
+        std::fill(taskResults, taskResults + lanes, ScanResult());
+        InstanceHeap* taskInstances = nullptr;
+        if (multi) {
+            taskInstances = useTiles ?
+                regionTiles[task.region].Instances(task.unit, task.tile) : &instances[taskIndex * lanes];
+            for (int lane = 0; lane < lanes; lane++) {
+                taskInstances[lane].Reset(settings.maxInstances, unitSize(task.unit).width, unitSize(task.unit).height);
+            }
+        }
+
+        const Template& tmpl = unitSize(task.unit);
+        if (task.unit < blockCount) {
+            ScanBlockBand(view, sat, blocks[task.unit], templates, unitMasks[task.unit], settings, kernels,
+                task.x0, task.x1, task.y0, task.y1, taskResults, taskInstances);
+        }
+        else if (usePyramid && tmpl.UsesDefaultPath()) {
+            ScanTemplatePyramid(pyramids[task.region], tmpl, settings, kernels, *taskResults, taskInstances);
+        }
+        else {
+            ScanTemplateBand(view, tmpl.UsesDefaultPath() ? sat : nullptr, tmpl, settings, kernels,
+                task.x0, task.x1, task.y0, task.y1, *taskResults, taskInstances);
+        }
+    });
+
+    // Všetky výskyty: kandidáti zo všetkých úloh (dlaždíc) dvojice (región,
+    // jednotka) sa spoja a NMS z nich vyberie neprekrývajúce sa výskyty
+    if (multi) {
+        std::vector<std::vector<ScanResult>> candidates((size_t)views.size() * unitCount * lanes);
+        auto collect = [&](int region, int unit, const InstanceHeap* heaps) {
+            for (int lane = 0; lane < lanes; lane++) {
+                auto& c = candidates[((size_t)region * unitCount + unit) * lanes + lane];
+                c.insert(c.end(), heaps[lane].items.begin(), heaps[lane].items.end());
+            }
+        };
+        if (useTiles) {
+            for (int i = 0; i < (int)views.size(); i++) {
+                RegionTiles& tiles = regionTiles[i];
+                for (int u = 0; u < unitCount; u++) {
+                    if (!unitMasks[u] || !unitFits(views[i], u)) continue;
+                    for (int tile = 0; tile < tiles.posCols * tiles.posRows; tile++) collect(i, u, tiles.Instances(u, tile));
+                }
+            }
+        }
+        else {
+            for (size_t i = 0; i < tasks.size(); i++) collect(tasks[i].region, tasks[i].unit, &instances[i * lanes]);
+        }
+
+        std::vector<ScanResult> accepted;
+        for (int i = 0; i < (int)views.size(); i++) {
+            const FrameView& view = views[i];
+            for (int unit = 0; unit < unitCount; unit++) {
+                if (!unitFits(view, unit)) continue;
+                const Template& tmpl = unitSize(unit);
+                for (int lane = 0; lane < lanes; lane++) {
+                    int t = unitTemplate(unit, lane);
+                    if (t < 0 || !((unitMasks[unit] >> lane) & 1)) continue;
+
+                    SuppressInstances(candidates[((size_t)i * unitCount + unit) * lanes + lane],
+                        view.width - tmpl.width + 1, view.height - tmpl.height + 1, tmpl.width, tmpl.height,
+                        settings.maxInstances, accepted);
+                    for (const auto& found : accepted) hits.push_back({ i, t, found });
+                }
+            }
+        }
+        return true;
+    }
+
+    // Najlepšia pozícia dvojice (región, jednotka) v dráhe lane. Pri rovnakom
+    // skóre vyhráva skoršia pozícia po riadkoch, rovnako ako pri sériovom prechode.
+    std::vector<ScanResult> best((size_t)views.size() * unitCount * lanes);
+    if (useTiles) {
+        for (int i = 0; i < (int)views.size(); i++) {
+            RegionTiles& tiles = regionTiles[i];
+            for (int u = 0; u < unitCount; u++) {
+                for (int tile = 0; tile < tiles.posCols * tiles.posRows; tile++) {
+                    const ScanResult* tileResults = tiles.Results(u, tile);
+                    for (int lane = 0; lane < lanes; lane++) {
+                        ScanResult& b = best[((size_t)i * unitCount + u) * lanes + lane];
+                        const ScanResult& r = tileResults[lane];
+                        if (r.score < b.score ||
+                            (r.score == b.score && r.score < FLT_MAX && (r.y < b.y || (r.y == b.y && r.x < b.x)))) {
+                            b = r;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i < tasks.size(); i++) {
+            for (int lane = 0; lane < lanes; lane++) {
+                ScanResult& b = best[((size_t)tasks[i].region * unitCount + tasks[i].unit) * lanes + lane];
+                if (results[i * lanes + lane].score < b.score) b = results[i * lanes + lane];
+            }
+        }
+    }
+
+    for (int i = 0; i < (int)views.size(); i++) {
+        const FrameView& view = views[i];
+        for (int unit = 0; unit < unitCount; unit++) {
+            if (!unitFits(view, unit)) continue;
+            for (int lane = 0; lane < lanes; lane++) {
+                int t = unitTemplate(unit, lane);
+                if (t < 0 || !((unitMasks[unit] >> lane) & 1)) continue;
+                const ScanResult& found = best[((size_t)i * unitCount + unit) * lanes + lane];
+
+                // Ak sme našli dobrú zhodu
+                if (found.score < settings.tolerance) {
+                    hits.push_back({ i, t, found });
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// ===== PRESNÁ ZHODA (ExactMatch) =====
+// Šablóny ktoré musia sedieť pixel po pixeli sa nehľadajú po jednej: 2D
+// Rabin-Karp hash každého okna rozmeru šablóny sa spočíta jedným prechodom
+// snímky a vyhľadá v tabuľke hashov všetkých šablón toho rozmeru. Bajty sa
+// porovnajú len pri zhode hashu. Cena je O(pixely) na rozmer, nezávisle od
+// počtu šablón. Riadkový hash okna sa posúva po x, stĺpcový súčet riadkových
+// hashov po y (kruh posledných height riadkov). Aritmetika je modulo 2^64,
+// kolízie zachytí porovnanie bajtov. Porovnávajú sa kanály podľa ChannelMode.
+// Maskované šablóny nemajú jeden hash okna, idú po pozíciách s toleranciou 0.
+constexpr uint64_t EXACT_ROW_BASE = 0x9E3779B97F4A7C15ull;  // Nepárne základy polynómov
+constexpr uint64_t EXACT_COLUMN_BASE = 0xC2B2AE3D27D4EB4Full;
+
+// Hodnota pixela pre hash a porovnanie podľa ChannelMode
+template<int Mode>
+inline uint32_t ExactPixel(const uint8_t* row, int x) {
+    if (Mode == CHANNELS_LUMA) return row[x];
+    uint32_t pixel;
+    memcpy(&pixel, row + x * 4, 4);
+    return Mode == CHANNELS_BGR ? pixel & 0x00FFFFFF : pixel;
+}
+
+inline uint64_t ExactPower(uint64_t base, int exponent) {
+    uint64_t power = 1;
+    while (exponent-- > 0) power *= base;
+    return power;
+}
+
+// Šablóny jedného rozmeru: otvorené adresovanie hash -> šablóna, duplicitné
+// hashe (rovnaké šablóny) ležia za sebou
+struct ExactGroup {
+    int width = 0, height = 0;
+    uint64_t rowPower = 0, columnPower = 0;  // ROW_BASE^width, COLUMN_BASE^height
+    std::vector<uint64_t> keys;
+    std::vector<int> ids;  // -1 = prázdne miesto
+    int shift = 64;
+
+    void Insert(uint64_t hash, int templateId) {
+        const size_t mask = ids.size() - 1;
+        size_t slot = (size_t)(hash >> shift);
+        while (ids[slot] >= 0) slot = (slot + 1) & mask;
+        keys[slot] = hash;
+        ids[slot] = templateId;
+    }
+
+    // Prvé miesto pre hash, pokračuje sa kým ids >= 0
+    size_t Slot(uint64_t hash) const { return (size_t)(hash >> shift); }
+};
+
+struct ExactIndex {
+    uint64_t version = 0;
+    int channelMode = -1;
+    std::vector<ExactGroup> groups;
+    std::vector<int> masked;  // Šablóny s maskou, hľadajú sa po pozíciách
+
+    template<int Mode>
+    static uint64_t HashTemplate(const Template& tmpl) {
+        const uint8_t* pixels = Mode == CHANNELS_LUMA ? tmpl.luma : tmpl.data;
+        const int stride = Mode == CHANNELS_LUMA ? tmpl.width : tmpl.width * 4;
+        uint64_t hash = 0;
+        for (int y = 0; y < tmpl.height; y++) {
+            uint64_t rowHash = 0;
+            for (int x = 0; x < tmpl.width; x++) rowHash = rowHash * EXACT_ROW_BASE + ExactPixel<Mode>(pixels + y * stride, x);
+            hash = hash * EXACT_COLUMN_BASE + rowHash;
+        }
+        return hash;
+    }
+
+    void Build(const TemplateSet& set, int mode) {
+        version = set.version;
+        channelMode = mode;
+        groups.clear();
+        masked.clear();
+
+        std::vector<std::vector<int>> members;
+        for (int t = 0; t < (int)set.templates.size(); t++) {
+            const Template& tmpl = set.templates[t];
+            if (tmpl.IsMasked()) {
+                masked.push_back(t);
+                continue;
+            }
+            size_t g = 0;
+            while (g < groups.size() && (groups[g].width != tmpl.width || groups[g].height != tmpl.height)) g++;
+            if (g == groups.size()) {
+                groups.emplace_back();
+                groups[g].width = tmpl.width;
+                groups[g].height = tmpl.height;
+                members.emplace_back();
+            }
+            members[g].push_back(t);
+        }
+
+        for (size_t g = 0; g < groups.size(); g++) {
+            ExactGroup& group = groups[g];
+            group.rowPower = ExactPower(EXACT_ROW_BASE, group.width);
+            group.columnPower = ExactPower(EXACT_COLUMN_BASE, group.height);
+            // Najviac štvrtina miest obsadená, prázdne okno skončí hneď na prvom mieste
+            int bits = 2;
+            while (((size_t)1 << bits) < members[g].size() * 4) bits++;
+            group.shift = 64 - bits;
+            group.keys.assign((size_t)1 << bits, 0);
+            group.ids.assign((size_t)1 << bits, -1);
+            for (int t : members[g]) {
+                const Template& tmpl = set.templates[t];
+                uint64_t hash = mode == CHANNELS_LUMA ? HashTemplate<CHANNELS_LUMA>(tmpl) :
+                    mode == CHANNELS_BGR ? HashTemplate<CHANNELS_BGR>(tmpl) : HashTemplate<CHANNELS_BGRA>(tmpl);
+                group.Insert(hash, t);
+            }
+        }
+    }
+};
+
+// Presný výskyt šablóny, pozícia ľavého horného rohu vo výreze
+struct ExactHit {
+    int templateId;
+    int x, y;
+};
+
+template<int Mode>
+bool ExactEqual(const FrameView& view, const Template& tmpl, int x, int y) {
+    for (int r = 0; r < tmpl.height; r++) {
+        const uint8_t* imageRow = Mode == CHANNELS_LUMA ? view.LumaPixel(x, y + r) : view.Pixel(x, y + r);
+        const uint8_t* tmplRow = Mode == CHANNELS_LUMA ? &tmpl.luma[(size_t)r * tmpl.width] : &tmpl.data[(size_t)r * tmpl.width * 4];
+        for (int c = 0; c < tmpl.width; c++) {
+            if (ExactPixel<Mode>(imageRow, c) != ExactPixel<Mode>(tmplRow, c)) return false;
+        }
+    }
+    return true;
+}
+
+// Okná s horným riadkom [y0, y1) a všetkými x jedného rozmeru, výskyty v
+// poradí po riadkoch. Prvých height - 1 riadkov pásma len naplní kruh.
+template<int Mode>
+void ExactScanBand(const FrameView& view, const ExactGroup& group, const std::vector<Template>& templates,
+    int y0, int y1, std::vector<ExactHit>& out) {
+    const int width = group.width, height = group.height;
+    const int columns = view.width - width + 1;
+    thread_local std::vector<uint64_t> ring, columnHash;
+    ring.assign((size_t)columns * height, 0);
+    columnHash.assign(columns, 0);
+
+    for (int row = y0; row < y1 + height - 1; row++) {
+        const uint8_t* pixels = Mode == CHANNELS_LUMA ? view.LumaPixel(0, row) : view.Pixel(0, row);
+        uint64_t* ringRow = &ring[(size_t)((row - y0) % height) * columns];
+
+        uint64_t rowHash = 0;
+        for (int x = 0; x < width; x++) rowHash = rowHash * EXACT_ROW_BASE + ExactPixel<Mode>(pixels, x);
+        for (int x = 0; x < columns; x++) {
+            if (x > 0) {
+                rowHash = rowHash * EXACT_ROW_BASE - ExactPixel<Mode>(pixels, x - 1) * group.rowPower +
+                    ExactPixel<Mode>(pixels, x + width - 1);
+            }
+            columnHash[x] = columnHash[x] * EXACT_COLUMN_BASE + rowHash - ringRow[x] * group.columnPower;
+            ringRow[x] = rowHash;
+        }
+
+        const int top = row - height + 1;
+        if (top < y0) continue;
+        const size_t mask = group.ids.size() - 1;
+        for (int x = 0; x < columns; x++) {
+            const uint64_t hash = columnHash[x];
+            for (size_t slot = group.Slot(hash); group.ids[slot] >= 0; slot = (slot + 1) & mask) {
+                const int t = group.ids[slot];
+                if (group.keys[slot] == hash && ExactEqual<Mode>(view, templates[t], x, top)) out.push_back({ t, x, top });
+            }
+        }
+    }
+}
+
+// Presné prehľadanie regiónov: do hits doplní prvú pozíciu po riadkoch
+// (pri MultiInstance až MaxInstances neprekrývajúcich sa) každej šablóny
+// ktorá sa vo výreze nachádza bez jediného rozdielu.
+void ScanFrameExact(ExactIndex& index, const std::vector<FrameView>& views, const TemplateSet& templateSet,
+    const Settings& settings, const KernelTable& kernels, std::vector<RegionHit>& hits) {
+    const auto& templates = templateSet.templates;
+    const int mode = settings.channelMode;
+
+    if (index.version != templateSet.version || index.channelMode != mode) index.Build(templateSet, mode);
+
+    // Úlohy (región, rozmer alebo maskovaná šablóna, pásmo riadkov). unit pod
+    // počtom skupín je skupina rozmeru, ďalšie sú maskované šablóny v poradí.
+    const int groupCount = (int)index.groups.size();
+    std::vector<ScanTask> tasks;
+    for (int i = 0; i < (int)views.size(); i++) {
+        for (int u = 0; u < groupCount + (int)index.masked.size(); u++) {
+            const int width = u < groupCount ? index.groups[u].width : templates[index.masked[u - groupCount]].width;
+            const int height = u < groupCount ? index.groups[u].height : templates[index.masked[u - groupCount]].height;
+            if (views[i].width < width || views[i].height < height) continue;
+            const int rows = views[i].height - height + 1;
+            for (int y0 = 0; y0 < rows; y0 += settings.bandHeight) {
+                tasks.push_back({ i, u, 0, views[i].width - width + 1, y0, min(y0 + settings.bandHeight, rows) });
+            }
+        }
+    }
+
+    // Tolerancia 0 s kontrolou od prvého riadku: prvý rozdielny riadok pozíciu odmietne
+    Settings exact = settings;
+    exact.tolerance = 0;
+    exact.earlyPixelCount = 0;
+
+    std::vector<std::vector<ExactHit>> taskHits(tasks.size());
+    g_workerPool.RunBatch(tasks.size(), [&](size_t taskIndex, int) {
+        const ScanTask& task = tasks[taskIndex];
+        const FrameView& view = views[task.region];
+        auto& out = taskHits[taskIndex];
+        if (task.unit < groupCount) {
+            const ExactGroup& group = index.groups[task.unit];
+            if (mode == CHANNELS_LUMA) ExactScanBand<CHANNELS_LUMA>(view, group, templates, task.y0, task.y1, out);
+            else if (mode == CHANNELS_BGR) ExactScanBand<CHANNELS_BGR>(view, group, templates, task.y0, task.y1, out);
+            else ExactScanBand<CHANNELS_BGRA>(view, group, templates, task.y0, task.y1, out);
+            return;
+        }
+
+        const int t = index.masked[task.unit - groupCount];
+        const TemplateProbe probe(view, templates[t], exact, kernels);
+        for (int y = task.y0; y < task.y1; y++) {
+            for (int x = task.x0; x < task.x1; x++) {
+                if (probe.Score(x, y) == 0) out.push_back({ t, x, y });
+            }
+        }
+    });
+
+    // Výskyty podľa (región, šablóna), úlohy sú zoradené po pásmach, takže
+    // výskyty ostávajú v poradí po riadkoch
+    std::vector<std::vector<ScanResult>> found((size_t)views.size() * templates.size());
+    for (size_t k = 0; k < tasks.size(); k++) {
+        for (const ExactHit& hit : taskHits[k]) {
+            if (!templates[hit.templateId].active) continue;
+            found[(size_t)tasks[k].region * templates.size() + hit.templateId].push_back({ 0.0f, hit.x, hit.y });
+        }
+    }
+
+    std::vector<ScanResult> accepted;
+    for (int i = 0; i < (int)views.size(); i++) {
+        for (int t = 0; t < (int)templates.size(); t++) {
+            auto& candidates = found[(size_t)i * templates.size() + t];
+            if (candidates.empty()) continue;
+            if (!settings.multiInstance) {
+                hits.push_back({ i, t, candidates.front() });
+                continue;
+            }
+            const Template& tmpl = templates[t];
+            SuppressInstances(candidates, views[i].width - tmpl.width + 1, views[i].height - tmpl.height + 1,
+                tmpl.width, tmpl.height, settings.maxInstances, accepted);
+            for (const auto& result : accepted) hits.push_back({ i, t, result });
+        }
+    }
+}
+
+// ===== STROM ZHLUKOV ŠABLÓN (ClusterTree) =====
+// Veľké sady majú veľa takmer rovnakých šablón (tá istá ikona v rôznych
+// stavoch), po jednej sa však každá porovnáva zvlášť. Strom zhlukov
+// (BuildClusterTrees) na pozícii porovná reprezentanta uzla a celý podstrom
+// odpadne keď SAD(obraz, rep) - polomer >= tolerancia * pixely * kanály:
+// z trojuholníkovej nerovnosti SAD(obraz, člen) >= SAD(obraz, rep) -
+// SAD(rep, člen), takže toleranciou by neprešiel žiadny člen. V liste
+// rovnako každý člen podľa svojej vzdialenosti k reprezentantovi. Kto
+// ostane, dostane skóre cez TemplateProbe ako pri hľadaní po jednej
+// šablóne, zhody sú preto rovnaké. Maskované šablóny idú po jednej.
+// Vnútorný uzol s polomerom nad CLUSTER_TEST_RADIUS na kanál (koreň
+// rôznorodých šablón) sa netestuje: podstrom by odpadol len pri obraze
+// vzdialenejšom než polomer, čo skoro nenastane, a test by zaplatil celý SAD.
+constexpr int CLUSTER_TEST_RADIUS = 64;
+
+// Prechod stromu po riadkoch pozícií: uzol otestuje všetky pozície riadku
+// ktoré prešli rodičom a deťom odovzdá tie, ktoré neodpadli. Dáta
+// reprezentanta a sondy člena tak ostávajú v cache celý riadok, nie jednu
+// pozíciu. results a instances sú indexované poradím člena v podstrome koreňa.
+class ClusterScan {
+private:
+    // Pozícia ktorá prešla uzlom a SAD jeho reprezentanta (-1 = netestovaný)
+    struct Survivor {
+        int x;
+        int sad;
+    };
+
+    const FrameView& m_view;
+    const TemplateSet& m_set;
+    const std::vector<uint8_t>& m_wanted;
+    const std::vector<uint8_t>& m_nodeWanted;
+    const Settings& m_settings;
+    ScanResult* m_results;
+    InstanceHeap* m_instances;
+    BoundedSadFn m_boundedSad;
+    int m_mode, m_height, m_rowBytes;
+    uint32_t m_imageMask;
+    int m_limit;  // Člen so SAD >= limit neprejde toleranciou
+    int m_testRadius;
+    int m_first;  // Prvý člen podstromu koreňa v clusterMembers
+    std::vector<TemplateProbe> m_probes;
+    std::vector<std::vector<Survivor>> m_survivors;  // [hĺbka uzla], 0 = celý riadok
+    int m_y = 0;
+
+    void Visit(int index, int depth, bool inherit) {
+        const ClusterNode& node = m_set.clusterNodes[index];
+        if (!m_nodeWanted[index]) return;
+        const std::vector<Survivor>& in = m_survivors[depth];
+        std::vector<Survivor>& out = m_survivors[depth + 1];
+        out.clear();
+
+        // Neprerezaný uzol má SAD celý (kernel skončil pod hranicou), dieťa
+        // s rovnakým reprezentantom ho zdedí. List s jedinou šablónou
+        // rovno skóruje, test by stál toľko ako jej sonda.
+        const int radius = node.radius[m_mode];
+        const bool test = node.IsLeaf() ? node.count > 1 : radius <= m_testRadius;
+        const uint8_t* rep = m_set.templates[node.rep].Plane(m_mode);
+        const bool luma = m_mode == CHANNELS_LUMA;
+        const int stride = luma ? m_view.lumaStride : m_view.stride;
+        for (const Survivor& survivor : in) {
+            int sad = inherit ? survivor.sad : -1;
+            if (sad < 0 && test) {
+                const uint8_t* image = luma ? m_view.LumaPixel(survivor.x, m_y) : m_view.Pixel(survivor.x, m_y);
+                sad = m_boundedSad(image, stride, rep, m_rowBytes, m_height, m_imageMask, m_limit + radius - 1);
+            }
+            if (sad < 0 || sad - radius < m_limit) out.push_back({ survivor.x, sad });
+        }
+        if (out.empty()) return;
+
+        if (!node.IsLeaf()) {
+            for (int c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+                const int child = m_set.clusterChildren[c];
+                Visit(child, depth + 1, m_set.clusterNodes[child].rep == node.rep);
+            }
+            return;
+        }
+
+        for (int k = node.first; k < node.first + node.count; k++) {
+            if (!m_wanted[m_set.clusterMembers[k]]) continue;
+            const int distance = m_set.clusterDistances[(size_t)k * CHANNEL_MODE_COUNT + m_mode];
+            const int member = k - m_first;
+            const TemplateProbe& probe = m_probes[member];
+            ScanResult& result = m_results[member];
+
+            for (const Survivor& survivor : out) {
+                if (survivor.sad >= 0 && survivor.sad - distance >= m_limit) continue;
+                float score = probe.Score(survivor.x, m_y);
+                if (m_instances && score < m_settings.tolerance) m_instances[member].Offer(survivor.x, m_y, score);
+
+                if (score < result.score) {
+                    result.score = score;
+                    result.x = survivor.x;
+                    result.y = m_y;
+                }
+            }
+        }
+    }
+
+public:
+    ClusterScan(const FrameView& view, const TemplateSet& set, int root, const std::vector<uint8_t>& wanted,
+        const std::vector<uint8_t>& nodeWanted, const Settings& settings, const KernelTable& kernels,
+        ScanResult* results, InstanceHeap* instances)
+        : m_view(view), m_set(set), m_wanted(wanted), m_nodeWanted(nodeWanted), m_settings(settings),
+        m_results(results), m_instances(instances), m_boundedSad(kernels.boundedSad) {
+        const ClusterNode& rootNode = set.clusterNodes[root];
+        const Template& shape = set.templates[rootNode.rep];
+        m_mode = settings.channelMode;
+        m_height = shape.height;
+        m_rowBytes = shape.width * CHANNEL_MODE_PIXEL_BYTES[m_mode];
+        m_imageMask = m_mode == CHANNELS_BGR ? 0x00FFFFFF : 0xFFFFFFFF;
+        const int channels = shape.width * shape.height * CHANNEL_MODE_COMPARED[m_mode];
+        m_limit = settings.tolerance * channels;
+        m_testRadius = CLUSTER_TEST_RADIUS * channels;
+        m_first = rootNode.first;
+
+        m_probes.reserve(rootNode.count);
+        for (int k = 0; k < rootNode.count; k++) {
+            m_probes.emplace_back(view, set.templates[set.clusterMembers[m_first + k]], settings, kernels);
+        }
+        m_survivors.resize(CLUSTER_LEVELS + 3);  // Koreň, uzly úrovní, list a jeho výstup
+    }
+
+    // Pozície [x0, x1) riadku y stromu s koreňom root
+    void Row(int root, int y, int x0, int x1) {
+        m_y = y;
+        m_survivors[0].clear();
+        for (int x = x0; x < x1; x++) m_survivors[0].push_back({ x, -1 });
+        Visit(root, 0, false);
+    }
+};
+
+// Prehľadanie regiónov cez stromy zhlukov, výsledok rovnaký ako ScanFrame
+// po jednej šablóne: najlepšia pozícia (pri MultiInstance až MaxInstances
+// neprekrývajúcich sa) každej šablóny ktorá prešla toleranciou. Bez
+// pyramídy, dávkového kernelu a detekcie zmien, prehľadáva sa vždy všetko.
+void ScanFrameClustered(const std::vector<FrameView>& views, const TemplateSet& templateSet,
+    const Settings& settings, const KernelTable& kernels, const std::vector<uint8_t>& skipTemplates,
+    std::vector<RegionHit>& hits) {
+    const auto& templates = templateSet.templates;
+    const auto& nodes = templateSet.clusterNodes;
+    const auto& roots = templateSet.clusterRoots;
+    const int treeCount = (int)roots.size();
+
+    std::vector<uint8_t> wanted(templates.size(), 0);
+    std::vector<int> masked;
+    for (int t = 0; t < (int)templates.size(); t++) {
+        wanted[t] = templates[t].active && (skipTemplates.empty() || !skipTemplates[t]);
+        if (wanted[t] && templates[t].IsMasked()) masked.push_back(t);
+    }
+    // Podstrom bez hľadanej šablóny sa netestuje
+    std::vector<uint8_t> nodeWanted(nodes.size(), 0);
+    for (size_t n = 0; n < nodes.size(); n++) {
+        for (int k = nodes[n].first; k < nodes[n].first + nodes[n].count && !nodeWanted[n]; k++) {
+            nodeWanted[n] = wanted[templateSet.clusterMembers[k]];
+        }
+    }
+
+    // Úlohy (región, strom alebo maskovaná šablóna, pásmo riadkov). unit pod
+    // počtom stromov je strom rozmeru, ďalšie sú maskované šablóny v poradí.
+    auto unitSize = [&](int unit) -> const Template& {
+        return templates[unit < treeCount ? nodes[roots[unit]].rep : masked[unit - treeCount]];
+    };
+    auto unitMembers = [&](int unit) { return unit < treeCount ? nodes[roots[unit]].count : 1; };
+    auto unitMember = [&](int unit, int k) {
+        return unit < treeCount ? templateSet.clusterMembers[nodes[roots[unit]].first + k] : masked[unit - treeCount];
+    };
+
+    std::vector<ScanTask> tasks;
+    for (int i = 0; i < (int)views.size(); i++) {
+        for (int u = 0; u < treeCount + (int)masked.size(); u++) {
+            if (u < treeCount && !nodeWanted[roots[u]]) continue;
+            const Template& tmpl = unitSize(u);
+            if (views[i].width < tmpl.width || views[i].height < tmpl.height) continue;
+            const int rows = views[i].height - tmpl.height + 1;
+            for (int y0 = 0; y0 < rows; y0 += settings.bandHeight) {
+                tasks.push_back({ i, u, 0, views[i].width - tmpl.width + 1, y0, min(y0 + settings.bandHeight, rows) });
+            }
+        }
+    }
+
+    // Výsledky úlohy: jeden na člena stromu, maskovaná šablóna má jeden
+    const bool multi = settings.multiInstance;
+    std::vector<size_t> offsets(tasks.size() + 1, 0);
+    for (size_t k = 0; k < tasks.size(); k++) offsets[k + 1] = offsets[k] + unitMembers(tasks[k].unit);
+    std::vector<ScanResult> results(offsets.back());
+    std::vector<InstanceHeap> instances(multi ? offsets.back() : 0);
+
+    g_workerPool.RunBatch(tasks.size(), [&](size_t taskIndex, int) {
+        const ScanTask& task = tasks[taskIndex];
+        const FrameView& view = views[task.region];
+        const Template& tmpl = unitSize(task.unit);
+        ScanResult* taskResults = &results[offsets[taskIndex]];
+        InstanceHeap* taskInstances = multi ? &instances[offsets[taskIndex]] : nullptr;
+        for (int k = 0; multi && k < unitMembers(task.unit); k++) {
+            taskInstances[k].Reset(settings.maxInstances, tmpl.width, tmpl.height);
+        }
+
+        if (task.unit < treeCount) {
+            ClusterScan scan(view, templateSet, roots[task.unit], wanted, nodeWanted, settings, kernels,
+                taskResults, taskInstances);
+            for (int y = task.y0; y < task.y1; y++) scan.Row(roots[task.unit], y, task.x0, task.x1);
+        }
+        else {
+            ScanTemplateBand(view, nullptr, tmpl, settings, kernels,
+                task.x0, task.x1, task.y0, task.y1, *taskResults, taskInstances);
+        }
+    });
+
+    // Výsledky podľa (región, šablóna). Úlohy idú po pásmach zhora, pri
+    // rovnakom skóre ostáva skoršia pozícia po riadkoch.
+    const size_t templateCount = templates.size();
+    std::vector<ScanResult> best(multi ? 0 : views.size() * templateCount);
+    std::vector<std::vector<ScanResult>> candidates(multi ? views.size() * templateCount : 0);
+    for (size_t k = 0; k < tasks.size(); k++) {
+        for (int m = 0; m < unitMembers(tasks[k].unit); m++) {
+            const size_t slot = (size_t)tasks[k].region * templateCount + unitMember(tasks[k].unit, m);
+            if (multi) {
+                const auto& items = instances[offsets[k] + m].items;
+                candidates[slot].insert(candidates[slot].end(), items.begin(), items.end());
+            }
+            else if (results[offsets[k] + m].score < best[slot].score) {
+                best[slot] = results[offsets[k] + m];
+            }
+        }
+    }
+
+    std::vector<ScanResult> accepted;
+    for (int i = 0; i < (int)views.size(); i++) {
+        for (int t = 0; t < (int)templateCount; t++) {
+            if (!wanted[t]) continue;
+            const size_t slot = (size_t)i * templateCount + t;
+            if (!multi) {
+                if (best[slot].score < settings.tolerance) hits.push_back({ i, t, best[slot] });
+                continue;
+            }
+            const Template& tmpl = templates[t];
+            if (views[i].width < tmpl.width || views[i].height < tmpl.height) continue;
+            SuppressInstances(candidates[slot], views[i].width - tmpl.width + 1, views[i].height - tmpl.height + 1,
+                tmpl.width, tmpl.height, settings.maxInstances, accepted);
+            for (const auto& found : accepted) hits.push_back({ i, t, found });
+        }
+    }
+}
+
+// Sledovanie zhôd medzi snímkami: šablóna nájdená minule sa najprv overí
+// v okne +-TrackingRadius okolo starej pozície. Celé prehľadanie beží len
+// keď sa niektorá stratí alebo po TrackingRefresh ms, nový výskyt šablóny
+// sa preto objaví najneskôr po tomto intervale.
+class MatchTracker {
+private:
+    std::vector<RegionHit> m_hits;  // Zhody posledného cyklu
+    std::vector<RECT> m_views;  // Výrezy regiónov v ktorých sa našli
+    uint64_t m_templateVersion = 0;
+    int m_channelMode = CHANNELS_BGRA;  // Iné kanály môžu nájsť iné zhody
+    std::chrono::steady_clock::time_point m_lastFullScan;
+    bool m_valid = false;
+
+    static RECT ViewRect(const FrameView& view) {
+        return { view.x, view.y, view.x + view.width, view.y + view.height };
+    }
+
+public:
+    // true = všetky minulé zhody sa potvrdili, ich nové pozície sú v hits
+    bool Track(const std::vector<FrameView>& views, const TemplateSet& set,
+        const Settings& settings, const KernelTable& kernels, std::vector<RegionHit>& hits) {
+        if (!m_valid || set.version != m_templateVersion || views.size() != m_views.size() ||
+            settings.channelMode != m_channelMode) {
+            return false;
+        }
+        if (std::chrono::steady_clock::now() - m_lastFullScan >= std::chrono::milliseconds(settings.trackingRefreshMs)) {
+            return false;
+        }
+        for (size_t i = 0; i < views.size(); i++) {
+            RECT rect = ViewRect(views[i]);
+            if (memcmp(&rect, &m_views[i], sizeof(RECT)) != 0) return false;
+        }
+
+        std::vector<RegionHit> tracked(m_hits.size());
+        std::atomic<bool> lost(false);
+        g_workerPool.RunBatch(m_hits.size(), [&](size_t h, int) {
+            if (lost) return;
+            const RegionHit& last = m_hits[h];
+            const FrameView& view = views[last.region];
+            const Template& tmpl = set.templates[last.templateId];
+            const int radius = settings.trackingRadius;
+            const int x1 = min(last.result.x + radius, view.width - tmpl.width);
+            const int y1 = min(last.result.y + radius, view.height - tmpl.height);
+
+            // Rovnaké poradie ako celé prehľadanie, pri zhode skóre vyhráva skoršia pozícia
+            const TemplateProbe probe(view, tmpl, settings, kernels);
+            ScanResult best;
+            for (int y = max(last.result.y - radius, 0); y <= y1; y++) {
+                for (int x = max(last.result.x - radius, 0); x <= x1; x++) {
+                    float score = probe.Score(x, y);
+                    if (score < best.score) {
+                        best.score = score;
+                        best.x = x;
+                        best.y = y;
+                    }
+                }
+            }
+
+            if (best.score >= settings.tolerance) lost = true;
+            tracked[h] = { last.region, last.templateId, best };
+        });
+
+        // Pri MultiInstance sa dva výskyty mohli stiahnuť na to isté miesto,
+        // jeden teda zmizol. Zhody sú zoradené podľa (región, šablóna).
+        for (size_t h = 1; h < tracked.size() && !lost; h++) {
+            for (size_t k = h; k-- > 0 && !lost;) {
+                if (tracked[k].region != tracked[h].region || tracked[k].templateId != tracked[h].templateId) break;
+                const Template& tmpl = set.templates[tracked[h].templateId];
+                lost = abs(tracked[k].result.x - tracked[h].result.x) < tmpl.width &&
+                    abs(tracked[k].result.y - tracked[h].result.y) < tmpl.height;
+            }
+        }
+        if (lost) return false;
+
+        m_hits = tracked;
+        hits.insert(hits.end(), tracked.begin(), tracked.end());
+        return true;
+    }
+
+    // Výsledok celého prehľadania sa stane východiskom sledovania
+    void Reset(const std::vector<FrameView>& views, const TemplateSet& set, const Settings& settings,
+        const std::vector<RegionHit>& hits) {
+        m_hits = hits;
+        m_views.clear();
+        for (const auto& view : views) m_views.push_back(ViewRect(view));
+        m_templateVersion = set.version;
+        m_channelMode = settings.channelMode;
+        m_lastFullScan = std::chrono::steady_clock::now();
+        m_valid = true;
+    }
+
+    // Celé prehľadanie zistilo rovnakú snímku ako minule, zhody platia ďalej
+    void MarkFullScan() {
+        m_lastFullScan = std::chrono::steady_clock::now();
+    }
+};
+
+// Naučená oblasť šablóny zo štatistík: obdĺžnik posledných hitov rozšírený
+// o PriorMargin. Platí len ak v nej leží väčšina dlhodobého tepla, šablóna
+// teda naozaj chodí na to isté miesto.
+constexpr int PRIOR_MIN_HITS = 8;  // Najmenej posledných hitov
+constexpr float PRIOR_HEAT_SHARE = 0.9f;  // Podiel tepla ktorý musí ležať v oblasti
+constexpr int PRIOR_MAX_POSITIONS = 4096;  // Väčšiu oblasť je lacnejšie prehľadať celú
+constexpr float PRIOR_CONFIDENT_SHARE = 0.5f;  // Skóre pod tolerancia * podiel ukončí hľadanie
+
+struct SpatialPrior {
+    bool valid = false;
+    RECT roi = {};  // Stredy šablóny na obrazovke, [left, right) x [top, bottom)
+    std::vector<POINT> anchors;  // Stredy posledných hitov od najčastejšieho
+};
+
+SpatialPrior BuildSpatialPrior(const TemplateStats& stats, int margin) {
+    SpatialPrior prior;
+    if (stats.recentCount < PRIOR_MIN_HITS) return prior;
+
+    // Pozície od najnovšej, pri rovnakom počte vyhráva novšia
+    std::vector<std::pair<int, POINT>> counted;
+    RECT box = { LONG_MAX, LONG_MAX, LONG_MIN, LONG_MIN };
+    for (int i = stats.recentCount - 1; i >= 0; i--) {
+        POINT p = stats.Recent(i);
+        box.left = min(box.left, p.x);
+        box.top = min(box.top, p.y);
+        box.right = max(box.right, p.x);
+        box.bottom = max(box.bottom, p.y);
+
+        auto it = std::find_if(counted.begin(), counted.end(), [&](const std::pair<int, POINT>& c) {
+            return c.second.x == p.x && c.second.y == p.y;
+        });
+        if (it != counted.end()) it->first++;
+        else counted.push_back({ 1, p });
+    }
+
+    RECT roi = { box.left - margin, box.top - margin, box.right + margin + 1, box.bottom + margin + 1 };
+    if ((roi.right - roi.left) * (roi.bottom - roi.top) > PRIOR_MAX_POSITIONS) return prior;
+
+    // Bunky mriežky tepla ktoré oblasť zasahuje
+    float inside = 0.0f, total = 0.0f;
+    for (int row = 0; row < STATS_HEAT_ROWS; row++) {
+        for (int col = 0; col < STATS_HEAT_COLS; col++) {
+            float heat = stats.Heat(row * STATS_HEAT_COLS + col);
+            total += heat;
+            if (col * SCREEN_WIDTH / STATS_HEAT_COLS < roi.right && (col + 1) * SCREEN_WIDTH / STATS_HEAT_COLS > roi.left &&
+                row * SCREEN_HEIGHT / STATS_HEAT_ROWS < roi.bottom && (row + 1) * SCREEN_HEIGHT / STATS_HEAT_ROWS > roi.top) {
+                inside += heat;
+            }
+        }
+    }
+    if (total <= 0.0f || inside < PRIOR_HEAT_SHARE * total) return prior;
+
+    std::stable_sort(counted.begin(), counted.end(), [](const std::pair<int, POINT>& a, const std::pair<int, POINT>& b) {
+        return a.first > b.first;
+    });
+    for (const auto& c : counted) prior.anchors.push_back(c.second);
+    prior.roi = roi;
+    prior.valid = true;
+    return prior;
+}
+
+// Šablóny s priorom sa hľadajú len v naučenej oblasti, najprv na
+// najčastejších pozíciách, istá zhoda hľadanie ukončí. handled[t] = 1 pre
+// šablóny nájdené takto, ostatné treba hľadať celým prehľadaním.
+void ScanPriors(const std::vector<FrameView>& views, const TemplateSet& set, const std::vector<SpatialPrior>& priors,
+    const Settings& settings, const KernelTable& kernels, std::vector<uint8_t>& handled, std::vector<RegionHit>& hits) {
+    const auto& templates = set.templates;
+    const float confident = settings.tolerance * PRIOR_CONFIDENT_SHARE;
+    handled.assign(templates.size(), 0);
+
+    std::vector<int> ids;
+    for (int t = 0; t < (int)templates.size() && t < (int)priors.size(); t++) {
+        if (templates[t].active && priors[t].valid) ids.push_back(t);
+    }
+
+    std::vector<std::vector<RegionHit>> found(ids.size());
+    g_workerPool.RunBatch(ids.size(), [&](size_t k, int) {
+        const int t = ids[k];
+        const SpatialPrior& prior = priors[t];
+        const Template& tmpl = templates[t];
+
+        for (int i = 0; i < (int)views.size(); i++) {
+            const FrameView& view = views[i];
+
+            // Oblasť v pozíciách ľavého horného rohu vo výreze
+            int x0 = max((int)prior.roi.left - tmpl.width / 2 - view.x, 0);
+            int y0 = max((int)prior.roi.top - tmpl.height / 2 - view.y, 0);
+            int x1 = min((int)prior.roi.right - tmpl.width / 2 - view.x, view.width - tmpl.width + 1);
+            int y1 = min((int)prior.roi.bottom - tmpl.height / 2 - view.y, view.height - tmpl.height + 1);
+            if (x0 >= x1 || y0 >= y1) continue;
+
+            const TemplateProbe probe(view, tmpl, settings, kernels);
+
+            // Všetky výskyty: celá oblasť, bez ukončenia na istej zhode
+            if (settings.multiInstance) {
+                InstanceHeap instances;
+                instances.Reset(settings.maxInstances, tmpl.width, tmpl.height);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        float score = probe.Score(x, y);
+                        if (score < settings.tolerance) instances.Offer(x, y, score);
+                    }
+                }
+
+                std::vector<ScanResult> accepted;
+                SuppressInstances(instances.items, view.width - tmpl.width + 1, view.height - tmpl.height + 1,
+                    tmpl.width, tmpl.height, settings.maxInstances, accepted);
+                for (const auto& result : accepted) found[k].push_back({ i, t, result });
+                continue;
+            }
+
+            ScanResult best;
+            auto test = [&](int x, int y) {
+                float score = probe.Score(x, y);
+                if (score < best.score) {
+                    best.score = score;
+                    best.x = x;
+                    best.y = y;
+                }
+                return score <= confident;
+            };
+
+            bool done = false;
+            for (const POINT& anchor : prior.anchors) {
+                int x = anchor.x - tmpl.width / 2 - view.x;
+                int y = anchor.y - tmpl.height / 2 - view.y;
+                if (x >= x0 && x < x1 && y >= y0 && y < y1 && test(x, y)) {
+                    done = true;
+                    break;
+                }
+            }
+            for (int y = y0; y < y1 && !done; y++) {
+                for (int x = x0; x < x1 && !done; x++) {
+                    done = test(x, y);
+                }
+            }
+
+            if (best.score < settings.tolerance) found[k].push_back({ i, t, best });
+        }
+    });
+
+    for (size_t k = 0; k < ids.size(); k++) {
+        if (found[k].empty()) continue;
+        handled[ids[k]] = 1;
+        hits.insert(hits.end(), found[k].begin(), found[k].end());
+    }
+}
+
+// Stav jedného pipeline hľadania medzi snímkami. Vlastní ho volajúci
+// MatchFrame (ProcessingThread), takže dva pipeline si stav neprepíšu.
+struct MatcherContext {
+    FrameScanState scan;
+    uint64_t scannedSequence = 0;  // Posledná snímka ktorú videl ScanFrame
+    ExactIndex exactIndex;
+    MatchTracker tracker;
+
+    std::shared_ptr<const TemplateSet> statsSet;  // Sada ku ktorej patria g_templateStats
+    std::vector<std::vector<uint8_t>> lumaPlanes;  // Jas výrezov pri ChannelMode luma
+
+    // Naučené oblasti a kedy sa majú postaviť znova
+    std::vector<SpatialPrior> priors;
+    uint64_t priorVersion = 0;
+    std::chrono::steady_clock::time_point lastPriorRefresh;
+
+    // Počítadlo FPS
+    int frameCount = 0;
+    std::chrono::steady_clock::time_point lastFPSUpdate = std::chrono::steady_clock::now();
+};
+
+// Oneskorenie, čas spracovania a FPS za cyklus MatchFrame, aj keď sa
+// nezmenená snímka nezverejnila
+void UpdateCycleStats(MatcherContext& context, std::chrono::steady_clock::time_point startTime,
+    std::chrono::steady_clock::time_point captureTime) {
+    g_lastLatency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - captureTime).count() / 1000.0f;
+
+    // Aktualizuj FPS       
+    auto endTime = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime);
+    g_lastProcessTime = duration.count() / 1000.0f;  // ms
+
+    context.frameCount++;
+
+    if (std::chrono::duration_cast<std::chrono::seconds>(endTime - context.lastFPSUpdate).count() >= 1) {
+        g_fps = context.frameCount;
+        context.frameCount = 0;
+        context.lastFPSUpdate = endTime;
+    }
+}
+
+// Hľadanie šablón v zachytenej snímke, regióny sú len výrezy z nej.
+// Zhody sa zverejnia cez g_matchPublisher, stav medzi snímkami je v context.
+void MatchFrame(MatcherContext& context, const CapturedFrame& frame) {
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto batch = g_matchPublisher.BeginBatch();
+    batch->frameSequence = frame.sequence;
+    batch->captureTime = frame.captureTime;
+
+    // Snapshot nastavení, aby sa počas cyklu nemenili pod workermi
+    const Settings settings = g_settings;
+    const KernelTable& kernels = GetKernels(settings.kernelLevel);
+
+    // Verzia sady šablón pre celý cyklus, výmena počas cyklu ju neovplyvní
+    const auto templateSet = AcquireTemplateSet();
+
+    if (context.statsSet != templateSet) {
+        if (context.statsSet) RemapTemplateStats(*context.statsSet, *templateSet);
+        context.statsSet = templateSet;
+    }
+
+    std::vector<FrameView> views;
+    for (const auto& region : g_searchRegions) {
+        FrameView view;
+        if (!region.active || !frame.View(region.x, region.y, region.width, region.height, view)) continue;
+        if (view.width < templateSet->minWidth || view.height < templateSet->minHeight) continue;
+
+        views.push_back(view);
+    }
+
+    // Pri jase sa výrezy prevedú raz za snímku, porovnanie potom číta bajt na pixel
+    auto& lumaPlanes = context.lumaPlanes;
+    if (settings.channelMode == CHANNELS_LUMA) {
+        lumaPlanes.resize(max(lumaPlanes.size(), views.size()));
+        g_workerPool.RunBatch(views.size(), [&](size_t i, int) {
+            FrameView& view = views[i];
+            lumaPlanes[i].resize((size_t)view.width * view.height);
+            kernels.convertLuma(view.data, view.stride, view.width, view.height, lumaPlanes[i].data(), view.width);
+            view.luma = lumaPlanes[i].data();
+            view.lumaStride = view.width;
+        });
+    }
+
+    // Pri sledovaní stačí overiť okolie minulých zhôd, celé prehľadanie len
+    // ak sa niektorá stratila alebo je čas na obnovu
+    MatchTracker& tracker = context.tracker;
+    std::vector<RegionHit> hits;
+    // Presná zhoda prehľadá všetko v O(pixely), sledovanie ani oblasti nepotrebuje
+    bool tracked = settings.useTracking && !settings.exactMatch &&
+        tracker.Track(views, *templateSet, settings, kernels, hits);
+
+    // Naučené oblasti platia do ďalšieho celého prehľadania, ktoré zachytí
+    // posun šablón a po ktorom sa oblasti postavia znova
+    bool rebuildPriors = false;
+
+    if (!tracked) {
+        // Oblasti sa prehľadajú až keď je jasné že sa snímka zmenila
+        std::vector<uint8_t> handled;
+        auto scanPriors = [&]() {
+            if (!settings.useSpatialPriors) return;
+            rebuildPriors = templateSet->version != context.priorVersion ||
+                startTime - context.lastPriorRefresh >= std::chrono::milliseconds(settings.priorRefreshMs);
+            if (!rebuildPriors) ScanPriors(views, *templateSet, context.priors, settings, kernels, handled, hits);
+        };
+
+        if (settings.exactMatch) {
+            ScanFrameExact(context.exactIndex, views, *templateSet, settings, kernels, hits);
+        }
+        else if (settings.useClusterTree) {
+            scanPriors();
+            ScanFrameClustered(views, *templateSet, settings, kernels, handled, hits);
+        }
+        else {
+            const uint64_t previousScan = context.scannedSequence;
+            context.scannedSequence = frame.sequence;
+            if (!ScanFrame(context.scan, views, *templateSet, settings, kernels, handled, hits, scanPriors)) {
+                // Snímka je rovnaká ako posledná prehľadaná, ak sú zverejnené
+                // jej zhody, platia aj pre túto
+                g_matchPublisher.Confirm(previousScan, frame.sequence, frame.captureTime);
+                tracker.MarkFullScan();
+                UpdateCycleStats(context, startTime, frame.captureTime);
+                return;
+            }
+        }
+
+        // Rovnaké poradie zhôd ako pri celom prehľadaní (región, šablóna)
+        std::stable_sort(hits.begin(), hits.end(), [](const RegionHit& a, const RegionHit& b) {
+            return a.region != b.region ? a.region < b.region : a.templateId < b.templateId;
+        });
+        tracker.Reset(views, *templateSet, settings, hits);
+    }
+
+    for (const auto& hit : hits) {
+        const FrameView& view = views[hit.region];
+        const int t = hit.templateId;
+
+        const Template& tmpl = templateSet->templates[t];
+
+        MatchResult match;
+        match.templateId = t;
+        match.x = view.x + hit.result.x + tmpl.width / 2;  // Stred šablóny
+        match.y = view.y + hit.result.y + tmpl.height / 2;
+        match.width = tmpl.width;
+        match.height = tmpl.height;
+        match.score = hit.result.score;
+        match.timestamp = std::chrono::steady_clock::now();
+
+        batch->matches.push_back(match);
+    }
+
+    // Aktualizuj štatistiky (učenie), O(1) na hit
+    if (settings.enableLearning && !batch->matches.empty()) {
+        std::lock_guard<std::mutex> lock(g_statsMutex);
+        for (const auto& match : batch->matches) {
+            g_templateStats[match.templateId].AddHit({ match.x, match.y }, match.timestamp);
+        }
+    }
+
+    if (rebuildPriors) {
+        const auto& templates = templateSet->templates;
+        context.priors.assign(templates.size(), SpatialPrior());
+        int priorCount = 0;
+        for (size_t t = 0; t < templates.size() && t < g_templateStats.size(); t++) {
+            context.priors[t] = BuildSpatialPrior(g_templateStats[t], settings.priorMargin);
+            priorCount += context.priors[t].valid;
+        }
+        context.priorVersion = templateSet->version;
+        context.lastPriorRefresh = startTime;
+        g_priorTemplates = priorCount;
+    }
+
+    // Zverejni všetky zhody snímky naraz
+    g_matchPublisher.Publish(batch);
+    UpdateCycleStats(context, startTime, frame.captureTime);
+}
+
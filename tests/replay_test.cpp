@@ -0,0 +1,188 @@
+// replay_test.cpp - Prehrá adresár .bmp snímok cez FileFrameSource a MatchFrame
+// a overí, že zhody všetkých regiónov v zverejnenom batchi sú z tej istej snímky.
+// Každá snímka má šablónu regiónu na inej pozícii, zhoda zo staršej snímky
+// (dlaždice, sledovanie, batch) by tak mala inú pozíciu ako očakávanú.
+#include "MatcherCore.h"
+
+constexpr int FRAME_WIDTH = 640;
+constexpr int FRAME_HEIGHT = 360;
+constexpr int REPLAY_FRAMES = 6;
+constexpr int REPLAY_PASSES = 2;  // Prehrávanie dookola, druhý prechod ide cez rovnaké súbory
+constexpr int CELL = 4;  // Šablóny z blokov 4x4, aby ich našla aj pyramída
+
+const SearchRegion REGIONS[] = {
+    { 0, 0, 200, FRAME_HEIGHT, "vľavo" },
+    { 220, 0, 200, FRAME_HEIGHT, "stred" },
+    { 440, 0, 200, FRAME_HEIGHT, "vpravo" },
+};
+constexpr int REGION_COUNT = sizeof(REGIONS) / sizeof(REGIONS[0]);
+
+int g_failures = 0;
+
+void Fail(const std::string& message) {
+    std::cout << "CHYBA: " << message << std::endl;
+    g_failures++;
+}
+
+// Ľavý horný roh šablóny regiónu r v snímke k, zarovnaný na CELL. Posledný
+// región sa mení len každú druhú snímku, jeho výsledky sa tak berú aj z
+// dlaždíc nezmenených od minulého cyklu.
+POINT PlantedAt(int region, int frame) {
+    const SearchRegion& r = REGIONS[region];
+    if (region == REGION_COUNT - 1) frame /= 2;
+    int x = (13 + frame * 37 + region * 11) % (r.width - TEMPLATE_SIZE) / CELL * CELL;
+    int y = (17 + frame * 53 + region * 29) % (r.height - TEMPLATE_SIZE) / CELL * CELL;
+    return { r.x + x, r.y + y };
+}
+
+std::vector<uint8_t> MakeTemplate(std::mt19937& rng) {
+    std::vector<uint8_t> pixels((size_t)TEMPLATE_SIZE * TEMPLATE_SIZE * 4);
+    std::uniform_int_distribution<int> color(0, 255);
+    for (int cy = 0; cy < TEMPLATE_SIZE; cy += CELL) {
+        for (int cx = 0; cx < TEMPLATE_SIZE; cx += CELL) {
+            uint8_t b = (uint8_t)color(rng), g = (uint8_t)color(rng), r = (uint8_t)color(rng);
+            for (int y = cy; y < cy + CELL; y++) {
+                for (int x = cx; x < cx + CELL; x++) {
+                    uint8_t* p = &pixels[((size_t)y * TEMPLATE_SIZE + x) * 4];
+                    p[0] = b; p[1] = g; p[2] = r; p[3] = 255;
+                }
+            }
+        }
+    }
+    return pixels;
+}
+
+// Plynulé pozadie, mení sa len okolie šablón (dlaždice ostatných sa preskočia)
+std::vector<uint8_t> MakeFrame(const std::vector<std::vector<uint8_t>>& templates, int frame) {
+    std::vector<uint8_t> pixels((size_t)FRAME_WIDTH * FRAME_HEIGHT * 4);
+    for (int y = 0; y < FRAME_HEIGHT; y++) {
+        for (int x = 0; x < FRAME_WIDTH; x++) {
+            uint8_t* p = &pixels[((size_t)y * FRAME_WIDTH + x) * 4];
+            p[0] = (uint8_t)(x / 3);
+            p[1] = (uint8_t)(y / 2);
+            p[2] = (uint8_t)((x + y) / 4);
+            p[3] = 255;
+        }
+    }
+
+    for (int region = 0; region < REGION_COUNT; region++) {
+        POINT at = PlantedAt(region, frame);
+        for (int y = 0; y < TEMPLATE_SIZE; y++) {
+            memcpy(&pixels[((size_t)(at.y + y) * FRAME_WIDTH + at.x) * 4],
+                &templates[region][(size_t)y * TEMPLATE_SIZE * 4], TEMPLATE_SIZE * 4);
+        }
+    }
+    return pixels;
+}
+
+// Zverejnený batch musí patriť snímke a mať v každom regióne práve zhodu jeho šablóny z nej
+void CheckBatch(const std::string& config, const CapturedFrame& frame, int frameIndex) {
+    auto batch = g_matchPublisher.Latest();
+    std::string where = config + " snímka " + std::to_string(frameIndex);
+
+    if (!batch || batch->frameSequence != frame.sequence) {
+        Fail(where + ": zverejnený batch je zo snímky " + std::to_string(batch ? batch->frameSequence : 0) +
+            ", očakávaná " + std::to_string(frame.sequence));
+        return;
+    }
+
+    int found[REGION_COUNT] = {};
+    for (const auto& match : batch->matches) {
+        if (match.templateId < 0 || match.templateId >= REGION_COUNT) {
+            Fail(where + ": neznáma šablóna " + std::to_string(match.templateId));
+            continue;
+        }
+
+        POINT at = PlantedAt(match.templateId, frameIndex);
+        if (match.x != at.x + TEMPLATE_SIZE / 2 || match.y != at.y + TEMPLATE_SIZE / 2) {
+            Fail(where + ": región " + REGIONS[match.templateId].name + " má zhodu na (" + std::to_string(match.x) +
+                ", " + std::to_string(match.y) + "), v snímke je na (" + std::to_string(at.x + TEMPLATE_SIZE / 2) +
+                ", " + std::to_string(at.y + TEMPLATE_SIZE / 2) + ")");
+        }
+        found[match.templateId]++;
+    }
+
+    for (int region = 0; region < REGION_COUNT; region++) {
+        if (found[region] != 1) {
+            Fail(where + ": región " + REGIONS[region].name + " má " + std::to_string(found[region]) + " zhôd");
+        }
+    }
+}
+
+void RunReplay(const std::string& config, const std::string& framesDir) {
+    MatcherContext context;  // Nový stav pipeline pre každú konfiguráciu
+    g_fileFrameSource.Open(framesDir);
+
+    for (int i = 0; i < REPLAY_FRAMES * REPLAY_PASSES; i++) {
+        CapturedFrame frame;
+        FrameLease lease;
+        RECT area = { 0, 0, FRAME_WIDTH, FRAME_HEIGHT };
+        if (!g_fileFrameSource.AcquireFrame(area, frame)) {
+            Fail(config + ": snímku " + std::to_string(i) + " sa nepodarilo načítať");
+            return;
+        }
+        lease.source = &g_fileFrameSource;
+
+        MatchFrame(context, frame);
+        CheckBatch(config, frame, i % REPLAY_FRAMES);
+    }
+}
+
+int main() {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "matcher_replay_test";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "obr");
+    std::filesystem::create_directories(root / "frames");
+
+    std::mt19937 rng(7);
+    std::vector<std::vector<uint8_t>> templates;
+    for (int region = 0; region < REGION_COUNT; region++) {
+        templates.push_back(MakeTemplate(rng));
+        std::string name = (root / "obr" / ("t" + std::to_string(region) + ".bmp")).string();
+        SaveBMP32(name, templates.back().data(), TEMPLATE_SIZE, TEMPLATE_SIZE);
+    }
+
+    for (int frame = 0; frame < REPLAY_FRAMES; frame++) {
+        auto pixels = MakeFrame(templates, frame);
+        std::string name = (root / "frames" / ("frame" + std::to_string(frame) + ".bmp")).string();
+        SaveBMP32(name, pixels.data(), FRAME_WIDTH, FRAME_HEIGHT);
+    }
+
+    g_maxKernelLevel = DetectKernelLevel();
+    g_workerPool.Start(4);
+
+    // Prvé načítanie zapíše balík, druhé šablóny číta zo zmapovaného balíka
+    LoadTemplateSet((root / "obr").string(), true);
+    auto set = LoadTemplateSet((root / "obr").string(), true);
+    if (set->templates.size() != REGION_COUNT) Fail("načítaných šablón: " + std::to_string(set->templates.size()));
+    PublishTemplateSet(set);
+    g_templateStats.resize(set->templates.size());
+
+    g_searchRegions.assign(REGIONS, REGIONS + REGION_COUNT);
+
+    for (int level = KERNEL_SCALAR; level <= g_maxKernelLevel; level++) {
+        for (int mode : { (int)CHANNELS_BGRA, (int)CHANNELS_LUMA }) {
+            for (bool pyramid : { true, false }) {
+                for (bool tracking : { false, true }) {
+                    g_settings.kernelLevel = level;
+                    g_settings.channelMode = mode;
+                    g_settings.usePyramidSearch = pyramid;  // Bez pyramídy sa dlaždice pozícií pamätajú zvlášť
+                    g_settings.useTracking = tracking;
+                    std::string config = std::string(GetKernels(level).configName) + "/" + CHANNEL_MODE_NAMES[mode] +
+                        (pyramid ? "/pyramída" : "") + (tracking ? "/sledovanie" : "");
+                    RunReplay(config, (root / "frames").string());
+                }
+            }
+        }
+    }
+
+    g_workerPool.Stop();
+    std::filesystem::remove_all(root);
+
+    if (g_failures) {
+        std::cout << g_failures << " chýb" << std::endl;
+        return 1;
+    }
+    std::cout << "OK: všetky regióny mali zhody zo zverejnenej snímky" << std::endl;
+    return 0;
+}